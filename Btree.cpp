@@ -1,80 +1,515 @@
 #include <iostream>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <stdexcept>
 #include <cstring>
+#include <cstddef>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
 // Constants and parameters for the B-Tree
-static const string MAGIC_NUMBER = "4337PRJ3";
+static const string MAGIC_NUMBER = "4337PRJ3";           // Files the original program reads correctly
+static const string MAGIC_NUMBER_EXTENDED = "4337PRJ4";  // Files it would misread: packed leaves, other
+                                                         // page sizes or block checksums
 static const int HEADER_SIZE = 512;
-static const size_t BLOCK_SIZE = 512;
-static const int MIN_DEGREE = 10;
-static const int MAX_KEYS = (2 * MIN_DEGREE - 1);  // Maximum number of keys in a node: 19
-static const int MAX_CHILDREN = (2 * MIN_DEGREE);  // Maximum number of children in a node: 20
+static const size_t DEFAULT_PAGE_SIZE = 512;        // Page size of new files unless chosen otherwise
+static const size_t MIN_PAGE_SIZE = 512;
+static const size_t MAX_PAGE_SIZE = 65536;
+static const uint64_t NODE_FORMAT_PLAIN = 1;        // Every node stores fixed 8-byte keys, values and children
+static const uint64_t NODE_FORMAT_PACKED = 2;       // Leaves store bit-packed key deltas and no children
+static const uint64_t DEFAULT_NODE_FORMAT = NODE_FORMAT_PACKED;
+static const uint64_t PACKED_LEAF_FLAG = 1ULL << 63; // Set in a packed-format leaf's numKeys word
+static const uint64_t FORMAT_VERSION_PARENT_IDS = 1; // Every node's second word holds its parent's block ID
+static const uint64_t FORMAT_VERSION_NO_PARENT_IDS = 2; // The second word is reserved and written as 0
+static const uint64_t FORMAT_VERSION_CHECKSUMS = 3; // The second word of every block holds its CRC32C
+static const uint64_t FORMAT_VERSION = FORMAT_VERSION_CHECKSUMS;
+static const uint64_t DEFAULT_COMMIT_INTERVAL = 1; // Commit after every operation
+static const size_t VERIFY_BATCH_BYTES = 1 << 20;  // Bytes each verify thread reads at a time
 
 // Forward declarations of big-endian functions (implemented elsewhere)
 uint64_t hostToBig(uint64_t x);
 uint64_t bigToHost(uint64_t x);
+void bigToHostArray(const uint8_t *src, uint64_t *dst, size_t n);
+void hostToBigArray(const uint64_t *src, uint8_t *dst, size_t n);
+
+// Forward declaration of the node key search (implemented elsewhere)
+int lowerBound(const uint64_t *keys, int n, uint64_t key);
+
+// Nanoseconds since start, for the latency statistics
+static uint64_t nanosSince(chrono::steady_clock::time_point start) {
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Node layout for one page size. An internal node block holds blockId, a reserved word and numKeys
+// followed by MAX_KEYS keys, MAX_KEYS values and MAX_CHILDREN child block IDs, all 64-bit
+// words, and the minimum degree is the largest one whose node fits the page. 512-byte pages
+// give the original layout with a minimum degree of 10 (19 keys per node). Leaves use the
+// same layout in the plain node format; in the packed format they hold a 5-word header
+// (blockId, reserved, numKeys, base key, delta width), the keys as bit-packed deltas from
+// the smallest key, then the values, so how many entries fit depends on how close the keys are.
+// The reserved word held the parent's block ID in files before format version 2; nodes do
+// not know their parent, since every operation reaches a node from the root. From format
+// version 3 on it holds the block's checksum, which the buffer pool stamps on write.
+template <size_t PageSize>
+struct NodeLayout {
+    static constexpr size_t BLOCK_SIZE = PageSize;
+    static constexpr int MIN_DEGREE = (int)(((PageSize / 8 - 4) / 3 + 1) / 2);
+    static constexpr int MAX_KEYS = 2 * MIN_DEGREE - 1;   // Maximum number of keys in a node
+    static constexpr int MAX_CHILDREN = 2 * MIN_DEGREE;   // Maximum number of children in a node
+    static constexpr size_t NODE_WORDS = 3 + 2 * MAX_KEYS + MAX_CHILDREN;  // 64-bit words stored per node
+
+    static constexpr size_t PACKED_HEADER_BYTES = 40;
+    // Entries a packed leaf holds even when its key deltas need all 64 bits
+    static constexpr int PACKED_LEAF_FIT_KEYS = (int)((PageSize - PACKED_HEADER_BYTES) / 16);
+    // Most entries a packed leaf may hold, so either half of a split plus one more key always fits
+    static constexpr int PACKED_LEAF_MAX_KEYS = 2 * (PACKED_LEAF_FIT_KEYS - 1);
+    static constexpr int KEY_CAPACITY = PACKED_LEAF_MAX_KEYS;  // Key slots in a decoded node
+
+    static_assert(NODE_WORDS * 8 <= PageSize, "Node does not fit in its page");
+    static_assert(PACKED_LEAF_MAX_KEYS >= MAX_KEYS, "Packed leaves must hold at least as much as plain ones");
+    static_assert(PACKED_LEAF_FIT_KEYS / 2 >= MIN_DEGREE - 1, "Split packed leaves must stay half full");
+    static_assert(MAX_KEYS <= PACKED_LEAF_FIT_KEYS, "Two merged packed leaves must fit one page");
+
+    // B-Tree node structure in memory (decoded from either node format)
+    struct Node {
+        uint64_t blockId;                  // The block ID where this node is stored
+        uint64_t numKeys;                  // Number of keys currently in this node
+        uint64_t keys[KEY_CAPACITY];       // Array of keys
+        uint64_t values[KEY_CAPACITY];     // Array of values corresponding to the keys
+        uint64_t children[MAX_CHILDREN];   // Array of child block IDs
+        bool isLeaf;                       // Flag indicating if the node is a leaf (no children)
+
+        Node() {
+            memset(this, 0, sizeof(Node));
+        }
+    };
+};
 
-// B-Tree node structure stored on disk
-struct BTreeNode {
-    uint64_t blockId;                  // The block ID where this node is stored
-    uint64_t parentId;                 // The block ID of this node's parent, 0 if root
-    uint64_t numKeys;                  // Number of keys currently in this node
-    uint64_t keys[MAX_KEYS];           // Array of keys
-    uint64_t values[MAX_KEYS];         // Array of values corresponding to the keys
-    uint64_t children[MAX_CHILDREN];   // Array of child block IDs
-    bool isLeaf;                       // Flag indicating if the node is a leaf (no children)
-
-    BTreeNode() {
-        memset(this, 0, sizeof(BTreeNode));
+// Number of bits needed to store x (0 for x == 0)
+static int bitWidth(uint64_t x) {
+    return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+// Bytes a packed leaf with n keys whose deltas take width bits occupies
+static size_t packedLeafBytes(uint64_t n, int width) {
+    return 40 + (n * width + 63) / 64 * 8 + n * 8;
+}
+
+// Pack the deltas keys[i] - base, width bits each, into big-endian words at out.
+// Returns the number of words written.
+static size_t packDeltas(uint8_t *out, const uint64_t *keys, int n, uint64_t base, int width) {
+    size_t words = 0;
+    uint64_t acc = 0;
+    int used = 0;
+    for (int i = 0; i < n && width > 0; i++) {
+        uint64_t delta = keys[i] - base;
+        acc |= delta << used;
+        used += width;
+        if (used >= 64) {
+            uint64_t be = hostToBig(acc);
+            memcpy(out + 8 * words++, &be, 8);
+            used -= 64;
+            acc = used > 0 ? delta >> (width - used) : 0;
+        }
     }
+    if (used > 0) {
+        uint64_t be = hostToBig(acc);
+        memcpy(out + 8 * words++, &be, 8);
+    }
+    return words;
+}
+
+// Read the i-th width-bit delta from words packed by packDeltas
+static uint64_t unpackDelta(const uint8_t *packed, int width, uint64_t i) {
+    if (width == 0) return 0;
+    uint64_t bit = i * (uint64_t)width;
+    size_t word = bit / 64;
+    int shift = (int)(bit % 64);
+    uint64_t be;
+    memcpy(&be, packed + 8 * word, 8);
+    uint64_t delta = bigToHost(be) >> shift;
+    if (shift + width > 64) {
+        memcpy(&be, packed + 8 * (word + 1), 8);
+        delta |= bigToHost(be) << (64 - shift);
+    }
+    return width == 64 ? delta : delta & ((1ULL << width) - 1);
+}
+
+// Page sizes the tree is compiled for: powers of two from MIN_PAGE_SIZE to MAX_PAGE_SIZE
+static bool isSupportedPageSize(size_t pageSize) {
+    return pageSize >= MIN_PAGE_SIZE && pageSize <= MAX_PAGE_SIZE && (pageSize & (pageSize - 1)) == 0;
+}
+
+// Page size recorded in a header block. Files written before the page size was recorded
+// leave the field zero and use 512-byte pages.
+// True if a header starts with either magic number
+static bool hasIndexMagic(const char *header) {
+    return strncmp(header, MAGIC_NUMBER.c_str(), MAGIC_NUMBER.size()) == 0
+           || strncmp(header, MAGIC_NUMBER_EXTENDED.c_str(), MAGIC_NUMBER_EXTENDED.size()) == 0;
+}
+
+static size_t readHeaderPageSize(const char *header) {
+    uint64_t bePageSize = 0;
+    memcpy(&bePageSize, header+24, sizeof(bePageSize));
+    uint64_t pageSize = bigToHost(bePageSize);
+    return pageSize == 0 ? 512 : (size_t)pageSize;
+}
+
+// Block order of a compacted index file
+enum class CompactOrder {
+    BreadthFirst,   // Level by level: the upper levels together, then all leaves in key order
+    KeyOrder        // Depth-first: each subtree in one contiguous run, ascending with the keys
 };
 
-class BTree {
+// What a write does with an existing and a missing key
+enum class WriteMode {
+    Insert,         // Add a missing key; leave an existing one alone
+    Upsert,         // Add a missing key or replace an existing key's value
+    Update          // Replace an existing key's value; leave a missing key missing
+};
+
+// Ordered position in an index, implemented by each page size's tree
+class IndexCursor {
+public:
+    virtual ~IndexCursor() {}
+    virtual bool seek(uint64_t key) = 0;
+    virtual bool first() = 0;
+    virtual bool last() = 0;
+    virtual bool next() = 0;
+    virtual bool prev() = 0;
+    virtual bool valid() const = 0;
+    virtual uint64_t key() const = 0;
+    virtual uint64_t value() const = 0;
+};
+
+// Read-only view of one published version of a tree, implemented by each page size's tree.
+// Destroying it lets the blocks only that version uses be reclaimed.
+class IndexSnapshot {
+public:
+    virtual ~IndexSnapshot() {}
+    virtual uint64_t rootBlockId() const = 0;
+    virtual uint64_t version() const = 0;
+    virtual IndexCursor *newCursor() = 0;
+    virtual void exportEntries(int fd, char separator, unsigned threads) = 0;
+};
+
+// Operations of a B-Tree over one index file, independent of its page size.
+// BTree forwards to the implementation compiled for the open file's page size.
+class IndexTree {
+public:
+    virtual ~IndexTree() {}
+
+    virtual size_t pageSize() const = 0;
+    virtual void createIndex(const string &path) = 0;
+    virtual void openIndex(const string &path) = 0;
+    virtual bool isOpen() const = 0;
+    virtual bool insert(uint64_t key, uint64_t value) = 0;
+    virtual bool write(uint64_t key, uint64_t value, WriteMode mode, uint64_t &previous) = 0;
+    virtual bool search(uint64_t key, uint64_t &value) = 0;
+    virtual bool erase(uint64_t key) = 0;
+    virtual void multiGet(const vector<uint64_t> &keys, vector<uint64_t> &values, vector<bool> &found) = 0;
+    virtual void sync() = 0;
+    virtual void compact(CompactOrder order) = 0;
+    virtual void exportEntries(int fd, char separator, unsigned threads) = 0;
+    virtual vector<uint64_t> splitKeys(size_t wanted) = 0;
+    virtual void load(const string &path) = 0;
+    virtual void bulkLoad(const string &path) = 0;
+    virtual IndexCursor *newCursor() = 0;
+    virtual IndexSnapshot *openSnapshot() = 0;
+    virtual uint64_t blocksRead() const = 0;
+    virtual uint64_t blocksWritten() const = 0;
+    virtual IndexStats stats() const = 0;
+    virtual TreeShape shape() = 0;
+    virtual VerifyReport verify(unsigned threads) = 0;
+    virtual void resetStats() = 0;
+
+    virtual void insertCommand() = 0;
+    virtual void upsertCommand() = 0;
+    virtual void updateCommand() = 0;
+    virtual void searchCommand() = 0;
+    virtual void deleteCommand() = 0;
+    virtual void multiGetCommand() = 0;
+    virtual void loadCommand() = 0;
+    virtual void rangeCommand() = 0;
+    virtual void scanCommand() = 0;
+    virtual void bulkLoadCommand() = 0;
+    virtual void compactCommand() = 0;
+    virtual void printCommand() = 0;
+    virtual void extractCommand() = 0;
+    virtual void syncCommand() = 0;
+    virtual void statsCommand() = 0;
+    virtual void verifyCommand() = 0;
+    virtual void resetStatsCommand() = 0;
+
+    virtual void setCommitInterval(uint64_t n) = 0;
+    virtual void setStorageKind(StorageKind kind) = 0;
+    virtual void setNodeFormat(uint64_t format) = 0;
+    virtual void setWalEnabled(bool enabled) = 0;
+    virtual void setCopyOnWrite(bool enabled) = 0;
+    virtual bool copyOnWriteEnabled() const = 0;
+    virtual void setReadAhead(IoEngine engine, size_t depth) = 0;
+    virtual const char *readAheadEngine() const = 0;
+    virtual void setBloomFilter(double rate, size_t maxBytes) = 0;
+    virtual void closeFile() = 0;
+};
+
+// Disk-based B-Tree over one index file, compiled for one node layout.
+//
+// search, insert and erase may be called from many threads at once. Each block has a
+// reader/writer latch and descents use latch crabbing: a reader holds the latch of
+// the node it is in until it has latched the child, an inserter splits full children
+// on the way down and an eraser tops up children holding the minimum number of keys,
+// so neither needs the parent again once the child is latched. rootLatch guards
+// rootBlockId, freeListLatch the free block list, and writers hold commitLatch shared
+// so a commit can wait until no block is half modified. Everything else (create, open,
+// close, load, bulkload, compact, print, extract and cursors) expects no concurrent writers.
+//
+// In copy-on-write mode a writer never changes a block that a published version can
+// reach: before changing such a node it copies it to a new block (shadowNode) and points
+// the parent, or the root, at the copy, so each write copies its path up to a new root.
+// Blocks written since the last publish are changed in place, under the same latches as
+// above. Commits and openSnapshot publish the working tree as a new version. A snapshot
+// reads its version's blocks without latches, and replaced blocks are retired until no
+// open snapshot is older than the version that replaced them, then go on the free list.
+template <typename Layout>
+class PagedBTree : public IndexTree {
 private:
-    fstream file;         // File stream for reading/writing the index file
+    typedef typename Layout::Node BTreeNode;
+    static constexpr size_t BLOCK_SIZE = Layout::BLOCK_SIZE;
+    static constexpr int MIN_DEGREE = Layout::MIN_DEGREE;
+    static constexpr int MAX_KEYS = Layout::MAX_KEYS;
+    static constexpr int MAX_CHILDREN = Layout::MAX_CHILDREN;
+    static constexpr size_t NODE_WORDS = Layout::NODE_WORDS;
+    static constexpr int PACKED_LEAF_FIT_KEYS = Layout::PACKED_LEAF_FIT_KEYS;
+    static constexpr int PACKED_LEAF_MAX_KEYS = Layout::PACKED_LEAF_MAX_KEYS;
+
+    unique_ptr<Storage> storage;  // Backend for reading/writing the index file
+    StorageKind storageKind;      // Backend used for the next create/open
+    bool walEnabled;              // Log writes to <index>.wal before they reach the index
     string fileName;      // Name of the currently opened file
     uint64_t rootBlockId; // Block ID of the root node
-    uint64_t nextBlockId; // Next available block ID for new nodes
+    atomic<uint64_t> nextBlockId; // Next available block ID for new nodes
+    uint64_t freeListHead;        // First block of the free block list, 0 if empty
     bool fileOpen;        // Flag indicating if a file is currently open
+    uint64_t nodeFormat;  // Node format of the open file
+    uint64_t newNodeFormat;       // Node format used by the next create
+    uint64_t formatVersion;       // Format version of the open file, written to its header
+    BufferPool pool;      // Cache of recently used node blocks
+    atomic<bool> headerDirty;     // Root or next block ID changed since the last commit
+    uint64_t commitInterval;      // Operations per commit, 0 for explicit sync only
+    atomic<uint64_t> opsSinceCommit; // Operations applied since the last commit
+    LatchTable latches;           // Per-block reader/writer latches
+    shared_mutex rootLatch;       // Protects rootBlockId
+    shared_mutex commitLatch;     // Held shared by writers, exclusively by commit
+    mutex freeListLatch;          // Protects freeListHead and the links in free blocks
+    IndexCounters counters;       // Operation statistics since open or the last reset
+    uint64_t blockReadsBase;      // Buffer pool and storage totals at that point
+    uint64_t blockPrefetchesBase;
+    uint64_t blockWritesBase;
+    uint64_t fsyncsBase;
+    unique_ptr<BloomFilter> filter; // Keys that may be in the tree, null when the filter is off
+    double bloomRate;             // Filter false-positive rate for the next create/open, 0 for none
+    size_t bloomMaxBytes;         // Memory the filter may use, 0 for no limit
+    atomic<uint64_t> filterGeneration; // Generation of the tree's contents recorded in the header
+    uint64_t openedGeneration;    // Generation the header had when the file was opened
+    atomic<bool> filterSaved;     // The sidecar file holds the filter for filterGeneration
+    bool copyOnWrite;             // Writes copy published blocks instead of changing them
+    bool newCopyOnWrite;          // Update mode used by the next create/open
+    mutable mutex versionLatch;   // Protects everything below
+    uint64_t publishedVersion;    // Version new snapshots see, counted from open
+    uint64_t publishedRoot;       // Root block of that version
+    unordered_set<uint64_t> freshBlocks; // Blocks allocated since the last publish
+    struct RetiredBlock {
+        uint64_t blockId;
+        uint64_t version;         // Last version that can reach the block
+    };
+    deque<RetiredBlock> retiredBlocks;   // Replaced blocks, oldest first
+    multiset<uint64_t> snapshotVersions; // Versions of the open snapshots
+
+    // Magic number of the open file: the original one only while the original program
+    // could still read and change the file correctly (512-byte pages, plain nodes, no
+    // block checksums), so older builds reject files they would misread
+    const string &magicNumber() const {
+        bool original = BLOCK_SIZE == 512 && nodeFormat == NODE_FORMAT_PLAIN
+                        && formatVersion < FORMAT_VERSION_CHECKSUMS;
+        return original ? MAGIC_NUMBER : MAGIC_NUMBER_EXTENDED;
+    }
 
-    // Write the B-Tree header into the file (contains magic number, root ID, next block ID)
+    // Write the B-Tree header into the file (contains magic number, root ID, next block ID,
+    // page size, node format, the first block of the free list, the format version and the
+    // generation the Bloom filter sidecar must match)
     void writeHeader() {
-        file.seekp(0, ios::beg);
         char header[HEADER_SIZE];
         memset(header, 0, HEADER_SIZE);
 
         // Copy magic number to header
-        memcpy(header, MAGIC_NUMBER.c_str(), MAGIC_NUMBER.size());
+        const string &magic = magicNumber();
+        memcpy(header, magic.c_str(), magic.size());
 
         // Convert and store rootBlockId and nextBlockId in big-endian
         uint64_t beRoot = hostToBig(rootBlockId);
-        uint64_t beNext = hostToBig(nextBlockId);
+        uint64_t beNext = hostToBig(nextBlockId.load());
         memcpy(header+8, &beRoot, sizeof(beRoot));
         memcpy(header+16, &beNext, sizeof(beNext));
+        uint64_t bePageSize = hostToBig(BLOCK_SIZE);
+        memcpy(header+24, &bePageSize, sizeof(bePageSize));
+        uint64_t beFormat = hostToBig(nodeFormat);
+        memcpy(header+32, &beFormat, sizeof(beFormat));
+        uint64_t beFree = hostToBig(freeListHead);
+        memcpy(header+40, &beFree, sizeof(beFree));
+        uint64_t beVersion = hostToBig(formatVersion);
+        memcpy(header+48, &beVersion, sizeof(beVersion));
+        uint64_t beGeneration = hostToBig(filterGeneration.load());
+        memcpy(header+56, &beGeneration, sizeof(beGeneration));
 
         // Write header to file
-        file.write(header, HEADER_SIZE);
-        file.flush();
+        storage->write(0, header, HEADER_SIZE);
+        storage->setLogicalSize(nextBlockId * BLOCK_SIZE);
+        headerDirty = false;
+    }
+
+    // Commit point: write dirty blocks back in block order, then the header, then flush
+    // (which with the write-ahead log appends a commit record and fsyncs the log). In
+    // copy-on-write mode the committed tree is also published, so the header's root is
+    // the root of the newest version.
+    void commit() {
+        auto start = chrono::steady_clock::now();
+        unique_lock<shared_mutex> quiesce(commitLatch);
+        if (copyOnWrite) publishVersion();
+        pool.flushAll();
+        if (headerDirty) {
+            writeHeader();
+        }
+        storage->flush();
+        opsSinceCommit = 0;
+        IndexCounters::add(counters.commits);
+        counters.commit.record(nanosSince(start));
+    }
+
+    // Make the working tree the version new snapshots see, and put the retired blocks no
+    // open snapshot can reach any more on the free list. Called with commitLatch held
+    // exclusively, so no write is half done. Freeing a block changes it, which the
+    // write-ahead log commits together with the header that no longer reaches the block.
+    void publishVersion() {
+        vector<uint64_t> reclaimed;
+        {
+            lock_guard<mutex> guard(versionLatch);
+            publishedVersion++;
+            publishedRoot = rootBlockId;
+            freshBlocks.clear();
+            uint64_t oldest = snapshotVersions.empty() ? publishedVersion : *snapshotVersions.begin();
+            while (!retiredBlocks.empty() && retiredBlocks.front().version < oldest) {
+                reclaimed.push_back(retiredBlocks.front().blockId);
+                retiredBlocks.pop_front();
+            }
+        }
+        for (uint64_t blockId : reclaimed) {
+            freeBlock(blockId);
+        }
+    }
+
+    // Forget all versions, for a file just created, opened or rebuilt: its whole tree is
+    // the first published version
+    void resetVersions() {
+        lock_guard<mutex> guard(versionLatch);
+        publishedVersion = 1;
+        publishedRoot = rootBlockId;
+        freshBlocks.clear();
+        retiredBlocks.clear();
+    }
+
+    bool snapshotsOpen() const {
+        lock_guard<mutex> guard(versionLatch);
+        return !snapshotVersions.empty();
+    }
+
+    // Throw if snapshots are open, before an operation that replaces the whole file
+    void requireNoSnapshots(const string &operation) {
+        if (snapshotsOpen()) {
+            throw runtime_error("Close open snapshots before " + operation + ".");
+        }
+    }
+
+    // Count a completed operation and commit if the durability mode asks for it
+    void finishOperation() {
+        uint64_t ops = ++opsSinceCommit;
+        if (commitInterval != 0 && ops >= commitInterval) {
+            commit();
+        }
+    }
+
+    // Create the selected storage backend. Unless logged is false or the log is turned off,
+    // writes go through the write-ahead log.
+    unique_ptr<Storage> makeStorage(bool logged) {
+        unique_ptr<Storage> backend;
+        if (storageKind == StorageKind::Mmap) {
+            backend.reset(new MmapStorage());
+        } else if (storageKind == StorageKind::Pread) {
+            backend.reset(new PreadStorage());
+        } else {
+            backend.reset(new StreamStorage());
+        }
+        if (logged && walEnabled) {
+            backend.reset(new WalStorage(move(backend)));
+        }
+        return backend;
+    }
+
+    // Open the index file with the selected storage backend and attach the buffer pool
+    bool openStorage(const string &path, bool create, bool logged = true) {
+        storage = makeStorage(logged);
+        if (!storage->open(path, create)) {
+            storage.reset();
+            return false;
+        }
+        pool.attach(storage.get());
+        return true;
+    }
+
+    // Give a file that is being created or written from scratch the current format version,
+    // whose blocks carry checksums
+    void useCurrentFormat() {
+        formatVersion = FORMAT_VERSION;
+        pool.setChecksums(true);
+    }
+
+    // Drop cached blocks and close the storage (callers commit first)
+    void closeStorage() {
+        pool.discard();
+        if (storage) {
+            storage->close();
+            storage.reset();
+        }
+        pool.attach(nullptr);
     }
 
     // Read and validate the B-Tree header from the file
     void readHeader() {
-        file.seekg(0, ios::beg);
-        char header[HEADER_SIZE] = {0};
-        file.read(header, HEADER_SIZE);
-
         // Check if the header is correctly sized
-        if ((size_t)file.gcount() < HEADER_SIZE) {
+        if (storage->size() < (uint64_t)HEADER_SIZE) {
             throw runtime_error("Invalid file header.");
         }
+        char header[HEADER_SIZE] = {0};
+        storage->read(0, header, HEADER_SIZE);
 
         // Validate the magic number
-        if (strncmp(header, MAGIC_NUMBER.c_str(), MAGIC_NUMBER.size()) != 0) {
+        if (!hasIndexMagic(header)) {
             throw runtime_error("Magic number mismatch.");
         }
 
@@ -85,48 +520,174 @@ private:
         memcpy(&beNext, header+16, sizeof(beNext));
         rootBlockId = bigToHost(beRoot);
         nextBlockId = bigToHost(beNext);
+
+        if (readHeaderPageSize(header) != BLOCK_SIZE) {
+            throw runtime_error("Page size mismatch.");
+        }
+
+        // Files written before the node format was recorded use the plain format
+        uint64_t beFormat = 0;
+        memcpy(&beFormat, header+32, sizeof(beFormat));
+        nodeFormat = bigToHost(beFormat);
+        if (nodeFormat == 0) nodeFormat = NODE_FORMAT_PLAIN;
+        if (nodeFormat != NODE_FORMAT_PLAIN && nodeFormat != NODE_FORMAT_PACKED) {
+            throw runtime_error("Unsupported node format.");
+        }
+
+        // Files written before the free list was recorded have none
+        uint64_t beFree = 0;
+        memcpy(&beFree, header+40, sizeof(beFree));
+        freeListHead = bigToHost(beFree);
+
+        // Files written before the version was recorded keep parent IDs in their nodes.
+        // Nothing reads them, so such files are upgraded by rewriting the header at the next
+        // commit; the stale IDs are cleared as their nodes are rewritten. Files without
+        // checksums keep going without them until compaction rewrites every block.
+        uint64_t beVersion = 0;
+        memcpy(&beVersion, header+48, sizeof(beVersion));
+        uint64_t version = bigToHost(beVersion);
+        if (version == 0) version = FORMAT_VERSION_PARENT_IDS;
+        if (version > FORMAT_VERSION) {
+            throw runtime_error("Unsupported format version.");
+        }
+        formatVersion = max(version, FORMAT_VERSION_NO_PARENT_IDS);
+        headerDirty = version != formatVersion;
+        pool.setChecksums(formatVersion >= FORMAT_VERSION_CHECKSUMS);
+        // Earlier builds wrote the original magic whatever the layout; such files get the
+        // magic their layout calls for at the next commit
+        if (strncmp(header, magicNumber().c_str(), magicNumber().size()) != 0) headerDirty = true;
+
+        // Files without a generation (or whose header an older build rewrote) have no
+        // trustworthy Bloom filter sidecar
+        uint64_t beGeneration = 0;
+        memcpy(&beGeneration, header+56, sizeof(beGeneration));
+        filterGeneration = bigToHost(beGeneration);
     }
 
-    // Load a node from the file at a given block ID
-    BTreeNode loadNode(uint64_t blockId) {
-        file.seekg(blockId * BLOCK_SIZE, ios::beg);
-        uint8_t buffer[BLOCK_SIZE];
-        memset(buffer, 0, BLOCK_SIZE);
-        file.read((char*)buffer, BLOCK_SIZE);
+    // Name of the Bloom filter sidecar file next to the index
+    string filterPath() const {
+        return fileName + ".bloom";
+    }
 
-        BTreeNode node;
+    // Generation after g: the next number, or one taken from the clock for a file that had
+    // none, so it does not match a sidecar left behind by an earlier file of the same name
+    static uint64_t nextGeneration(uint64_t g) {
+        if (g != 0) return g + 1;
+        return (uint64_t)chrono::system_clock::now().time_since_epoch().count() | 1;
+    }
 
-        // Extract blockId, parentId, and numKeys from the node block
-        uint64_t beBlockId, beParentId, beNumKeys;
-        memcpy(&beBlockId, buffer, 8);
-        memcpy(&beParentId, buffer+8, 8);
-        memcpy(&beNumKeys, buffer+16, 8);
+    // Called by writers before they change the tree. The first change after open moves the
+    // header to a new generation, committed together with the change, so a sidecar saved
+    // for the old contents is never trusted after a crash (with the filter on or off).
+    void markModified() {
+        uint64_t opened = openedGeneration;
+        if (opened == 0 || filterGeneration.load(memory_order_relaxed) != opened) return;
+        if (filterGeneration.compare_exchange_strong(opened, nextGeneration(opened))) {
+            filterSaved = false;
+            headerDirty = true;
+        }
+    }
+
+    // Ask the Bloom filter about a key before descending for it; false means the key is
+    // certainly not in the tree. Callers count a let-through key that turns out missing
+    // with countFalsePositive.
+    bool filterAllows(uint64_t key) {
+        if (!filter) return true;
+        IndexCounters::add(counters.bloomChecks);
+        if (filter->mayContain(key)) return true;
+        IndexCounters::add(counters.bloomSkips);
+        return false;
+    }
 
-        node.blockId = bigToHost(beBlockId);
-        node.parentId = bigToHost(beParentId);
-        node.numKeys = bigToHost(beNumKeys);
+    void countFalsePositive() {
+        if (filter) IndexCounters::add(counters.bloomFalsePositives);
+    }
 
-        // Extract keys
-        for (int i=0; i<MAX_KEYS; i++) {
-            uint64_t beKey;
-            memcpy(&beKey, buffer+24+(i*8), 8);
-            node.keys[i] = bigToHost(beKey);
+    // Mark every key of the subtree rooted at blockId in the filter
+    void addSubtreeToFilter(uint64_t blockId) {
+        BTreeNode node = loadNodeShared(blockId);
+        for (int i=0; i<(int)node.numKeys; i++) {
+            if (!node.isLeaf) {
+                prefetchChildren(node, i, 1, MAX_CHILDREN);
+                addSubtreeToFilter(node.children[i]);
+            }
+            filter->add(node.keys[i]);
         }
+        if (!node.isLeaf) addSubtreeToFilter(node.children[node.numKeys]);
+    }
 
-        // Extract values
-        for (int i=0; i<MAX_KEYS; i++) {
-            uint64_t beVal;
-            memcpy(&beVal, buffer+24+(MAX_KEYS*8)+(i*8), 8);
-            node.values[i] = bigToHost(beVal);
+    // Build the filter from the tree, sized for keysHint keys or, without a hint, for as
+    // many keys as the file's blocks would hold written by a bulk build. If the tree holds
+    // more, the filter grows while it is built, and it is built once more at the size the
+    // key count calls for.
+    void rebuildFilter(uint64_t keysHint = 0) {
+        uint64_t estimate = keysHint != 0 ? keysHint : (nextBlockId - 1) * (uint64_t)bulkLeafKeys();
+        filter.reset(new BloomFilter(bloomRate, bloomMaxBytes, BloomFilter::capacityFor(estimate)));
+        filterSaved = false;
+        if (rootBlockId == 0) return;
+        storage->advise(AccessPattern::Sequential);
+        addSubtreeToFilter(rootBlockId);
+        if (filter->layers() > 1) {
+            filter.reset(new BloomFilter(bloomRate, bloomMaxBytes, BloomFilter::capacityFor(filter->keys())));
+            addSubtreeToFilter(rootBlockId);
         }
+        storage->advise(AccessPattern::Random);
+    }
 
-        // Extract children block IDs
-        for (int i=0; i<MAX_CHILDREN; i++) {
-            uint64_t beChild;
-            memcpy(&beChild, buffer+24+(MAX_KEYS*8)+(MAX_KEYS*8)+(i*8), 8);
-            node.children[i] = bigToHost(beChild);
+    // Set up the filter of a file just opened: load the sidecar if it was saved for the
+    // header's generation and is not stale, else rebuild the filter from the tree (sized
+    // by the stale filter's key count when there is one)
+    void openFilter() {
+        filter.reset();
+        filterSaved = false;
+        openedGeneration = filterGeneration;
+        if (bloomRate <= 0) return;
+        uint64_t keysHint = 0;
+        if (filterGeneration != 0) {
+            filter = BloomFilter::load(filterPath(), filterGeneration, bloomMaxBytes);
+            if (filter && !filter->stale(bloomRate, bloomMaxBytes)) {
+                filterSaved = true;
+                return;
+            }
+            if (filter) keysHint = filter->keys() - filter->keysRemoved();
+        }
+        rebuildFilter(keysHint);
+    }
+
+    // True if a block holds a leaf in the packed node format
+    bool isPackedLeaf(const uint8_t *buffer) const {
+        if (nodeFormat != NODE_FORMAT_PACKED) return false;
+        uint64_t beNumKeys;
+        memcpy(&beNumKeys, buffer+16, 8);
+        return (bigToHost(beNumKeys) & PACKED_LEAF_FLAG) != 0;
+    }
+
+    // Decode a node block into its in-memory form
+    void decodeNode(const uint8_t *buffer, BTreeNode &node) const {
+        uint64_t words[3];
+        bigToHostArray(buffer, words, 3);
+        node.blockId = words[0];
+        node.numKeys = words[2];
+        if (isPackedLeaf(buffer)) {
+            node.numKeys &= ~PACKED_LEAF_FLAG;
+            uint64_t beBase, beWidth;
+            memcpy(&beBase, buffer+24, 8);
+            memcpy(&beWidth, buffer+32, 8);
+            uint64_t base = bigToHost(beBase);
+            int width = (int)bigToHost(beWidth);
+            const uint8_t *packed = buffer + Layout::PACKED_HEADER_BYTES;
+            for (uint64_t i = 0; i < node.numKeys; i++) {
+                node.keys[i] = base + unpackDelta(packed, width, i);
+            }
+            bigToHostArray(packed + (node.numKeys * width + 63) / 64 * 8, node.values, node.numKeys);
+            node.isLeaf = true;
+            return;
         }
 
+        bigToHostArray(buffer+24, node.keys, MAX_KEYS);
+        bigToHostArray(buffer+24+(MAX_KEYS*8), node.values, MAX_KEYS);
+        bigToHostArray(buffer+24+(MAX_KEYS*8)+(MAX_KEYS*8), node.children, MAX_CHILDREN);
+
         // Determine if the node is a leaf (no children)
         bool leaf = true;
         for (int i=0; i<MAX_CHILDREN; i++) {
@@ -136,93 +697,348 @@ private:
             }
         }
         node.isLeaf = leaf;
+    }
+
+    // Encode a node into its block, in the open file's node format
+    void encodeNode(const BTreeNode &node, uint8_t *buffer) const {
+        if (nodeFormat == NODE_FORMAT_PACKED && node.isLeaf) {
+            int n = (int)node.numKeys;
+            uint64_t base = n > 0 ? node.keys[0] : 0;
+            int width = n > 0 ? bitWidth(node.keys[n-1] - base) : 0;
+            if (packedLeafBytes(n, width) > BLOCK_SIZE) {
+                throw runtime_error("Leaf does not fit in its page.");
+            }
+            uint64_t header[5] = {node.blockId, 0, node.numKeys | PACKED_LEAF_FLAG, base, (uint64_t)width};
+            hostToBigArray(header, buffer, 5);
+            uint8_t *packed = buffer + Layout::PACKED_HEADER_BYTES;
+            size_t words = packDeltas(packed, node.keys, n, base, width);
+            hostToBigArray(node.values, packed + words * 8, n);
+            return;
+        }
+
+        uint64_t header[3] = {node.blockId, 0, node.numKeys};
+        hostToBigArray(header, buffer, 3);
+        hostToBigArray(node.keys, buffer+24, MAX_KEYS);
+        hostToBigArray(node.values, buffer+24+(MAX_KEYS*8), MAX_KEYS);
+        hostToBigArray(node.children, buffer+24+(MAX_KEYS*8)+(MAX_KEYS*8), MAX_CHILDREN);
+    }
 
+    // Binary search a packed leaf block in place; returns true and sets valueOut if key is there
+    bool searchPackedLeaf(const uint8_t *buffer, uint64_t key, uint64_t &valueOut) const {
+        uint64_t words[5];
+        bigToHostArray(buffer, words, 5);
+        uint64_t n = words[2] & ~PACKED_LEAF_FLAG;
+        uint64_t base = words[3];
+        int width = (int)words[4];
+        if (n == 0 || key < base) return false;
+        uint64_t delta = key - base;
+        if (width < 64 && (delta >> width) != 0) return false;
+
+        const uint8_t *packed = buffer + Layout::PACKED_HEADER_BYTES;
+        uint64_t lo = 0, hi = n;
+        while (lo < hi) {
+            uint64_t mid = (lo + hi) / 2;
+            if (unpackDelta(packed, width, mid) < delta) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == n || unpackDelta(packed, width, lo) != delta) return false;
+        uint64_t beValue;
+        memcpy(&beValue, packed + (n * width + 63) / 64 * 8 + lo * 8, 8);
+        valueOut = bigToHost(beValue);
+        return true;
+    }
+
+    // True if a leaf can take key without splitting first
+    bool leafHasRoom(const BTreeNode &leaf, uint64_t key) const {
+        int n = (int)leaf.numKeys;
+        if (nodeFormat == NODE_FORMAT_PLAIN) return n < MAX_KEYS;
+        if (n == 0) return true;
+        if (n >= PACKED_LEAF_MAX_KEYS) return false;
+        uint64_t low = min(leaf.keys[0], key);
+        uint64_t high = max(leaf.keys[n-1], key);
+        return packedLeafBytes(n + 1, bitWidth(high - low)) <= BLOCK_SIZE;
+    }
+
+    // True if a node has to be split before key can be inserted below it
+    bool needsSplit(const BTreeNode &node, uint64_t key) const {
+        return node.isLeaf ? !leafHasRoom(node, key) : (int)node.numKeys == MAX_KEYS;
+    }
+
+    // Keys per leaf written by a bulk build, chosen so every leaf fits whatever its keys
+    int bulkLeafKeys() const {
+        return nodeFormat == NODE_FORMAT_PLAIN ? MAX_KEYS : PACKED_LEAF_FIT_KEYS;
+    }
+
+    // Load a node at a given block ID through the buffer pool
+    BTreeNode loadNode(uint64_t blockId) {
+        IndexCounters::add(counters.nodeLoads);
+        const uint8_t *buffer = pool.pin(blockId);
+        BTreeNode node;
+        decodeNode(buffer, node);
+        pool.unpin(blockId, false);
         return node;
     }
 
-    // Save a node's data to the file at its block ID
+    // Load a node under a shared latch, for traversals that do not crab
+    BTreeNode loadNodeShared(uint64_t blockId) {
+        LatchGuard latch(latches, blockId, false);
+        return loadNode(blockId);
+    }
+
+    // Load a node for such a traversal of the live tree, or of a snapshot, whose blocks
+    // do not change and are read without latches
+    BTreeNode loadNodeIn(uint64_t blockId, bool snapshot) {
+        return snapshot ? loadNode(blockId) : loadNodeShared(blockId);
+    }
+
+    // Save a node's data into its block's buffer pool frame (written back when flushed or evicted)
     void saveNode(const BTreeNode &node) {
-        file.seekp(node.blockId * BLOCK_SIZE, ios::beg);
-        uint8_t buffer[BLOCK_SIZE];
-        memset(buffer, 0, BLOCK_SIZE);
+        IndexCounters::add(counters.nodeSaves);
+        uint8_t *buffer = pool.pin(node.blockId, false);
 
-        // Convert fields to big-endian before writing
-        uint64_t beBlockId = hostToBig(node.blockId);
-        uint64_t beParentId = hostToBig(node.parentId);
-        uint64_t beNumKeys = hostToBig(node.numKeys);
+        encodeNode(node, buffer);
+        pool.unpin(node.blockId, true);
+    }
+
+    // Take a block off the free list, or extend the file by one block when the list is empty
+    // (the header is written at the next commit). In copy-on-write mode the block is fresh:
+    // no published version reaches it, so it is changed in place until the next publish.
+    uint64_t allocateBlock() {
+        uint64_t blockId;
+        {
+            lock_guard<mutex> guard(freeListLatch);
+            headerDirty = true;
+            if (freeListHead == 0) {
+                IndexCounters::add(counters.blocksAppended);
+                blockId = nextBlockId.fetch_add(1);
+            } else {
+                IndexCounters::add(counters.blocksReused);
+                blockId = freeListHead;
+                const uint8_t *buffer = pool.pin(blockId);
+                uint64_t beNext;
+                memcpy(&beNext, buffer, sizeof(beNext));
+                pool.unpin(blockId, false);
+                freeListHead = bigToHost(beNext);
+            }
+        }
+        if (copyOnWrite) {
+            lock_guard<mutex> guard(versionLatch);
+            freshBlocks.insert(blockId);
+        }
+        return blockId;
+    }
 
-        memcpy(buffer, &beBlockId, 8);
-        memcpy(buffer+8, &beParentId, 8);
-        memcpy(buffer+16, &beNumKeys, 8);
+    // Put a block no node uses any more on the free list. A free block holds the ID of the
+    // next free block in its first word and zeros elsewhere.
+    void freeBlock(uint64_t blockId) {
+        lock_guard<mutex> guard(freeListLatch);
+        uint8_t *buffer = pool.pin(blockId, false);
+        memset(buffer, 0, BLOCK_SIZE);
+        uint64_t beNext = hostToBig(freeListHead);
+        memcpy(buffer, &beNext, sizeof(beNext));
+        pool.unpin(blockId, true);
+        freeListHead = blockId;
+        headerDirty = true;
+        IndexCounters::add(counters.blocksFreed);
+    }
+
+    // Give up a block the tree no longer uses. In copy-on-write mode a block that a
+    // published version can reach is retired instead, until no snapshot can reach it.
+    void releaseBlock(uint64_t blockId) {
+        if (copyOnWrite) {
+            lock_guard<mutex> guard(versionLatch);
+            if (freshBlocks.count(blockId) == 0) {
+                retiredBlocks.push_back(RetiredBlock{blockId, publishedVersion});
+                return;
+            }
+        }
+        freeBlock(blockId);
+    }
 
-        // Store keys
-        for (int i=0; i<MAX_KEYS; i++) {
-            uint64_t beKey = hostToBig(node.keys[i]);
-            memcpy(buffer+24+(i*8), &beKey, 8);
+    // Before a latched node is changed in copy-on-write mode, move it to a new block if a
+    // published version can reach it: the node is saved there, latch moves to the new
+    // block (which nothing else can reach yet) and the old block is retired. Returns true
+    // if the node moved, in which case the caller points its parent or the root at it.
+    bool shadowNode(BTreeNode &node, LatchGuard &latch) {
+        if (!copyOnWrite) return false;
+        {
+            lock_guard<mutex> guard(versionLatch);
+            if (freshBlocks.count(node.blockId) != 0) return false;
         }
+        uint64_t oldId = node.blockId;
+        node.blockId = allocateBlock();
+        LatchGuard newLatch(latches, node.blockId, true);
+        latch = move(newLatch);
+        saveNode(node);
+        releaseBlock(oldId);
+        IndexCounters::add(counters.blocksCopied);
+        return true;
+    }
 
-        // Store values
-        for (int i=0; i<MAX_KEYS; i++) {
-            uint64_t beVal = hostToBig(node.values[i]);
-            memcpy(buffer+24+(MAX_KEYS*8)+(i*8), &beVal, 8);
+    // shadowNode for child i of parent, which is latched exclusively and already fresh
+    void shadowChild(BTreeNode &parent, int i, BTreeNode &child, LatchGuard &latch) {
+        if (shadowNode(child, latch)) {
+            parent.children[i] = child.blockId;
+            saveNode(parent);
         }
+    }
 
-        // Store children
-        for (int i=0; i<MAX_CHILDREN; i++) {
-            uint64_t beChild = hostToBig(node.children[i]);
-            memcpy(buffer+24+(MAX_KEYS*8)+(MAX_KEYS*8)+(i*8), &beChild, 8);
+    // shadowNode for the root, with rootLatch held exclusively
+    void shadowRoot(BTreeNode &root, LatchGuard &latch) {
+        if (shadowNode(root, latch)) {
+            rootBlockId = root.blockId;
+            headerDirty = true;
         }
+    }
 
-        // Write node block to file
-        file.write((char*)buffer, BLOCK_SIZE);
-        file.flush();
+    // Add the nodes of the subtree rooted at blockId, which is at the given level (the root
+    // is level 1), to shape. A node's fill is the share of its keys or, for a packed leaf,
+    // of its page in use; fill sums are added to internalFill and leafFill.
+    void measureSubtree(uint64_t blockId, uint64_t level, TreeShape &shape, double &internalFill, double &leafFill) {
+        BTreeNode node = loadNodeShared(blockId);
+        shape.height = max(shape.height, level);
+        shape.keys += node.numKeys;
+        double fill;
+        if (node.isLeaf && nodeFormat == NODE_FORMAT_PACKED && node.numKeys > 0) {
+            int width = bitWidth(node.keys[node.numKeys - 1] - node.keys[0]);
+            fill = (double)packedLeafBytes(node.numKeys, width) / (double)BLOCK_SIZE;
+        } else {
+            fill = (double)node.numKeys / (double)MAX_KEYS;
+        }
+        int bucket = min(FILL_BUCKETS - 1, (int)(fill * FILL_BUCKETS));
+        if (node.isLeaf) {
+            shape.leafNodes++;
+            shape.leafFill[bucket]++;
+            leafFill += fill;
+            return;
+        }
+        shape.internalNodes++;
+        shape.internalFill[bucket]++;
+        internalFill += fill;
+        for (int i = 0; i <= (int)node.numKeys; i++) {
+            measureSubtree(node.children[i], level + 1, shape, internalFill, leafFill);
+        }
     }
 
-    // Allocate a new node on disk, updating nextBlockId and header
+    // Allocate a new node, reusing a free block when there is one
     BTreeNode allocateNode(bool leaf) {
         BTreeNode node;
-        node.blockId = nextBlockId++;
-        node.parentId = 0;
+        node.blockId = allocateBlock();
         node.numKeys = 0;
+        node.isLeaf = leaf;
         saveNode(node);
-        writeHeader();
         return node;
     }
 
     // Search for a key in the B-Tree, return true if found and set valueOut
-    bool searchKey(uint64_t blockId, uint64_t key, uint64_t &valueOut) {
-        if (blockId == 0) return false; // No such node
-        BTreeNode node = loadNode(blockId);
+    bool searchKey(uint64_t key, uint64_t &valueOut) {
+        shared_lock<shared_mutex> rootLock(rootLatch);
+        uint64_t blockId = rootBlockId;
+        if (blockId == 0) return false; // Empty tree
+        LatchGuard latch(latches, blockId, false);
+        rootLock.unlock();
+
+        for (int depth = 0; ; depth++) {
+            const uint8_t *buffer = pool.pin(blockId);
+            if (isPackedLeaf(buffer)) {
+                // Packed leaves are searched without decoding them
+                bool found = searchPackedLeaf(buffer, key, valueOut);
+                pool.unpin(blockId, false);
+                IndexCounters::addAtLevel(counters.searchDepths, depth);
+                return found;
+            }
+            BTreeNode node;
+            decodeNode(buffer, node);
+            pool.unpin(blockId, false);
+
+            // Find the position of the key or where it would be inserted
+            int i = lowerBound(node.keys, (int)node.numKeys, key);
+
+            // If key is found in this node, return its value
+            if (i < (int)node.numKeys && key == node.keys[i]) {
+                valueOut = node.values[i];
+                IndexCounters::addAtLevel(counters.searchDepths, depth);
+                return true;
+            }
 
-        int i = 0;
-        // Find the position of the key or where it would be inserted
-        while (i < (int)node.numKeys && key > node.keys[i]) i++;
+            // If leaf, key not found
+            if (node.isLeaf) {
+                IndexCounters::addAtLevel(counters.searchDepths, depth);
+                return false;
+            }
 
-        // If key is found in this node, return its value
-        if (i < (int)node.numKeys && key == node.keys[i]) {
-            valueOut = node.values[i];
-            return true;
+            // Otherwise, latch the appropriate child before letting go of this node
+            blockId = node.children[i];
+            LatchGuard childLatch(latches, blockId, false);
+            latch = move(childLatch);
         }
+    }
 
-        // If leaf, key not found
-        if (node.isLeaf) {
-            return false;
+    // Look up a sorted batch of keys in the subtree rooted at blockId. order[lo, hi) holds
+    // indexes into keys sorted by key; each node on the union of their paths is loaded once
+    // and its latch is held while its children are searched, so the batch sees each node
+    // in the same state a single search would.
+    void multiGetNode(uint64_t blockId, const vector<uint64_t> &keys, const vector<size_t> &order,
+                      size_t lo, size_t hi, vector<uint64_t> &values, vector<bool> &found) {
+        BTreeNode node = loadNode(blockId);
+        // Groups of the batch to search in child groupChild[g], order[groupLo[g], groupHi[g])
+        vector<int> groupChild;
+        vector<size_t> groupLo, groupHi;
+        vector<uint64_t> childIds;
+        size_t pos = lo;
+        for (int i=0; i<=(int)node.numKeys && pos<hi; i++) {
+            // Keys below keys[i] (or all remaining keys after the last separator) go to child i
+            size_t groupStart = pos;
+            while (pos < hi && (i == (int)node.numKeys || keys[order[pos]] < node.keys[i])) pos++;
+            if (pos > groupStart && !node.isLeaf) {
+                groupChild.push_back(i);
+                groupLo.push_back(groupStart);
+                groupHi.push_back(pos);
+                childIds.push_back(node.children[i]);
+            }
+            // Keys equal to the separator are answered by this node
+            while (i < (int)node.numKeys && pos < hi && keys[order[pos]] == node.keys[i]) {
+                values[order[pos]] = node.values[i];
+                found[order[pos]] = true;
+                pos++;
+            }
         }
 
-        // Otherwise, search in the appropriate child
-        return searchKey(node.children[i], key, valueOut);
+        // All children the batch goes to are read ahead together, then searched in order
+        if (childIds.size() > 1) pool.prefetch(childIds.data(), childIds.size());
+        for (size_t g = 0; g < groupChild.size(); g++) {
+            uint64_t childId = node.children[groupChild[g]];
+            LatchGuard childLatch(latches, childId, false);
+            multiGetNode(childId, keys, order, groupLo[g], groupHi[g], values, found);
+        }
     }
 
-    // Check if a key already exists in the B-Tree
-    bool keyExists(uint64_t key) {
-        if (rootBlockId == 0) return false; // Empty tree
-        uint64_t dummy;
-        return searchKey(rootBlockId, key, dummy);
+    // Start reading up to count children of an internal node, from child from onwards in
+    // the direction of step (1 or -1), so a traversal finds them cached when it gets there.
+    // The pool caps the reads in flight at its read-ahead window.
+    void prefetchChildren(const BTreeNode &node, int from, int step, size_t count) {
+        if (node.isLeaf) return;
+        count = min(count, pool.readAheadWindow());
+        if (count == 0) return;
+        if (step > 0) {
+            if (from > (int)node.numKeys) return;
+            pool.prefetch(&node.children[from], min(count, (size_t)(node.numKeys + 1 - from)));
+            return;
+        }
+        vector<uint64_t> ids;
+        for (int i = from; i >= 0 && ids.size() < count; i--) ids.push_back(node.children[i]);
+        pool.prefetch(ids.data(), ids.size());
     }
 
-    // Insert a key/value pair into the B-Tree
-    void insertKey(uint64_t key, uint64_t value) {
+    // Write a key/value pair in one pass down the tree. Returns true if the key was already
+    // there, with its value before the write in previous; mode decides whether a missing key
+    // is added and whether an existing key's value is replaced. Inserts and upserts split
+    // full nodes on the way down as before, since whether the key is new is only known once
+    // it is found or its leaf is reached; updates never split.
+    bool writeKey(uint64_t key, uint64_t value, WriteMode mode, uint64_t &previous) {
+        unique_lock<shared_mutex> rootLock(rootLatch);
         if (rootBlockId == 0) {
+            if (mode == WriteMode::Update) return false;
             // Tree is empty, create a new root node
             BTreeNode root = allocateNode(true);
             root.numKeys = 1;
@@ -230,102 +1046,126 @@ private:
             root.values[0] = value;
             saveNode(root);
             rootBlockId = root.blockId;
-            writeHeader();
-            return;
+            headerDirty = true;
+            return false;
         }
 
         // If root is full, split it before inserting
+        LatchGuard rootNodeLatch(latches, rootBlockId, true);
         BTreeNode root = loadNode(rootBlockId);
-        if (root.numKeys == MAX_KEYS) {
+        shadowRoot(root, rootNodeLatch);
+        if (mode != WriteMode::Update && needsSplit(root, key)) {
             BTreeNode newRoot = allocateNode(false);
+            LatchGuard newRootLatch(latches, newRoot.blockId, true);
             newRoot.children[0] = root.blockId;
-            root.parentId = newRoot.blockId;
-            saveNode(root);
 
             // Split the old root and create a new root
-            splitChild(newRoot, 0, root.blockId);
-            saveNode(newRoot);
+            BTreeNode sibling;
+            splitChild(newRoot, 0, root, sibling);
+            IndexCounters::addAtLevel(counters.splits, 0);
             rootBlockId = newRoot.blockId;
-            writeHeader();
+            headerDirty = true;
+            rootNodeLatch = move(newRootLatch);
+            root = newRoot;
+        }
 
-            insertNonFull(newRoot, key, value);
-        } else {
-            // Root not full, insert into it
-            insertNonFull(root, key, value);
+        // The root can no longer split during this write, so other threads may proceed
+        rootLock.unlock();
+        return writeNonFull(root, move(rootNodeLatch), key, value, mode, previous);
+    }
+
+    // Report the existing entry i of a latched node in previous and replace its value if the
+    // mode asks for it
+    void writeExisting(BTreeNode &node, int i, uint64_t value, WriteMode mode, uint64_t &previous) {
+        previous = node.values[i];
+        if (mode != WriteMode::Insert && previous != value) {
+            node.values[i] = value;
+            saveNode(node);
         }
     }
 
-    // Insert into a node that is guaranteed not to be full
-    void insertNonFull(BTreeNode node, uint64_t key, uint64_t value) {
-        while (true) {
-            int i = (int)node.numKeys - 1;
+    // Write into a node that is guaranteed not to be full (unless the mode is Update) and is
+    // latched exclusively. Each node on the path is loaded once: a child that is split is
+    // continued in from the halves splitChild leaves in memory.
+    bool writeNonFull(BTreeNode node, LatchGuard latch, uint64_t key, uint64_t value, WriteMode mode, uint64_t &previous) {
+        // Depth of the children looked at; the root is at depth 0
+        for (int depth = 1; ; depth++) {
+            // Find the first key >= key; an equal key is the existing entry
+            int i = lowerBound(node.keys, (int)node.numKeys, key);
+            if (i < (int)node.numKeys && node.keys[i] == key) {
+                writeExisting(node, i, value, mode, previous);
+                return true;
+            }
+
             if (node.isLeaf) {
+                if (mode == WriteMode::Update) return false;
                 // Insert key/value into leaf node
-                while (i>=0 && key < node.keys[i]) {
-                    node.keys[i+1] = node.keys[i];
-                    node.values[i+1] = node.values[i];
-                    i--;
-                }
-                // Check for duplicate key
-                if (i>=0 && node.keys[i] == key) {
-                    // Key already exists, abort
-                    saveNode(node);
-                    throw runtime_error("Key already exists.");
+                for (int j=(int)node.numKeys-1; j>=i; j--) {
+                    node.keys[j+1] = node.keys[j];
+                    node.values[j+1] = node.values[j];
                 }
-                node.keys[i+1] = key;
-                node.values[i+1] = value;
+                node.keys[i] = key;
+                node.values[i] = value;
                 node.numKeys++;
                 saveNode(node);
-                return;
-            } else {
-                // Insert into internal node: find child to descend into
-                while (i>=0 && key < node.keys[i]) i--;
-                i++;
-                uint64_t childId = node.children[i];
-                BTreeNode child = loadNode(childId);
-                // If child is full, split it before descending
-                if ((int)child.numKeys == MAX_KEYS) {
-                    splitChild(node, i, childId);
-                    node = loadNode(node.blockId);
-                    if (key > node.keys[i]) {
-                        i++;
-                    }
+                return false;
+            }
+
+            // Insert into internal node: latch and load the child to descend into
+            uint64_t childId = node.children[i];
+            LatchGuard childLatch(latches, childId, true);
+            BTreeNode child = loadNode(childId);
+            shadowChild(node, i, child, childLatch);
+            // If child is full, split it before descending
+            if (mode != WriteMode::Update && needsSplit(child, key)) {
+                BTreeNode sibling;
+                splitChild(node, i, child, sibling);
+                IndexCounters::addAtLevel(counters.splits, depth);
+                if (key == node.keys[i]) {
+                    // The key was the child's middle key and moved up into this node
+                    writeExisting(node, i, value, mode, previous);
+                    return true;
+                }
+                if (key > node.keys[i]) {
+                    // Continue in the new sibling, which only this thread can reach so far
+                    LatchGuard siblingLatch(latches, sibling.blockId, true);
+                    childLatch = move(siblingLatch);
+                    child = sibling;
                 }
-                // Descend into the appropriate child
-                uint64_t newChildId = node.children[i];
-                BTreeNode newChild = loadNode(newChildId);
-                node = newChild; // Continue insertion in the chosen child
             }
+            // Descend into the chosen child, releasing this node
+            latch = move(childLatch);
+            node = child;
         }
     }
 
-    // Split a full child node into two and adjust the parent node accordingly
-    void splitChild(BTreeNode &parent, int index, uint64_t childId) {
-        BTreeNode child = loadNode(childId);
-        BTreeNode newChild = allocateNode(child.isLeaf);
-        newChild.parentId = parent.blockId;
+    // Split a full child node into two and adjust the parent node accordingly. The parent
+    // and child must be latched exclusively; the child is updated in place and the new
+    // right sibling is returned in newChild. Only these three blocks are written: the moved
+    // grandchildren are not touched, as nodes do not record their parent.
+    void splitChild(BTreeNode &parent, int index, BTreeNode &child, BTreeNode &newChild) {
+        newChild = allocateNode(child.isLeaf);
+
+        // The middle key moves up; full internal nodes split at MIN_DEGREE-1, leaves at their middle
+        int mid = (int)child.numKeys / 2;
 
         // Move the upper half of child's keys/values to newChild
-        newChild.numKeys = MIN_DEGREE - 1;
-        for (int j=0; j<MIN_DEGREE-1; j++) {
-            newChild.keys[j] = child.keys[j+MIN_DEGREE];
-            newChild.values[j] = child.values[j+MIN_DEGREE];
+        newChild.numKeys = child.numKeys - mid - 1;
+        for (int j=0; j<(int)newChild.numKeys; j++) {
+            newChild.keys[j] = child.keys[j+mid+1];
+            newChild.values[j] = child.values[j+mid+1];
         }
 
         // Move the upper half of child's children if not a leaf
         if (!child.isLeaf) {
-            for (int j=0; j<MIN_DEGREE; j++) {
-                newChild.children[j] = child.children[j+MIN_DEGREE];
-                if (newChild.children[j] != 0) {
-                    BTreeNode temp = loadNode(newChild.children[j]);
-                    temp.parentId = newChild.blockId;
-                    saveNode(temp);
-                }
+            for (int j=0; j<=(int)newChild.numKeys; j++) {
+                newChild.children[j] = child.children[j+mid+1];
             }
         }
+        newChild.isLeaf = child.isLeaf;
 
         // Adjust the old child node's number of keys
-        child.numKeys = MIN_DEGREE - 1;
+        child.numKeys = mid;
         saveNode(child);
         saveNode(newChild);
 
@@ -340,209 +1180,1647 @@ private:
             parent.keys[j+1] = parent.keys[j];
             parent.values[j+1] = parent.values[j];
         }
-        parent.keys[index] = child.keys[MIN_DEGREE-1];
-        parent.values[index] = child.values[MIN_DEGREE-1];
+        parent.keys[index] = child.keys[mid];
+        parent.values[index] = child.values[mid];
 
         parent.numKeys++;
+        parent.isLeaf = false;
         saveNode(parent);
     }
 
-    // Print all keys/values in ascending order (in-order traversal)
-    void printInOrder(uint64_t blockId) {
-        if (blockId == 0) return; // No node
-        BTreeNode node = loadNode(blockId);
-        // Traverse the children and keys in order
-        for (int i=0; i<(int)node.numKeys; i++) {
-            printInOrder(node.children[i]);
-            cout << node.keys[i] << " " << node.values[i] << "\n";
+    // Remove entry i from a leaf
+    void removeFromLeaf(BTreeNode &leaf, int i) {
+        for (int j=i; j<(int)leaf.numKeys-1; j++) {
+            leaf.keys[j] = leaf.keys[j+1];
+            leaf.values[j] = leaf.values[j+1];
         }
-        // Print from the last child
-        printInOrder(node.children[node.numKeys]);
+        leaf.numKeys--;
     }
 
-    // Extract all keys/values in ascending order to a file
-    void extractInOrder(uint64_t blockId, ofstream &out) {
-        if (blockId == 0) return;
-        BTreeNode node = loadNode(blockId);
-        for (int i=0; i<(int)node.numKeys; i++) {
-            extractInOrder(node.children[i], out);
-            out << node.keys[i] << "," << node.values[i] << "\n";
+    // Move the separator before child i of parent down into child, and the largest key of
+    // child's left sibling up in its place. All three nodes are latched exclusively.
+    void borrowFromLeft(BTreeNode &parent, int i, BTreeNode &child, BTreeNode &left) {
+        for (int j=(int)child.numKeys-1; j>=0; j--) {
+            child.keys[j+1] = child.keys[j];
+            child.values[j+1] = child.values[j];
+        }
+        child.keys[0] = parent.keys[i-1];
+        child.values[0] = parent.values[i-1];
+        if (!child.isLeaf) {
+            for (int j=(int)child.numKeys; j>=0; j--) {
+                child.children[j+1] = child.children[j];
+            }
+            child.children[0] = left.children[left.numKeys];
+            left.children[left.numKeys] = 0;
         }
-        extractInOrder(node.children[node.numKeys], out);
+        child.numKeys++;
+
+        parent.keys[i-1] = left.keys[left.numKeys-1];
+        parent.values[i-1] = left.values[left.numKeys-1];
+        left.numKeys--;
+        saveNode(left);
+        saveNode(child);
+        saveNode(parent);
     }
 
-    // Load key/value pairs from a CSV file and insert them
-    void loadFromFile(const string &inputFile) {
-        ifstream in(inputFile);
-        if (!in.is_open()) {
-            throw runtime_error("Unable to open input file for load.");
+    // Move the separator after child i of parent down into child, and the smallest key of
+    // child's right sibling up in its place. All three nodes are latched exclusively.
+    void borrowFromRight(BTreeNode &parent, int i, BTreeNode &child, BTreeNode &right) {
+        child.keys[child.numKeys] = parent.keys[i];
+        child.values[child.numKeys] = parent.values[i];
+        if (!child.isLeaf) {
+            child.children[child.numKeys+1] = right.children[0];
+            for (int j=0; j<(int)right.numKeys; j++) {
+                right.children[j] = right.children[j+1];
+            }
+            right.children[right.numKeys] = 0;
         }
+        child.numKeys++;
 
-        string line;
-        while (getline(in, line)) {
-            if (line.empty()) continue;
-            size_t pos = line.find(',');
-            if (pos == string::npos) {
-                cerr << "Invalid line format in load file: " << line << "\n";
-                continue;
-            }
-            string k = line.substr(0, pos);
-            string v = line.substr(pos+1);
+        parent.keys[i] = right.keys[0];
+        parent.values[i] = right.values[0];
+        for (int j=0; j<(int)right.numKeys-1; j++) {
+            right.keys[j] = right.keys[j+1];
+            right.values[j] = right.values[j+1];
+        }
+        right.numKeys--;
+        saveNode(right);
+        saveNode(child);
+        saveNode(parent);
+    }
 
-            uint64_t key, value;
-            try {
-                key = stoull(k);
-                value = stoull(v);
-            } catch (...) {
-                cerr << "Invalid integer in line: " << line << "\n";
-                continue;
+    // Merge child i+1 of parent and the separator between them into child i, and release
+    // the emptied block (see releaseBlock). Only called when both children hold fewer than
+    // MIN_DEGREE keys, so the result fits a node. All three nodes are latched exclusively.
+    void mergeChildren(BTreeNode &parent, int i, BTreeNode &left, BTreeNode &right) {
+        int n = (int)left.numKeys;
+        left.keys[n] = parent.keys[i];
+        left.values[n] = parent.values[i];
+        for (int j=0; j<(int)right.numKeys; j++) {
+            left.keys[n+1+j] = right.keys[j];
+            left.values[n+1+j] = right.values[j];
+        }
+        if (!left.isLeaf) {
+            for (int j=0; j<=(int)right.numKeys; j++) {
+                left.children[n+1+j] = right.children[j];
             }
+        }
+        left.numKeys += right.numKeys + 1;
 
-            // Skip if key already exists
-            if (keyExists(key)) {
-                cerr << "Error: key " << key << " already exists. Skipping.\n";
-                continue;
+        // Remove the separator and the right child from the parent
+        for (int j=i; j<(int)parent.numKeys-1; j++) {
+            parent.keys[j] = parent.keys[j+1];
+            parent.values[j] = parent.values[j+1];
+        }
+        for (int j=i+1; j<(int)parent.numKeys; j++) {
+            parent.children[j] = parent.children[j+1];
+        }
+        parent.children[parent.numKeys] = 0;
+        parent.numKeys--;
+        saveNode(left);
+        saveNode(parent);
+        releaseBlock(right.blockId);
+    }
+
+    // Make sure child i of node holds at least MIN_DEGREE keys before descending into it,
+    // so it can lose one. node and child are latched exclusively. A sibling with a key to
+    // spare lends one through the parent; otherwise child is merged with a sibling. When
+    // that is its left sibling, child, childLatch and i move to the merged node.
+    void fillChild(BTreeNode &node, int &i, BTreeNode &child, LatchGuard &childLatch) {
+        if ((int)child.numKeys >= MIN_DEGREE) return;
+        BTreeNode sibling;
+        if (i > 0) {
+            LatchGuard leftLatch(latches, node.children[i-1], true);
+            sibling = loadNode(node.children[i-1]);
+            if ((int)sibling.numKeys >= MIN_DEGREE) {
+                shadowChild(node, i-1, sibling, leftLatch);
+                borrowFromLeft(node, i, child, sibling);
+                return;
             }
-            try {
-                insertKey(key, value);
-            } catch (runtime_error &e) {
-                cerr << "Error inserting key " << key << ": " << e.what() << "\n";
+            if (i == (int)node.numKeys) {
+                // The last child has no right sibling: merge it into its left one
+                shadowChild(node, i-1, sibling, leftLatch);
+                mergeChildren(node, i-1, sibling, child);
+                child = sibling;
+                childLatch = move(leftLatch);
+                i--;
+                return;
             }
         }
+        LatchGuard rightLatch(latches, node.children[i+1], true);
+        sibling = loadNode(node.children[i+1]);
+        if ((int)sibling.numKeys >= MIN_DEGREE) {
+            shadowChild(node, i+1, sibling, rightLatch);
+            borrowFromRight(node, i, child, sibling);
+        } else {
+            mergeChildren(node, i, child, sibling);
+        }
     }
 
-public:
-    BTree() {
-        fileOpen = false;
-        rootBlockId = 0;
-        nextBlockId = 1;
+    // Remove the largest (or smallest) key of the subtree of node, which is latched
+    // exclusively and holds at least MIN_DEGREE keys, returning it in keyOut/valueOut
+    void takeExtreme(BTreeNode node, LatchGuard latch, bool largest, uint64_t &keyOut, uint64_t &valueOut) {
+        while (!node.isLeaf) {
+            int i = largest ? (int)node.numKeys : 0;
+            LatchGuard childLatch(latches, node.children[i], true);
+            BTreeNode child = loadNode(node.children[i]);
+            shadowChild(node, i, child, childLatch);
+            fillChild(node, i, child, childLatch);
+            latch = move(childLatch);
+            node = child;
+        }
+        int i = largest ? (int)node.numKeys - 1 : 0;
+        keyOut = node.keys[i];
+        valueOut = node.values[i];
+        removeFromLeaf(node, i);
+        saveNode(node);
     }
 
-    // Create a new B-Tree index file
-    void createFile() {
-        cout << "Enter the file name to create: ";
-        string fname; cin >> fname;
-        {
-            // Check if file already exists
-            ifstream test(fname, ios::binary);
-            if (test.is_open()) {
-                cout << "File already exists. Overwrite? (y/n): ";
-                char c; cin >> c;
-                if (c!='y' && c!='Y') {
-                    cout << "File creation aborted.\n";
-                    return;
-                }
+    // Remove a key from the B-Tree; returns false if it is not there. Like writeKey this
+    // is one pass down the tree that fixes nodes before entering them: a child holding only
+    // the minimum MIN_DEGREE-1 keys is topped up first (fillChild), and a key found in an
+    // internal node is replaced by its predecessor or successor from a child that can spare
+    // one, or else the two children around it are merged and the key removed from the
+    // merged child. No node ever has to be revisited, so the same latch crabbing as insert works.
+    bool deleteKey(uint64_t key, uint64_t &valueOut) {
+        unique_lock<shared_mutex> rootLock(rootLatch);
+        if (rootBlockId == 0) return false;
+        LatchGuard rootNodeLatch(latches, rootBlockId, true);
+        BTreeNode root = loadNode(rootBlockId);
+        shadowRoot(root, rootNodeLatch);
+
+        if (root.isLeaf) {
+            // Removing the last key of a root leaf empties the tree, so rootLatch stays held
+            int i = lowerBound(root.keys, (int)root.numKeys, key);
+            if (i == (int)root.numKeys || root.keys[i] != key) return false;
+            valueOut = root.values[i];
+            removeFromLeaf(root, i);
+            if (root.numKeys == 0) {
+                releaseBlock(root.blockId);
+                rootBlockId = 0;
+                headerDirty = true;
+            } else {
+                saveNode(root);
             }
+            return true;
         }
 
-        fileName = fname;
-        // Create/truncate the file
-        file.open(fileName, ios::binary | ios::trunc | ios::in | ios::out);
-        if (!file.is_open()) {
-            cerr << "Error: Unable to create file.\n";
-            return;
+        if (root.numKeys == 1) {
+            // Merging the root's only two children would leave it without keys, so merge
+            // them now and let the merged node take over as root
+            LatchGuard leftLatch(latches, root.children[0], true);
+            LatchGuard rightLatch(latches, root.children[1], true);
+            BTreeNode left = loadNode(root.children[0]);
+            BTreeNode right = loadNode(root.children[1]);
+            if ((int)left.numKeys < MIN_DEGREE && (int)right.numKeys < MIN_DEGREE) {
+                shadowChild(root, 0, left, leftLatch);
+                mergeChildren(root, 0, left, right);
+                releaseBlock(root.blockId);
+                rootBlockId = left.blockId;
+                headerDirty = true;
+                rootNodeLatch = move(leftLatch);
+                root = left;
+            }
         }
 
-        // Initialize empty tree header
-        rootBlockId = 0;
-        nextBlockId = 1;
-        writeHeader();
-        fileOpen = true;
-        cout << "File created successfully.\n";
+        // The root can no longer change during this delete, so other threads may proceed
+        rootLock.unlock();
+        return deleteFromSubtree(root, move(rootNodeLatch), key, valueOut);
     }
 
-    // Open an existing B-Tree index file
-    void openFile() {
-        cout << "Enter the file name to open: ";
-        string fname; cin >> fname;
-        fileName = fname;
-        file.open(fileName, ios::binary | ios::in | ios::out);
-        if (!file.is_open()) {
-            cerr << "Error: File does not exist.\n";
-            return;
-        }
-        try {
+    // Remove key from the subtree of node, which is latched exclusively and is the root or
+    // holds at least MIN_DEGREE keys
+    bool deleteFromSubtree(BTreeNode node, LatchGuard latch, uint64_t key, uint64_t &valueOut) {
+        while (true) {
+            int i = lowerBound(node.keys, (int)node.numKeys, key);
+            bool found = i < (int)node.numKeys && node.keys[i] == key;
+
+            if (node.isLeaf) {
+                if (!found) return false;
+                valueOut = node.values[i];
+                removeFromLeaf(node, i);
+                saveNode(node);
+                return true;
+            }
+
+            if (found) {
+                LatchGuard leftLatch(latches, node.children[i], true);
+                LatchGuard rightLatch(latches, node.children[i+1], true);
+                BTreeNode left = loadNode(node.children[i]);
+                BTreeNode right = loadNode(node.children[i+1]);
+                valueOut = node.values[i];
+                if ((int)left.numKeys >= MIN_DEGREE) {
+                    // Replace the key by its predecessor; this node stays latched until rewritten
+                    rightLatch.release();
+                    shadowChild(node, i, left, leftLatch);
+                    takeExtreme(left, move(leftLatch), true, node.keys[i], node.values[i]);
+                    saveNode(node);
+                    return true;
+                }
+                if ((int)right.numKeys >= MIN_DEGREE) {
+                    // Replace the key by its successor
+                    leftLatch.release();
+                    shadowChild(node, i+1, right, rightLatch);
+                    takeExtreme(right, move(rightLatch), false, node.keys[i], node.values[i]);
+                    saveNode(node);
+                    return true;
+                }
+                // Both children are at the minimum: merge them around the key and go on
+                // deleting it from the merged child
+                shadowChild(node, i, left, leftLatch);
+                mergeChildren(node, i, left, right);
+                latch = move(leftLatch);
+                node = left;
+                continue;
+            }
+
+            // Latch and top up the child to descend into before letting go of this node
+            LatchGuard childLatch(latches, node.children[i], true);
+            BTreeNode child = loadNode(node.children[i]);
+            shadowChild(node, i, child, childLatch);
+            fillChild(node, i, child, childLatch);
+            latch = move(childLatch);
+            node = child;
+        }
+    }
+
+    // Format all keys/values of a subtree in ascending order (in-order traversal)
+    void exportInOrder(uint64_t blockId, bool snapshot, PartOutput &out) {
+        BTreeNode node = loadNodeIn(blockId, snapshot);
+        // Traverse the children and keys in order (leaves may hold more keys than child slots),
+        // keeping the next children read ahead while one is formatted
+        for (int i=0; i<(int)node.numKeys; i++) {
+            if (!node.isLeaf) {
+                prefetchChildren(node, i, 1, MAX_CHILDREN);
+                exportInOrder(node.children[i], snapshot, out);
+            }
+            out.add(node.keys[i], node.values[i]);
+        }
+        if (!node.isLeaf) exportInOrder(node.children[node.numKeys], snapshot, out);
+    }
+
+    // A run of consecutive keys for export: a subtree, then the key separating it from the next run
+    struct ExportRange {
+        uint64_t blockId;
+        bool hasSeparator;
+        uint64_t key;
+        uint64_t value;
+    };
+
+    // Split the tree under root into consecutive ranges at the root's separators. While
+    // there are fewer than wanted ranges, each is split again at its own root's separators,
+    // down to the level above the leaves. Only internal nodes are read.
+    vector<ExportRange> splitForExport(uint64_t root, bool snapshot, size_t wanted) {
+        vector<ExportRange> ranges;
+        if (root == 0) return ranges;
+        ranges.push_back(ExportRange{root, false, 0, 0});
+        while (ranges.size() < wanted) {
+            vector<ExportRange> split;
+            for (const ExportRange &range : ranges) {
+                BTreeNode node = loadNodeIn(range.blockId, snapshot);
+                if (node.isLeaf) return ranges;
+                for (int i=0; i<=(int)node.numKeys; i++) {
+                    if (i < (int)node.numKeys) {
+                        split.push_back(ExportRange{node.children[i], true, node.keys[i], node.values[i]});
+                    } else {
+                        split.push_back(ExportRange{node.children[i], range.hasSeparator, range.key, range.value});
+                    }
+                }
+            }
+            ranges.swap(split);
+        }
+        return ranges;
+    }
+
+    // Write every key/value pair of the tree under root (the live tree's or a snapshot's)
+    // as "key<separator>value" lines in ascending order to fd. Worker threads format the
+    // ranges from splitForExport with to_chars into large buffers, and the calling thread
+    // writes the ranges' output in order.
+    void exportToFd(uint64_t root, bool snapshot, int fd, char separator, unsigned threads) {
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        vector<ExportRange> ranges = splitForExport(root, snapshot, threads == 1 ? 1 : (size_t)threads * 8);
+        threads = (unsigned)min<size_t>(threads, ranges.size());
+
+        OrderedWriter writer(fd, ranges.size());
+        atomic<size_t> nextRange(0);
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                try {
+                    for (size_t r = nextRange++; r < ranges.size(); r = nextRange++) {
+                        PartOutput out(writer, r, separator);
+                        exportInOrder(ranges[r].blockId, snapshot, out);
+                        if (ranges[r].hasSeparator) out.add(ranges[r].key, ranges[r].value);
+                        out.finish();
+                    }
+                } catch (...) {
+                    writer.abort(current_exception());
+                }
+            });
+        }
+        try {
+            writer.writeAll();
+        } catch (...) {
+            for (auto &w : workers) w.join();
+            throw;
+        }
+        for (auto &w : workers) w.join();
+    }
+
+    // Load key/value pairs from a CSV or binary record file and insert them. A CSV file is
+    // parsed on other threads while this one inserts (see CsvReader). A binary file with
+    // ascending keys going into an empty tree is bulk built instead, which gives the same
+    // entries without a descent per key.
+    void loadFromFile(const string &inputFile) {
+        LoadInput input;
+        if (!input.open(inputFile)) {
+            throw runtime_error("Unable to open input file for load.");
+        }
+        if (rootBlockId == 0 && !snapshotsOpen() && input.sortedRecords()) {
+            commit();
+            buildFromSorted(input.recordReader(), input.recordReader().count());
+            return;
+        }
+
+        input.forEach([this](uint64_t key, uint64_t value) {
+            try {
+                if (!insert(key, value)) {
+                    cerr << "Error: key " << key << " already exists. Skipping.\n";
+                }
+            } catch (runtime_error &e) {
+                cerr << "Error inserting key " << key << ": " << e.what() << "\n";
+            }
+        });
+    }
+
+    // Feed every key/value pair of the tree, in ascending order, to the sorter
+    void collectInOrder(uint64_t blockId, ExternalSorter &sorter) {
+        if (blockId == 0) return;
+        BTreeNode node = loadNodeShared(blockId);
+        for (int i=0; i<(int)node.numKeys; i++) {
+            if (!node.isLeaf) {
+                prefetchChildren(node, i, 1, MAX_CHILDREN);
+                collectInOrder(node.children[i], sorter);
+            }
+            sorter.add(node.keys[i], node.values[i]);
+        }
+        if (!node.isLeaf) collectInOrder(node.children[node.numKeys], sorter);
+    }
+
+    // Number of keys a full subtree of the given height holds (saturates instead of overflowing)
+    uint64_t subtreeCapacity(int height) const {
+        uint64_t cap = bulkLeafKeys();
+        for (int h = 0; h < height; h++) {
+            if (cap > (UINT64_MAX - MAX_KEYS) / MAX_CHILDREN) return UINT64_MAX;
+            cap = cap * MAX_CHILDREN + MAX_KEYS;
+        }
+        return cap;
+    }
+
+    // Build a subtree of the given height holding the next count sorted pairs from the sorter
+    // (an ExternalSorter, or a RecordReader over a sorted binary file).
+    // Children are packed full except the last two, which share the remainder so both stay at
+    // least half full. Keys are also added to built unless it is null. Returns the block ID of
+    // the subtree's root.
+    template <typename Source>
+    uint64_t buildSubtree(Source &sorter, uint64_t count, int height, BloomFilter *built) {
+        BTreeNode node;
+        node.blockId = nextBlockId++;
+        node.isLeaf = height == 0;
+        KeyValue kv;
+
+        if (height == 0) {
+            for (uint64_t i = 0; i < count; i++) {
+                if (!sorter.next(kv)) throw runtime_error("Bulk load input ended early.");
+                node.keys[i] = kv.key;
+                node.values[i] = kv.value;
+                if (built) built->add(kv.key);
+            }
+            node.numKeys = count;
+            saveNode(node);
+            return node.blockId;
+        }
+
+        uint64_t childCap = subtreeCapacity(height - 1);
+        uint64_t numChildren = (count + 1 + childCap) / (childCap + 1);  // ceil((count+1)/(childCap+1))
+        uint64_t remainder = count - (numChildren - 1) - (numChildren - 2) * childCap;
+        for (uint64_t i = 0; i < numChildren; i++) {
+            uint64_t childCount = childCap;
+            if (i == numChildren - 2) childCount = remainder / 2;
+            else if (i == numChildren - 1) childCount = remainder - remainder / 2;
+
+            node.children[i] = buildSubtree(sorter, childCount, height - 1, built);
+            if (i + 1 < numChildren) {
+                if (!sorter.next(kv)) throw runtime_error("Bulk load input ended early.");
+                node.keys[i] = kv.key;
+                node.values[i] = kv.value;
+                if (built) built->add(kv.key);
+            }
+        }
+        node.numKeys = numChildren - 1;
+        saveNode(node);
+        return node.blockId;
+    }
+
+    // Bulk load a CSV or binary record file: sort the input externally together with the
+    // existing tree contents, drop duplicate keys, and write a fully packed tree bottom-up
+    // into a fresh file that then replaces the index. A binary file with ascending keys
+    // going into an empty tree is streamed from its mapping straight into the build.
+    void bulkLoadFromFile(const string &inputFile) {
+        LoadInput input;
+        if (!input.open(inputFile)) {
+            throw runtime_error("Unable to open input file for load.");
+        }
+        requireNoSnapshots("bulk load");
+
+        // Make pending changes durable before the old file is replaced
+        commit();
+        if (rootBlockId == 0 && input.sortedRecords()) {
+            buildFromSorted(input.recordReader(), input.recordReader().count());
+            return;
+        }
+
+        // Existing entries are added first so they win over duplicates in the input
+        ExternalSorter sorter(fileName);
+        storage->advise(AccessPattern::Sequential);
+        collectInOrder(rootBlockId, sorter);
+        storage->advise(AccessPattern::Random);
+
+        input.forEach([&sorter](uint64_t key, uint64_t value) {
+            sorter.add(key, value);
+        });
+
+        uint64_t count = sorter.finish([](const KeyValue &kv) {
+            cerr << "Error: key " << kv.key << " already exists. Skipping.\n";
+        });
+        buildFromSorted(sorter, count);
+    }
+
+    // Write a tree of the next count pairs of a sorted source (see buildSubtree) into a
+    // fresh file and swap it in for the index, whose pending changes must be committed.
+    template <typename Source>
+    void buildFromSorted(Source &sorter, uint64_t count) {
+        // Build the new tree in a temporary file next to the index. It is not logged: it only
+        // replaces the index once it is complete and synced.
+        string tempName = fileName + ".bulk";
+        pool.flushAll();
+        closeStorage();
+        if (!openStorage(tempName, true, false)) {
+            if (!openStorage(fileName, false)) fileOpen = false;
+            throw runtime_error("Unable to create temporary file for bulk load.");
+        }
+
+        useCurrentFormat();
+        rootBlockId = 0;
+        nextBlockId = 1;
+        freeListHead = 0;
+        // The new file is a new generation; its filter is sized for exactly its keys
+        filterGeneration = nextGeneration(filterGeneration);
+        filterSaved = false;
+        unique_ptr<BloomFilter> built;
+        if (filter) built.reset(new BloomFilter(bloomRate, bloomMaxBytes, BloomFilter::capacityFor(count)));
+        if (count > 0) {
+            int height = 0;
+            while (subtreeCapacity(height) < count) height++;
+            rootBlockId = buildSubtree(sorter, count, height, built.get());
+        }
+        replaceIndexWith(tempName, "bulk load");
+        if (filter) filter = move(built);
+    }
+
+    // Close the finished temporary file and move it over the index, then reopen the index.
+    // operation names what built the file, for error messages.
+    void replaceIndexWith(const string &tempName, const string &operation) {
+        headerDirty = true;
+        commit();
+        storage->sync();
+        closeStorage();
+
+        if (rename(tempName.c_str(), fileName.c_str()) != 0) {
+            remove(tempName.c_str());
+            fileOpen = false;
+            throw runtime_error("Unable to replace index file after " + operation + ".");
+        }
+        if (!openStorage(fileName, false)) {
+            fileOpen = false;
+            throw runtime_error("Unable to reopen index file after " + operation + ".");
+        }
+        resetVersions();
+    }
+
+    // Append the blocks of the subtree rooted at blockId, height levels above the leaves, in
+    // depth-first order (a node, then each child's subtree left to right)
+    void listDepthFirst(uint64_t blockId, int height, vector<uint64_t> &blocks) {
+        blocks.push_back(blockId);
+        if (height == 0) return;
+        BTreeNode node = loadNodeShared(blockId);
+        for (int i=0; i<=(int)node.numKeys; i++) {
+            listDepthFirst(node.children[i], height - 1, blocks);
+        }
+    }
+
+    // List the tree's blocks in the order a compacted file stores them. Only internal nodes
+    // are read; the leaves' IDs come from their parents.
+    void listForCompaction(CompactOrder order, vector<uint64_t> &blocks) {
+        if (rootBlockId == 0) return;
+        int height = 0;
+        for (BTreeNode node = loadNodeShared(rootBlockId); !node.isLeaf; node = loadNodeShared(node.children[0])) {
+            height++;
+        }
+        if (order == CompactOrder::KeyOrder) {
+            listDepthFirst(rootBlockId, height, blocks);
+            return;
+        }
+
+        // Breadth-first: the children of each level, in order, follow the whole level
+        blocks.push_back(rootBlockId);
+        size_t levelStart = 0;
+        for (int h = height; h > 0; h--) {
+            size_t levelEnd = blocks.size();
+            for (size_t k = levelStart; k < levelEnd; k++) {
+                BTreeNode node = loadNodeShared(blocks[k]);
+                for (int i=0; i<=(int)node.numKeys; i++) {
+                    blocks.push_back(node.children[i]);
+                }
+            }
+            levelStart = levelEnd;
+        }
+    }
+
+    // Copy every node, renumbered, into a fresh file in the given block order, leaving out
+    // free blocks, and swap it in for the index. Node contents are unchanged apart from
+    // block IDs, so the tree keeps its shape and fill. The copy gets the current format
+    // version, so compacting a file written without checksums adds them.
+    void compactFile(CompactOrder order) {
+        requireNoSnapshots("compaction");
+        // Make pending changes durable before the old file is replaced
+        commit();
+
+        storage->advise(AccessPattern::Sequential);
+        vector<uint64_t> blocks;
+        listForCompaction(order, blocks);
+        // New block IDs follow the list, starting right after the header
+        vector<uint64_t> newIds(nextBlockId, 0);
+        for (size_t k = 0; k < blocks.size(); k++) {
+            newIds[blocks[k]] = k + 1;
+        }
+
+        string tempName = fileName + ".compact";
+        unique_ptr<Storage> out = makeStorage(false);
+        if (!out->open(tempName, true)) {
+            storage->advise(AccessPattern::Random);
+            throw runtime_error("Unable to create temporary file for compaction.");
+        }
+        try {
+            // Nodes are written in new block order, so consecutive blocks go out in one write
+            const size_t batchBytes = 1 << 20;
+            vector<uint8_t> batch;
+            uint64_t batchStart = 1;
+            size_t window = pool.readAheadWindow();
+            for (size_t k = 0; k < blocks.size(); k++) {
+                // Keep the next blocks of the list read ahead, topping up every half window
+                if (window > 0 && k % max<size_t>(1, window / 2) == 0) {
+                    pool.prefetch(&blocks[k], min(window, blocks.size() - k));
+                }
+                BTreeNode node = loadNodeShared(blocks[k]);
+                node.blockId = k + 1;
+                if (!node.isLeaf) {
+                    for (int i=0; i<=(int)node.numKeys; i++) {
+                        node.children[i] = newIds[node.children[i]];
+                    }
+                }
+                size_t at = batch.size();
+                batch.resize(at + BLOCK_SIZE, 0);
+                encodeNode(node, &batch[at]);
+                stampBlockChecksum(&batch[at], BLOCK_SIZE);
+                if (batch.size() >= batchBytes || k + 1 == blocks.size()) {
+                    out->write(batchStart * BLOCK_SIZE, batch.data(), batch.size());
+                    batchStart = k + 2;
+                    batch.clear();
+                }
+            }
+        } catch (...) {
+            // Any failure, not only an I/O error, must not leave the partial copy behind
+            out->close();
+            remove(tempName.c_str());
+            storage->advise(AccessPattern::Random);
+            throw;
+        }
+        storage->advise(AccessPattern::Random);
+
+        // Switch to the new file to write its header
+        closeStorage();
+        storage = move(out);
+        pool.attach(storage.get());
+        useCurrentFormat();
+        rootBlockId = blocks.empty() ? 0 : 1;
+        nextBlockId = blocks.size() + 1;
+        freeListHead = 0;
+        replaceIndexWith(tempName, "compaction");
+    }
+
+    // What verify's scan found in one block
+    enum class BlockKind : uint8_t {
+        Bad,         // Failed its checksum or is neither a node nor a free block
+        Leaf,
+        Internal,
+        Free
+    };
+
+    struct ScannedBlock {
+        BlockKind kind;
+        bool reached;            // Linked from the tree or the free list (set by the second pass)
+        uint64_t numKeys;
+        uint64_t minKey, maxKey; // Smallest and largest key of a node with keys
+        uint64_t next;           // A free block's next free block; where an internal node's
+                                 // keys and then children start in its scan thread's links
+    };
+
+    // Check one block on its own and record what it is. A block whose first word is its
+    // own ID is a node; anything else must be a free block.
+    void scanBlock(uint64_t blockId, const uint8_t *buffer, ScannedBlock &block, vector<uint64_t> &links,
+                   BTreeNode &node, VerifyReport &report) const {
+        block = ScannedBlock{BlockKind::Bad, false, 0, 0, 0, 0};
+        string where = "block " + to_string(blockId) + ": ";
+        bool checksummed = formatVersion >= FORMAT_VERSION_CHECKSUMS;
+        if (checksummed && !blockChecksumValid(buffer, BLOCK_SIZE)) {
+            report.checksumErrors++;
+            report.note(where + "checksum mismatch");
+            return;
+        }
+
+        uint64_t words[5];
+        bigToHostArray(buffer, words, 5);
+        if (words[0] != blockId) {
+            size_t zerosFrom = checksummed ? 16 : 8;
+            bool zeros = all_of(buffer + zerosFrom, buffer + BLOCK_SIZE, [](uint8_t b) { return b == 0; });
+            if (!zeros || words[0] >= nextBlockId) {
+                report.structureErrors++;
+                report.note(where + "neither a node nor a free block");
+                return;
+            }
+            block.kind = BlockKind::Free;
+            block.next = words[0];
+            return;
+        }
+
+        // Bounds are checked before decoding, which trusts them
+        bool packed = isPackedLeaf(buffer);
+        uint64_t n = packed ? words[2] & ~PACKED_LEAF_FLAG : words[2];
+        bool fits = packed ? n <= (uint64_t)PACKED_LEAF_MAX_KEYS && words[4] <= 64
+                             && packedLeafBytes(n, (int)words[4]) <= BLOCK_SIZE
+                           : n <= (uint64_t)MAX_KEYS;
+        if (!fits) {
+            report.structureErrors++;
+            report.note(where + "numKeys " + to_string(n) + " out of bounds");
+            return;
+        }
+        decodeNode(buffer, node);
+        for (uint64_t i = 1; i < n; i++) {
+            if (node.keys[i-1] >= node.keys[i]) {
+                report.structureErrors++;
+                report.note(where + "keys out of order at slot " + to_string(i));
+                return;
+            }
+        }
+        if (!node.isLeaf) {
+            if (n == 0) {
+                report.structureErrors++;
+                report.note(where + "internal node without keys");
+                return;
+            }
+            for (uint64_t i = 0; i <= n; i++) {
+                uint64_t child = node.children[i];
+                if (child == 0 || child >= nextBlockId || child == blockId) {
+                    report.structureErrors++;
+                    report.note(where + "child " + to_string(i) + " points to block " + to_string(child));
+                    return;
+                }
+            }
+        }
+
+        block.kind = node.isLeaf ? BlockKind::Leaf : BlockKind::Internal;
+        block.numKeys = n;
+        if (n > 0) {
+            block.minKey = node.keys[0];
+            block.maxKey = node.keys[n-1];
+        }
+        if (!node.isLeaf) {
+            block.next = links.size();
+            links.insert(links.end(), node.keys, node.keys + n);
+            links.insert(links.end(), node.children, node.children + n + 1);
+        }
+    }
+
+    // Check the blocks in [first, end), reading them front to back in large batches
+    void scanBlocks(uint64_t first, uint64_t end, vector<ScannedBlock> &scanned, vector<uint64_t> &links,
+                    VerifyReport &report) const {
+        unique_ptr<BTreeNode> node(new BTreeNode());
+        const uint64_t perBatch = max<uint64_t>(1, VERIFY_BATCH_BYTES / BLOCK_SIZE);
+        vector<uint8_t> batch;
+        for (uint64_t start = first; start < end; start += perBatch) {
+            uint64_t n = min(perBatch, end - start);
+            batch.resize(n * BLOCK_SIZE);
+            storage->read(start * BLOCK_SIZE, batch.data(), batch.size());
+            report.bytes += batch.size();
+            for (uint64_t k = 0; k < n; k++) {
+                scanBlock(start + k, &batch[k * BLOCK_SIZE], scanned[start + k], links, *node, report);
+            }
+        }
+    }
+
+    // Second pass of verify, over what the scan recorded: walk the tree from the root,
+    // checking each node against the key range its parent gives it and every leaf's depth,
+    // then walk the free list. Every block may be reached once, by one of the two.
+    void verifyLinks(vector<ScannedBlock> &scanned, const vector<vector<uint64_t>> &links,
+                     uint64_t chunkBlocks, VerifyReport &report) const {
+        struct Visit {
+            uint64_t blockId, parent, depth;
+            bool hasLow, hasHigh;  // Keys must be above low and below high
+            uint64_t low, high;
+        };
+        auto fail = [&report](const string &problem) {
+            report.structureErrors++;
+            report.note(problem);
+        };
+
+        vector<Visit> stack;
+        if (rootBlockId >= nextBlockId) {
+            fail("root block " + to_string(rootBlockId) + " is past the end of the file");
+        } else if (rootBlockId != 0) {
+            stack.push_back(Visit{rootBlockId, 0, 1, false, false, 0, 0});
+        }
+        while (!stack.empty()) {
+            Visit v = stack.back();
+            stack.pop_back();
+            ScannedBlock &block = scanned[v.blockId];
+            string where = "block " + to_string(v.blockId) + ": ";
+            if (block.reached) {
+                fail(where + "linked from more than one parent");
+                continue;
+            }
+            block.reached = true;
+            if (block.kind == BlockKind::Bad) continue;  // Reported by the scan
+            if (block.kind == BlockKind::Free) {
+                fail(where + "free block linked from block " + to_string(v.parent));
+                continue;
+            }
+            if (block.numKeys == 0 && v.parent != 0) {
+                fail(where + "empty node below block " + to_string(v.parent));
+            }
+            if (block.numKeys > 0 && ((v.hasLow && block.minKey <= v.low) || (v.hasHigh && block.maxKey >= v.high))) {
+                fail(where + "keys outside the range of its place in block " + to_string(v.parent));
+            }
+            report.keys += block.numKeys;
+            if (block.kind == BlockKind::Leaf) {
+                report.leafNodes++;
+                if (report.height == 0) {
+                    report.height = v.depth;
+                } else if (v.depth != report.height) {
+                    fail(where + "leaf at depth " + to_string(v.depth) + ", others at " + to_string(report.height));
+                }
+                continue;
+            }
+            report.internalNodes++;
+            const uint64_t *keys = &links[(v.blockId - 1) / chunkBlocks][block.next];
+            const uint64_t *children = keys + block.numKeys;
+            for (uint64_t i = 0; i <= block.numKeys; i++) {
+                stack.push_back(Visit{children[i], v.blockId, v.depth + 1,
+                                      i > 0 || v.hasLow, i < block.numKeys || v.hasHigh,
+                                      i > 0 ? keys[i-1] : v.low, i < block.numKeys ? keys[i] : v.high});
+            }
+        }
+
+        for (uint64_t blockId = freeListHead; blockId != 0; ) {
+            string where = "block " + to_string(blockId) + ": ";
+            if (blockId >= nextBlockId) {
+                fail("free list links to block " + to_string(blockId) + " past the end of the file");
+                break;
+            }
+            ScannedBlock &block = scanned[blockId];
+            if (block.reached) {
+                fail(where + (block.kind == BlockKind::Free ? "free list loops back to it" : "on the free list and in the tree"));
+                break;
+            }
+            block.reached = true;
+            if (block.kind != BlockKind::Free) {
+                if (block.kind != BlockKind::Bad) fail(where + "on the free list but holds a node");
+                break;
+            }
+            report.freeBlocks++;
+            blockId = block.next;
+        }
+
+        for (uint64_t blockId = 1; blockId < nextBlockId; blockId++) {
+            if (!scanned[blockId].reached && scanned[blockId].kind != BlockKind::Bad) report.unreachableBlocks++;
+        }
+    }
+
+public:
+    // Ordered position in the tree. The cursor keeps only the nodes on the path from
+    // the root to the current key in memory, so walking n keys costs O(height + n/keys
+    // per node) block reads. Any insert or erase invalidates open cursors, except those
+    // of a snapshot, which read its version without latches.
+    class Cursor : public IndexCursor {
+    private:
+        struct PathEntry {
+            BTreeNode node;
+            int index;   // Current key in the last entry, child descended into in the others
+        };
+
+        PagedBTree *tree;
+        bool snapshot;           // Walks a snapshot rather than the live tree
+        uint64_t snapshotRoot;   // Root block of the snapshot's version
+        vector<PathEntry> path;
+        size_t moves;   // Subtrees the cursor has moved into since it was positioned
+
+        void push(uint64_t blockId, int index) {
+            path.push_back(PathEntry{tree->loadNodeIn(blockId, snapshot), index});
+        }
+
+        uint64_t root() const {
+            return snapshot ? snapshotRoot : tree->rootBlockId;
+        }
+
+        // Walk down to the leftmost key of the subtree rooted at blockId
+        void descendLeftmost(uint64_t blockId) {
+            while (true) {
+                push(blockId, 0);
+                if (path.back().node.isLeaf) return;
+                blockId = path.back().node.children[0];
+            }
+        }
+
+        // Walk down to the rightmost key of the subtree rooted at blockId
+        void descendRightmost(uint64_t blockId) {
+            while (true) {
+                push(blockId, 0);
+                PathEntry &top = path.back();
+                if (top.node.isLeaf) {
+                    top.index = (int)top.node.numKeys - 1;
+                    return;
+                }
+                top.index = (int)top.node.numKeys;
+                blockId = top.node.children[top.node.numKeys];
+            }
+        }
+
+        // After running off the end of a leaf, climb to the next ancestor key
+        bool climbForward() {
+            while (!path.empty() && path.back().index >= (int)path.back().node.numKeys) {
+                path.pop_back();
+            }
+            return !path.empty();
+        }
+
+        // After running off the start of a leaf, climb to the previous ancestor key
+        bool climbBackward() {
+            while (!path.empty() && path.back().index < 0) {
+                path.pop_back();
+                if (!path.empty()) path.back().index--;
+            }
+            return !path.empty();
+        }
+
+        // Read ahead the siblings after (step 1) or before (step -1) child index of an
+        // internal node the cursor is about to enter. Short scans read nothing ahead; from
+        // the third subtree on, 1, 2, 4, ... siblings up to the pool's read-ahead window.
+        void readAhead(const BTreeNode &node, int index, int step) {
+            moves++;
+            if (moves < 3) return;
+            size_t ahead = (size_t)1 << min<size_t>(moves - 3, 10);
+            tree->prefetchChildren(node, index + step, step, ahead);
+        }
+
+    public:
+        Cursor(PagedBTree *owner) : tree(owner), snapshot(false), snapshotRoot(0), moves(0) {}
+
+        // Cursor over the snapshot whose version has the given root
+        Cursor(PagedBTree *owner, uint64_t root) : tree(owner), snapshot(true), snapshotRoot(root), moves(0) {}
+
+        // Position on the first key >= key; returns false if there is none
+        bool seek(uint64_t key) override {
+            path.clear();
+            moves = 0;
+            uint64_t blockId = root();
+            while (blockId != 0) {
+                push(blockId, 0);
+                PathEntry &top = path.back();
+                int i = lowerBound(top.node.keys, (int)top.node.numKeys, key);
+                top.index = i;
+                if ((i < (int)top.node.numKeys && key == top.node.keys[i]) || top.node.isLeaf) break;
+                blockId = top.node.children[i];
+            }
+            return climbForward();
+        }
+
+        // Position on the smallest key; returns false if the tree is empty
+        bool first() override {
+            path.clear();
+            moves = 0;
+            if (root() == 0) return false;
+            descendLeftmost(root());
+            return climbForward();
+        }
+
+        // Position on the largest key; returns false if the tree is empty
+        bool last() override {
+            path.clear();
+            moves = 0;
+            if (root() == 0) return false;
+            descendRightmost(root());
+            return climbBackward();
+        }
+
+        // Move to the next key in ascending order; returns false past the end
+        bool next() override {
+            if (path.empty()) return false;
+            PathEntry &top = path.back();
+            if (!top.node.isLeaf) {
+                top.index++;
+                readAhead(top.node, top.index, 1);
+                descendLeftmost(top.node.children[top.index]);
+                return true;
+            }
+            top.index++;
+            return climbForward();
+        }
+
+        // Move to the previous key; returns false before the beginning
+        bool prev() override {
+            if (path.empty()) return false;
+            PathEntry &top = path.back();
+            if (!top.node.isLeaf) {
+                readAhead(top.node, top.index, -1);
+                descendRightmost(top.node.children[top.index]);
+                return true;
+            }
+            top.index--;
+            return climbBackward();
+        }
+
+        bool valid() const override {
+            return !path.empty();
+        }
+
+        uint64_t key() const override {
+            return path.back().node.keys[path.back().index];
+        }
+
+        uint64_t value() const override {
+            return path.back().node.values[path.back().index];
+        }
+    };
+
+    IndexCursor *newCursor() override {
+        return new Cursor(this);
+    }
+
+    // A published version of the tree. Its blocks stay as they are until it is destroyed,
+    // so it can be read from any number of threads while writers go on.
+    class Snapshot : public IndexSnapshot {
+    private:
+        PagedBTree *tree;
+        uint64_t root;
+        uint64_t ver;
+
+    public:
+        Snapshot(PagedBTree *owner, uint64_t root, uint64_t version) : tree(owner), root(root), ver(version) {}
+
+        ~Snapshot() override {
+            lock_guard<mutex> guard(tree->versionLatch);
+            tree->snapshotVersions.erase(tree->snapshotVersions.find(ver));
+        }
+
+        uint64_t rootBlockId() const override {
+            return root;
+        }
+
+        uint64_t version() const override {
+            return ver;
+        }
+
+        IndexCursor *newCursor() override {
+            return new Cursor(tree, root);
+        }
+
+        // Write the version's entries like PagedBTree::exportEntries. The file's access
+        // pattern advice is left alone, since writers keep using it meanwhile.
+        void exportEntries(int fd, char separator, unsigned threads) override {
+            tree->exportToFd(root, true, fd, separator, threads);
+        }
+    };
+
+    // Publish the tree as it is now, once the writes in progress are done, and open a
+    // snapshot of it. Only in copy-on-write mode.
+    IndexSnapshot *openSnapshot() override {
+        if (!fileOpen) {
+            throw runtime_error("No index file is open.");
+        }
+        if (!copyOnWrite) {
+            throw runtime_error("Snapshots need copy-on-write mode.");
+        }
+        unique_lock<shared_mutex> quiesce(commitLatch);
+        publishVersion();
+        lock_guard<mutex> guard(versionLatch);
+        snapshotVersions.insert(publishedVersion);
+        return new Snapshot(this, publishedRoot, publishedVersion);
+    }
+
+    PagedBTree(size_t cacheFrames = DEFAULT_POOL_FRAMES) : pool(BLOCK_SIZE, cacheFrames) {
+        fileOpen = false;
+        nodeFormat = DEFAULT_NODE_FORMAT;
+        newNodeFormat = DEFAULT_NODE_FORMAT;
+        formatVersion = FORMAT_VERSION;
+        storageKind = StorageKind::Pread;
+        walEnabled = true;
+        headerDirty = false;
+        commitInterval = DEFAULT_COMMIT_INTERVAL;
+        opsSinceCommit = 0;
+        rootBlockId = 0;
+        nextBlockId = 1;
+        freeListHead = 0;
+        bloomRate = 0;
+        bloomMaxBytes = 0;
+        filterGeneration = 0;
+        openedGeneration = 0;
+        filterSaved = false;
+        copyOnWrite = false;
+        newCopyOnWrite = false;
+        publishedVersion = 0;
+        publishedRoot = 0;
+        resetStats();
+    }
+
+    // Create (or truncate) an index file holding an empty tree; throws runtime_error on failure
+    void createIndex(const string &path) override {
+        closeFile();
+        fileName = path;
+        // Create/truncate the file
+        if (!openStorage(fileName, true)) {
+            throw runtime_error("Unable to create file.");
+        }
+
+        // Initialize empty tree header. A filter sidecar of an earlier file of this name
+        // no longer applies.
+        rootBlockId = 0;
+        nextBlockId = 1;
+        freeListHead = 0;
+        nodeFormat = newNodeFormat;
+        useCurrentFormat();
+        filterGeneration = 0;
+        remove(filterPath().c_str());
+        openFilter();
+        writeHeader();
+        storage->flush();
+        copyOnWrite = newCopyOnWrite;
+        resetVersions();
+        opsSinceCommit = 0;
+        fileOpen = true;
+        resetStats();
+    }
+
+    // Open an existing index file; throws runtime_error if it is missing or invalid
+    void openIndex(const string &path) override {
+        closeFile();
+        fileName = path;
+        if (!openStorage(fileName, false)) {
+            throw runtime_error("File does not exist.");
+        }
+        try {
             readHeader();
+            openFilter();
+        } catch (runtime_error &) {
+            filter.reset();
+            closeStorage();
+            throw;
+        }
+
+        copyOnWrite = newCopyOnWrite;
+        resetVersions();
+        opsSinceCommit = 0;
+        fileOpen = true;
+        resetStats();
+    }
+
+    bool isOpen() const override {
+        return fileOpen;
+    }
+
+    size_t pageSize() const override {
+        return BLOCK_SIZE;
+    }
+
+    // Insert a key/value pair; returns false (and changes nothing) if the key already exists.
+    // Safe to call from several threads at once, also concurrently with search.
+    bool insert(uint64_t key, uint64_t value) override {
+        uint64_t existing;
+        return !write(key, value, WriteMode::Insert, existing);
+    }
+
+    // Insert, upsert or update a key in one descent; returns true if the key was already
+    // there and sets previous to its value before the write. Safe to call from several
+    // threads at once, also concurrently with search and erase.
+    bool write(uint64_t key, uint64_t value, WriteMode mode, uint64_t &previous) override {
+        auto start = chrono::steady_clock::now();
+        // An update of a key the filter rules out has nothing to change
+        if (mode == WriteMode::Update && !filterAllows(key)) {
+            counters.insert.record(nanosSince(start));
+            return false;
+        }
+        bool existed;
+        bool adds = filter && mode != WriteMode::Update;
+        {
+            shared_lock<shared_mutex> writer(commitLatch);
+            markModified();
+            if (adds) filter->mark(key);
+            existed = writeKey(key, value, mode, previous);
+        }
+        if (adds && !existed) filter->countAdded();
+        if (mode == WriteMode::Update && !existed) countFalsePositive();
+        counters.insert.record(nanosSince(start));
+        finishOperation();
+        return existed;
+    }
+
+    // Look up a key; returns true and sets value if found. Safe to call from several threads.
+    bool search(uint64_t key, uint64_t &value) override {
+        auto start = chrono::steady_clock::now();
+        bool found = false;
+        if (filterAllows(key)) {
+            found = searchKey(key, value);
+            if (!found) countFalsePositive();
+        }
+        counters.search.record(nanosSince(start));
+        return found;
+    }
+
+    // Remove a key; returns false (and changes nothing) if it is not in the tree. Blocks
+    // emptied by merges go on the free list for later inserts. Safe to call from several
+    // threads at once, also concurrently with insert and search.
+    bool erase(uint64_t key) override {
+        auto start = chrono::steady_clock::now();
+        // A key the filter rules out is not there to delete, and there is nothing to commit
+        if (!filterAllows(key)) {
+            counters.erase.record(nanosSince(start));
+            return false;
+        }
+        bool erased;
+        uint64_t value;
+        {
+            shared_lock<shared_mutex> writer(commitLatch);
+            markModified();
+            erased = deleteKey(key, value);
+        }
+        if (erased && filter) filter->countRemoved();
+        if (!erased) countFalsePositive();
+        counters.erase.record(nanosSince(start));
+        finishOperation();
+        return erased;
+    }
+
+    // Look up many keys at once. The batch is sorted and pushed down the tree together,
+    // split at each node's separators, so shared upper levels are read once per batch.
+    // values[i] and found[i] answer keys[i]. Keys the Bloom filter rules out are left out
+    // of the batch. Safe to call from several threads.
+    void multiGet(const vector<uint64_t> &keys, vector<uint64_t> &values, vector<bool> &found) override {
+        values.assign(keys.size(), 0);
+        found.assign(keys.size(), false);
+        vector<size_t> order;
+        order.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (filterAllows(keys[i])) order.push_back(i);
+        }
+        sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+        shared_lock<shared_mutex> rootLock(rootLatch);
+        uint64_t blockId = rootBlockId;
+        if (blockId == 0 || order.empty()) return;
+        LatchGuard latch(latches, blockId, false);
+        rootLock.unlock();
+        multiGetNode(blockId, keys, order, 0, order.size(), values, found);
+        for (size_t i : order) {
+            if (!found[i]) countFalsePositive();
+        }
+    }
+
+    // Commit all pending changes now
+    void sync() override {
+        commit();
+    }
+
+    // Rewrite the index without free blocks, with its nodes stored in the given order
+    void compact(CompactOrder order) override {
+        compactFile(order);
+    }
+
+    // Write all keys/values in ascending order to fd as "key<separator>value" lines, formatted
+    // by the given number of threads (0 for one per CPU). In copy-on-write mode the entries
+    // come from a snapshot, so writers may go on meanwhile.
+    void exportEntries(int fd, char separator, unsigned threads) override {
+        if (!fileOpen) {
+            throw runtime_error("No index file is open.");
+        }
+        if (copyOnWrite) {
+            unique_ptr<IndexSnapshot> snapshot(openSnapshot());
+            snapshot->exportEntries(fd, separator, threads);
+            return;
+        }
+        storage->advise(AccessPattern::Sequential);
+        try {
+            exportToFd(rootBlockId, false, fd, separator, threads);
+        } catch (runtime_error &) {
+            storage->advise(AccessPattern::Random);
+            throw;
+        }
+        storage->advise(AccessPattern::Random);
+    }
+
+    // Separator keys of the upper levels that cut the tree into up to wanted consecutive
+    // ranges of similar size, ascending. Expects no concurrent writers.
+    vector<uint64_t> splitKeys(size_t wanted) override {
+        vector<uint64_t> keys;
+        if (!fileOpen) return keys;
+        for (const ExportRange &range : splitForExport(rootBlockId, false, wanted)) {
+            if (range.hasSeparator) keys.push_back(range.key);
+        }
+        return keys;
+    }
+
+    // Insert every "key,value" line of a CSV file one at a time, skipping existing keys
+    void load(const string &path) override {
+        if (!fileOpen) {
+            throw runtime_error("No index file is open.");
+        }
+        loadFromFile(path);
+    }
+
+    // Merge a CSV file into the index with a bottom-up rebuild
+    void bulkLoad(const string &path) override {
+        if (!fileOpen) {
+            throw runtime_error("No index file is open.");
+        }
+        bulkLoadFromFile(path);
+    }
+
+    // Blocks the buffer pool has read from and written to storage
+    uint64_t blocksRead() const override {
+        return pool.readCount();
+    }
+
+    uint64_t blocksWritten() const override {
+        return pool.writeCount();
+    }
+
+    // Operation statistics since the index was created or opened, or since resetStats
+    IndexStats stats() const override {
+        IndexStats s;
+        counters.snapshot(s, BLOCK_SIZE);
+        s.blockReads = pool.readCount() - blockReadsBase;
+        s.blockPrefetches = pool.prefetchCount() - blockPrefetchesBase;
+        s.blockWrites = pool.writeCount() - blockWritesBase;
+        s.fsyncs = storageSyncCount.load(memory_order_relaxed) - fsyncsBase;
+        s.bloomBytes = filter ? filter->bytes() : 0;
+        s.bloomKeys = filter ? filter->keys() - filter->keysRemoved() : 0;
+        s.bloomLayers = filter ? filter->layers() : 0;
+        s.bloomTargetRate = filter ? filter->targetRate() : 0;
+        s.bloomEstimatedRate = filter ? filter->estimatedRate() : 0;
+        lock_guard<mutex> guard(versionLatch);
+        s.copyOnWrite = copyOnWrite;
+        s.version = copyOnWrite ? publishedVersion : 0;
+        s.snapshotsOpen = snapshotVersions.size();
+        s.blocksRetired = retiredBlocks.size();
+        return s;
+    }
+
+    void resetStats() override {
+        counters.reset();
+        blockReadsBase = pool.readCount();
+        blockPrefetchesBase = pool.prefetchCount();
+        blockWritesBase = pool.writeCount();
+        fsyncsBase = storageSyncCount.load(memory_order_relaxed);
+    }
+
+    // Walk the whole tree to measure its height, node counts and node fill. Expects no
+    // concurrent writers.
+    TreeShape shape() override {
+        TreeShape shape;
+        memset(&shape, 0, sizeof(shape));
+        if (!fileOpen) return shape;
+        shape.fileBlocks = nextBlockId - 1;
+        double internalFill = 0, leafFill = 0;
+        if (rootBlockId != 0) {
+            storage->advise(AccessPattern::Sequential);
+            measureSubtree(rootBlockId, 1, shape, internalFill, leafFill);
+            storage->advise(AccessPattern::Random);
+        }
+        shape.averageInternalFill = shape.internalNodes ? internalFill / (double)shape.internalNodes : 0;
+        shape.averageLeafFill = shape.leafNodes ? leafFill / (double)shape.leafNodes : 0;
+
+        lock_guard<mutex> guard(freeListLatch);
+        for (uint64_t blockId = freeListHead; blockId != 0; shape.freeBlocks++) {
+            const uint8_t *buffer = pool.pin(blockId);
+            uint64_t beNext;
+            memcpy(&beNext, buffer, sizeof(beNext));
+            pool.unpin(blockId, false);
+            blockId = bigToHost(beNext);
+        }
+        return shape;
+    }
+
+    // Check the whole index file. Every block is read sequentially, the file split into one
+    // contiguous range per thread (threads = 0 for one per core), and checked on its own:
+    // its checksum, its numKeys against what fits the page, the order of its keys and its
+    // child IDs. A second pass checks the links between blocks from what the scan recorded,
+    // without reading the file again. Commits first and expects no concurrent writers.
+    VerifyReport verify(unsigned threads) override {
+        VerifyReport report;
+        if (!fileOpen) return report;
+        auto start = chrono::steady_clock::now();
+        commit();
+        report.checksums = formatVersion >= FORMAT_VERSION_CHECKSUMS;
+        uint64_t end = nextBlockId;
+        report.blocks = end - 1;
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        uint64_t chunkBlocks = max<uint64_t>(1, (report.blocks + threads - 1) / threads);
+        threads = (unsigned)((report.blocks + chunkBlocks - 1) / chunkBlocks);
+
+        vector<ScannedBlock> scanned(end);
+        vector<vector<uint64_t>> links(threads);
+        vector<VerifyReport> parts(threads);
+        vector<exception_ptr> errors(threads);
+        storage->advise(AccessPattern::Sequential);
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                try {
+                    uint64_t first = 1 + t * chunkBlocks;
+                    scanBlocks(first, min(end, first + chunkBlocks), scanned, links[t], parts[t]);
+                } catch (...) {
+                    errors[t] = current_exception();
+                }
+            });
+        }
+        for (auto &w : workers) w.join();
+        storage->advise(AccessPattern::Random);
+        for (auto &error : errors) {
+            if (error) rethrow_exception(error);
+        }
+
+        for (const VerifyReport &part : parts) {
+            report.bytes += part.bytes;
+            report.checksumErrors += part.checksumErrors;
+            report.structureErrors += part.structureErrors;
+            for (const string &problem : part.problems) report.note(problem);
+        }
+        verifyLinks(scanned, links, chunkBlocks, report);
+        report.seconds = (double)nanosSince(start) / 1e9;
+        return report;
+    }
+
+    // Insert command: prompt user for key/value and insert
+    void insertCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key and value: ";
+        uint64_t key, value;
+        if (!(cin >> key >> value)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        try {
+            if (!insert(key, value)) {
+                cerr << "Error: Key already exists.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Upsert command: prompt user for a key and value, adding the key or replacing its value
+    void upsertCommand() override {
+        writeCommand(WriteMode::Upsert);
+    }
+
+    // Update command: prompt user for a key and value, replacing the value of an existing key
+    void updateCommand() override {
+        writeCommand(WriteMode::Update);
+    }
+
+    // Shared by upsert and update: write the entered pair and print the value it replaced
+    void writeCommand(WriteMode mode) {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key and value: ";
+        uint64_t key, value;
+        if (!(cin >> key >> value)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        try {
+            uint64_t previous;
+            if (write(key, value, mode, previous)) {
+                cout << "Replaced value " << previous << ".\n";
+            } else if (mode == WriteMode::Update) {
+                cerr << "Error: Key not found.\n";
+            } else {
+                cout << "Key inserted.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Search command: prompt user for key and search the B-Tree
+    void searchCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key: ";
+        uint64_t key;
+        if (!(cin >> key)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        uint64_t value;
+        if (search(key, value)) {
+            cout << key << " " << value << "\n";
+        } else {
+            cerr << "Error: Key not found.\n";
+        }
+    }
+
+    // Delete command: prompt user for a key and remove it from the B-Tree
+    void deleteCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key: ";
+        uint64_t key;
+        if (!(cin >> key)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        try {
+            if (!erase(key)) {
+                cerr << "Error: Key not found.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Multiget command: look up a batch of keys, printing results in the order given
+    void multiGetCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter the number of keys: ";
+        uint64_t count;
+        if (!(cin >> count)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+        cout << "Enter keys: ";
+        vector<uint64_t> keys(count);
+        for (uint64_t i = 0; i < count; i++) {
+            if (!(cin >> keys[i])) {
+                cerr << "Error: Invalid input.\n";
+                cin.clear(); cin.ignore(10000,'\n');
+                return;
+            }
+        }
+
+        vector<uint64_t> values;
+        vector<bool> found;
+        multiGet(keys, values, found);
+        for (uint64_t i = 0; i < count; i++) {
+            if (found[i]) {
+                cout << keys[i] << " " << values[i] << "\n";
+            } else {
+                cerr << "Error: Key " << keys[i] << " not found.\n";
+            }
+        }
+    }
+
+    // Load command: load key/value pairs from a given CSV file
+    void loadCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter the file name to load from: ";
+        string fname; cin >> fname;
+        try {
+            loadFromFile(fname);
         } catch (runtime_error &e) {
             cerr << "Error: " << e.what() << "\n";
-            file.close();
-            return;
         }
-
-        fileOpen = true;
-        cout << "File opened successfully.\n";
     }
 
-    // Insert command: prompt user for key/value and insert
-    void insertCommand() {
+    // Range command: print all keys/values with low <= key <= high in ascending order
+    void rangeCommand() override {
         if (!fileOpen) {
             cerr << "Error: No index file is open.\n";
             return;
         }
-        cout << "Enter key and value: ";
-        uint64_t key, value;
-        if (!(cin >> key >> value)) {
+        cout << "Enter low and high keys: ";
+        uint64_t low, high;
+        if (!(cin >> low >> high)) {
             cerr << "Error: Invalid input.\n";
             cin.clear(); cin.ignore(10000,'\n');
             return;
         }
-
-        // Check for duplicate
-        if (keyExists(key)) {
-            cerr << "Error: Key already exists.\n";
-            return;
-        }
-
-        try {
-            insertKey(key, value);
-        } catch (runtime_error &e) {
-            cerr << "Error: " << e.what() << "\n";
+        Cursor c(this);
+        for (bool more = low <= high && c.seek(low); more && c.key() <= high; more = c.next()) {
+            cout << c.key() << " " << c.value() << "\n";
         }
     }
 
-    // Search command: prompt user for key and search the B-Tree
-    void searchCommand() {
+    // Scan command: print the next count keys/values after a given key
+    void scanCommand() override {
         if (!fileOpen) {
             cerr << "Error: No index file is open.\n";
             return;
         }
-        cout << "Enter key: ";
-        uint64_t key;
-        if (!(cin >> key)) {
+        cout << "Enter start key and count: ";
+        uint64_t start, count;
+        if (!(cin >> start >> count)) {
             cerr << "Error: Invalid input.\n";
             cin.clear(); cin.ignore(10000,'\n');
             return;
         }
+        Cursor c(this);
+        bool more = c.seek(start);
+        if (more && c.key() == start) more = c.next();
+        for (uint64_t n = 0; more && n < count; n++) {
+            cout << c.key() << " " << c.value() << "\n";
+            more = c.next();
+        }
+    }
 
-        if (rootBlockId == 0) {
-            cerr << "Error: Key not found.\n";
+    // Bulk load command: rebuild the tree from its contents plus a CSV file in one sorted pass
+    void bulkLoadCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
             return;
         }
-        uint64_t value;
-        if (searchKey(rootBlockId, key, value)) {
-            cout << key << " " << value << "\n";
-        } else {
-            cerr << "Error: Key not found.\n";
+        cout << "Enter the file name to load from: ";
+        string fname; cin >> fname;
+        try {
+            bulkLoadFromFile(fname);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
         }
     }
 
-    // Load command: load key/value pairs from a given CSV file
-    void loadCommand() {
+    // Compact command: rewrite the index in breadth-first or key order, dropping free blocks
+    void compactCommand() override {
         if (!fileOpen) {
             cerr << "Error: No index file is open.\n";
             return;
         }
-        cout << "Enter the file name to load from: ";
-        string fname; cin >> fname;
+        cout << "Enter the block order (bfs or key): ";
+        string orderName; cin >> orderName;
+        CompactOrder order;
+        if (orderName == "bfs") {
+            order = CompactOrder::BreadthFirst;
+        } else if (orderName == "key") {
+            order = CompactOrder::KeyOrder;
+        } else {
+            cerr << "Error: Block order must be bfs or key.\n";
+            return;
+        }
+
+        uint64_t blocksBefore = nextBlockId - 1;
         try {
-            loadFromFile(fname);
+            compactFile(order);
         } catch (runtime_error &e) {
             cerr << "Error: " << e.what() << "\n";
+            return;
         }
+        cout << "Compaction completed: " << blocksBefore << " blocks before, "
+             << nextBlockId - 1 << " after.\n";
     }
 
     // Print command: print all keys/values in ascending order
-    void printCommand() {
+    void printCommand() override {
         if (!fileOpen) {
             cerr << "Error: No index file is open.\n";
             return;
@@ -551,11 +2829,18 @@ public:
             // Empty tree, nothing to print
             return;
         }
-        printInOrder(rootBlockId);
+        // Entries go straight to standard output, after whatever cout still buffers
+        cout.flush();
+        try {
+            exportEntries(STDOUT_FILENO, ' ', 0);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
     }
 
-    // Extract command: write all keys/values to a specified file in ascending order
-    void extractCommand() {
+    // Extract command: write all keys/values to a specified file in ascending order, as
+    // binary records if its name ends in .bin
+    void extractCommand() override {
         if (!fileOpen) {
             cerr << "Error: No index file is open.\n";
             return;
@@ -576,31 +2861,612 @@ public:
             }
         }
 
-        ofstream out(fname);
-        if (!out.is_open()) {
+        int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
             cerr << "Error: Unable to open output file.\n";
             return;
         }
 
-        if (rootBlockId != 0) {
-            extractInOrder(rootBlockId, out);
+        bool binary = isRecordFileName(fname);
+        try {
+            if (binary && !startRecordFile(fd)) {
+                throw runtime_error("Unable to write output file.");
+            }
+            exportEntries(fd, binary ? BINARY_RECORDS : ',', 0);
+            if (binary && !finishRecordFile(fd)) {
+                throw runtime_error("Unable to write output file.");
+            }
+        } catch (runtime_error &e) {
+            ::close(fd);
+            cerr << "Error: " << e.what() << "\n";
+            return;
         }
-        out.close();
+        ::close(fd);
         cout << "Extract completed.\n";
     }
 
-    // Close the currently open file and reset state
-    void closeFile() {
-        if (file.is_open()) {
-            file.close();
+    // Sync command: commit all pending changes to the index file now
+    void syncCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        commit();
+        cout << "Index file synced.\n";
+    }
+
+    // Stats command: print the operation statistics and the shape of the tree
+    void statsCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        try {
+            TreeShape treeShape = shape();
+            printIndexStats(cout, stats(), treeShape);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Verify command: check every block of the index file and the links between them
+    void verifyCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        try {
+            printVerifyReport(cout, verify(0));
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Reset stats command: start counting operations from zero
+    void resetStatsCommand() override {
+        if (!fileOpen) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        resetStats();
+        cout << "Statistics reset.\n";
+    }
+
+    // Set the durability mode: commit every n operations, or only on sync/close when n is 0
+    void setCommitInterval(uint64_t n) override {
+        commitInterval = n;
+        if (fileOpen && commitInterval != 0 && opsSinceCommit >= commitInterval) {
+            commit();
+        }
+    }
+
+    // Choose the storage backend used by the next create/open
+    void setStorageKind(StorageKind kind) override {
+        storageKind = kind;
+    }
+
+    // Choose the node format used by the next create
+    void setNodeFormat(uint64_t format) override {
+        newNodeFormat = format;
+    }
+
+    // Turn the write-ahead log on or off for the next create/open
+    void setWalEnabled(bool enabled) override {
+        walEnabled = enabled;
+    }
+
+    // Choose copy-on-write or in-place updates for the next create/open
+    void setCopyOnWrite(bool enabled) override {
+        newCopyOnWrite = enabled;
+    }
+
+    bool copyOnWriteEnabled() const override {
+        return copyOnWrite;
+    }
+
+    // Choose the read-ahead engine and how many reads it may have in flight
+    void setReadAhead(IoEngine engine, size_t depth) override {
+        pool.setReadAhead(engine, depth);
+    }
+
+    const char *readAheadEngine() const override {
+        return pool.readAheadEngine();
+    }
+
+    // Turn the Bloom filter on (rate > 0) or off for the next create/open
+    void setBloomFilter(double rate, size_t maxBytes) override {
+        bloomRate = rate;
+        bloomMaxBytes = maxBytes;
+    }
+
+    // Close the currently open file and reset state. A filter that changed is saved next
+    // to the index after the final commit; if that fails, the next open rebuilds it.
+    // Snapshots must be closed first.
+    void closeFile() override {
+        if (storage && storage->isOpen()) {
+            if (fileOpen) {
+                bool saveFilter = filter && !filterSaved;
+                if (saveFilter && filterGeneration == 0) {
+                    filterGeneration = nextGeneration(0);
+                    headerDirty = true;
+                }
+                commit();
+                if (saveFilter) filter->save(filterPath(), filterGeneration);
+            }
+            closeStorage();
         }
+        filter.reset();
+        filterSaved = false;
         fileOpen = false;
         rootBlockId = 0;
         nextBlockId = 1;
+        freeListHead = 0;
+        resetVersions();
     }
 
     // Destructor: ensure file is closed
-    ~BTree() {
+    ~PagedBTree() {
         closeFile();
     }
 };
+
+// Disk-based B-Tree index. Every index file records its page size in the header: new files
+// get the page size chosen with setPageSize, and open picks the tree compiled for the page
+// size found in the file. All other calls go to that tree.
+class BTree {
+private:
+    unique_ptr<IndexTree> tree;   // Tree for the current file's page size
+    size_t newPageSize;           // Page size used by the next create
+    uint64_t newNodeFormat;       // Node format used by the next create
+    bool walEnabled;              // Log writes to <index>.wal before they reach the index
+    bool copyOnWrite;             // Copy-on-write updates for the next create/open
+    size_t cacheFrames;           // Buffer pool frames given to each tree
+    IoEngine ioEngine;            // Read-ahead engine given to each tree
+    size_t ioDepth;               // Read-ahead reads in flight
+    double bloomRate;             // Bloom filter false-positive rate, 0 for no filter
+    size_t bloomMaxBytes;         // Memory the Bloom filter may use, 0 for no limit
+    StorageKind storageKind;      // Backend used for the next create/open
+    uint64_t commitInterval;      // Operations per commit, 0 for explicit sync only
+
+    static IndexTree *makeTree(size_t pageSize, size_t cacheFrames) {
+        switch (pageSize) {
+            case 512: return new PagedBTree<NodeLayout<512>>(cacheFrames);
+            case 1024: return new PagedBTree<NodeLayout<1024>>(cacheFrames);
+            case 2048: return new PagedBTree<NodeLayout<2048>>(cacheFrames);
+            case 4096: return new PagedBTree<NodeLayout<4096>>(cacheFrames);
+            case 8192: return new PagedBTree<NodeLayout<8192>>(cacheFrames);
+            case 16384: return new PagedBTree<NodeLayout<16384>>(cacheFrames);
+            case 32768: return new PagedBTree<NodeLayout<32768>>(cacheFrames);
+            case 65536: return new PagedBTree<NodeLayout<65536>>(cacheFrames);
+        }
+        throw runtime_error("Unsupported page size.");
+    }
+
+    // Close the current file and switch to the tree compiled for a page size
+    void useLayout(size_t pageSize) {
+        tree->closeFile();
+        if (tree->pageSize() == pageSize) return;
+        tree.reset(makeTree(pageSize, cacheFrames));
+        tree->setStorageKind(storageKind);
+        tree->setNodeFormat(newNodeFormat);
+        tree->setWalEnabled(walEnabled);
+        tree->setCopyOnWrite(copyOnWrite);
+        tree->setCommitInterval(commitInterval);
+        tree->setReadAhead(ioEngine, ioDepth);
+        tree->setBloomFilter(bloomRate, bloomMaxBytes);
+    }
+
+    // Page size recorded in an existing file. Files that cannot be read as an index keep
+    // the current page size, so opening them reports the actual problem.
+    size_t filePageSize(const string &path) {
+        char header[HEADER_SIZE] = {0};
+        ifstream in(path, ios::binary);
+        if (!in.read(header, HEADER_SIZE) || !hasIndexMagic(header)) {
+            return tree->pageSize();
+        }
+        size_t pageSize = readHeaderPageSize(header);
+        if (!isSupportedPageSize(pageSize)) {
+            throw runtime_error("Unsupported page size in file header.");
+        }
+        return pageSize;
+    }
+
+public:
+    // Ordered position in the tree. The cursor keeps only the nodes on the path from
+    // the root to the current key in memory, so walking n keys costs O(height + n/keys
+    // per node) block reads. Any insert or erase invalidates open cursors, except cursors
+    // of a snapshot.
+    class Cursor {
+    private:
+        unique_ptr<IndexCursor> impl;
+
+    public:
+        Cursor(BTree *owner) : impl(owner->tree->newCursor()) {}
+        explicit Cursor(IndexCursor *impl) : impl(impl) {}
+
+        // Position on the first key >= key; returns false if there is none
+        bool seek(uint64_t key) { return impl->seek(key); }
+        // Position on the smallest key; returns false if the tree is empty
+        bool first() { return impl->first(); }
+        // Position on the largest key; returns false if the tree is empty
+        bool last() { return impl->last(); }
+        // Move to the next key in ascending order; returns false past the end
+        bool next() { return impl->next(); }
+        // Move to the previous key; returns false before the beginning
+        bool prev() { return impl->prev(); }
+        bool valid() const { return impl->valid(); }
+        uint64_t key() const { return impl->key(); }
+        uint64_t value() const { return impl->value(); }
+    };
+
+    // Forward iterator over the key/value pairs of a key range, for range-based for loops
+    class RangeIterator {
+    private:
+        Cursor cursor;
+        uint64_t high;
+        bool atEnd;
+
+    public:
+        RangeIterator(BTree *tree, uint64_t low, uint64_t high, bool end) : cursor(tree), high(high) {
+            atEnd = end || !cursor.seek(low) || cursor.key() > high;
+        }
+
+        KeyValue operator*() const {
+            return KeyValue{cursor.key(), cursor.value()};
+        }
+
+        RangeIterator &operator++() {
+            atEnd = !cursor.next() || cursor.key() > high;
+            return *this;
+        }
+
+        bool operator==(const RangeIterator &other) const {
+            return atEnd && other.atEnd;
+        }
+
+        bool operator!=(const RangeIterator &other) const {
+            return !(*this == other);
+        }
+    };
+
+    // All key/value pairs with low <= key <= high, in ascending order
+    class Range {
+    private:
+        BTree *tree;
+        uint64_t low, high;
+
+    public:
+        Range(BTree *tree, uint64_t low, uint64_t high) : tree(tree), low(low), high(high) {}
+        RangeIterator begin() const { return RangeIterator(tree, low, high, low > high); }
+        RangeIterator end() const { return RangeIterator(tree, low, high, true); }
+    };
+
+    // Consistent read-only view of the tree as it was when the snapshot was opened, in
+    // copy-on-write mode. Its cursors and export read that version without latches while
+    // other threads keep writing, and the blocks only it still uses are reclaimed after it
+    // is destroyed. Close all snapshots before closing, compacting or bulk loading the index.
+    class Snapshot {
+    private:
+        unique_ptr<IndexSnapshot> impl;
+
+    public:
+        explicit Snapshot(IndexSnapshot *impl) : impl(impl) {}
+
+        // Root block of the snapshot's version (0 for an empty tree)
+        uint64_t rootBlockId() const { return impl->rootBlockId(); }
+        // Version number, counted from when the index was opened
+        uint64_t version() const { return impl->version(); }
+        Cursor cursor() { return Cursor(impl->newCursor()); }
+        // Like BTree::exportEntries, for the snapshot's version
+        void exportEntries(int fd, char separator = ',', unsigned threads = 0) {
+            impl->exportEntries(fd, separator, threads);
+        }
+    };
+
+    Cursor cursor() {
+        return Cursor(this);
+    }
+
+    // Open a snapshot of the tree; throws runtime_error unless copy-on-write mode is on.
+    // Waits for the writes in progress, which the snapshot then includes.
+    Snapshot snapshot() {
+        return Snapshot(tree->openSnapshot());
+    }
+
+    Range range(uint64_t low, uint64_t high) {
+        return Range(this, low, high);
+    }
+
+    BTree(size_t cacheFrames = DEFAULT_POOL_FRAMES) {
+        newPageSize = DEFAULT_PAGE_SIZE;
+        newNodeFormat = DEFAULT_NODE_FORMAT;
+        walEnabled = true;
+        copyOnWrite = false;
+        this->cacheFrames = cacheFrames;
+        storageKind = StorageKind::Pread;
+        commitInterval = DEFAULT_COMMIT_INTERVAL;
+        ioEngine = IoEngine::Uring;
+        ioDepth = DEFAULT_IO_DEPTH;
+        bloomRate = 0;
+        bloomMaxBytes = 0;
+        tree.reset(makeTree(newPageSize, cacheFrames));
+        tree->setReadAhead(ioEngine, ioDepth);
+    }
+
+    // Create (or truncate) an index file holding an empty tree; throws runtime_error on failure
+    void createIndex(const string &path) {
+        useLayout(newPageSize);
+        tree->createIndex(path);
+    }
+
+    // Open an existing index file; throws runtime_error if it is missing or invalid
+    void openIndex(const string &path) {
+        tree->closeFile();
+        useLayout(filePageSize(path));
+        tree->openIndex(path);
+    }
+
+    bool isOpen() const {
+        return tree->isOpen();
+    }
+
+    // Page size of the open file (or of the last one opened or created)
+    size_t pageSize() const {
+        return tree->pageSize();
+    }
+
+    // Insert a key/value pair; returns false (and changes nothing) if the key already exists.
+    // Safe to call from several threads at once, also concurrently with search.
+    bool insert(uint64_t key, uint64_t value) {
+        return tree->insert(key, value);
+    }
+
+    // Insert a key/value pair in one descent; returns true (and changes nothing) if the key
+    // already exists, with its value in existing.
+    bool insert(uint64_t key, uint64_t value, uint64_t &existing) {
+        return tree->write(key, value, WriteMode::Insert, existing);
+    }
+
+    // Add a key or replace its value in one descent (insert_or_assign); returns true if the
+    // key already existed, with the value it replaced in previous.
+    bool upsert(uint64_t key, uint64_t value, uint64_t &previous) {
+        return tree->write(key, value, WriteMode::Upsert, previous);
+    }
+
+    // Replace the value of an existing key in one descent; returns false (and changes
+    // nothing) if the key is not in the tree, else true with the replaced value in previous.
+    bool update(uint64_t key, uint64_t value, uint64_t &previous) {
+        return tree->write(key, value, WriteMode::Update, previous);
+    }
+
+    // Look up a key; returns true and sets value if found. Safe to call from several threads.
+    bool search(uint64_t key, uint64_t &value) {
+        return tree->search(key, value);
+    }
+
+    // Remove a key; returns false (and changes nothing) if it is not in the tree. Safe to
+    // call from several threads at once, also concurrently with insert and search.
+    bool erase(uint64_t key) {
+        return tree->erase(key);
+    }
+
+    // Look up many keys at once; values[i] and found[i] answer keys[i]. Safe to call from
+    // several threads.
+    void multiGet(const vector<uint64_t> &keys, vector<uint64_t> &values, vector<bool> &found) {
+        tree->multiGet(keys, values, found);
+    }
+
+    // Commit all pending changes now
+    void sync() {
+        tree->sync();
+    }
+
+    // Rewrite the index without free blocks, with its nodes stored in the given order
+    void compact(CompactOrder order) {
+        tree->compact(order);
+    }
+
+    // Write all keys/values in ascending order to fd as "key<separator>value" lines (the
+    // extract format with ','), formatted by the given number of threads (0 for one per CPU).
+    // With BINARY_RECORDS as the separator the entries are written as 16-byte records; the
+    // caller writes the record file header around them (startRecordFile, finishRecordFile).
+    void exportEntries(int fd, char separator = ',', unsigned threads = 0) {
+        tree->exportEntries(fd, separator, threads);
+    }
+
+    // Keys that cut the tree into up to wanted consecutive ranges of similar size, taken
+    // from its upper levels without reading the leaves; ascending, and empty for a tree
+    // of one node. Expects no concurrent writers.
+    vector<uint64_t> splitKeys(size_t wanted) {
+        return tree->splitKeys(wanted);
+    }
+
+    // Insert every "key,value" line of a CSV file, or every record of a binary record file,
+    // one at a time (the load command); lines with existing keys or bad syntax are reported
+    // on cerr and skipped. A sorted binary file loaded into an empty tree is bulk built.
+    void load(const string &path) {
+        tree->load(path);
+    }
+
+    // Merge a CSV or binary record file into the index by rebuilding it bottom-up (the
+    // bulkload command)
+    void bulkLoad(const string &path) {
+        tree->bulkLoad(path);
+    }
+
+    // Blocks read from and written to the index file through the buffer pool since the
+    // current file's page size was selected (not counted for memory-mapped files)
+    uint64_t blocksRead() const {
+        return tree->blocksRead();
+    }
+
+    uint64_t blocksWritten() const {
+        return tree->blocksWritten();
+    }
+
+    // Operation statistics (node loads and saves, block I/O, commits, fsyncs, block
+    // allocation, splits per depth, search depths and latency percentiles) since the
+    // index was created or opened, or since resetStats
+    IndexStats stats() const {
+        return tree->stats();
+    }
+
+    // Start the operation statistics from zero
+    void resetStats() {
+        tree->resetStats();
+    }
+
+    // Height, node counts and fill distribution of the tree, found by reading every node.
+    // Expects no concurrent writers.
+    TreeShape shape() {
+        return tree->shape();
+    }
+
+    // Check every block of the file (checksums, node bounds, key order) and the links
+    // between them, reading it sequentially on threads threads (0 for one per core).
+    // Commits first and expects no concurrent writers.
+    VerifyReport verify(unsigned threads = 0) {
+        return tree->verify(threads);
+    }
+
+    // Create a new B-Tree index file
+    void createFile() {
+        cout << "Enter the file name to create: ";
+        string fname; cin >> fname;
+        {
+            // Check if file already exists
+            ifstream test(fname, ios::binary);
+            if (test.is_open()) {
+                cout << "File already exists. Overwrite? (y/n): ";
+                char c; cin >> c;
+                if (c!='y' && c!='Y') {
+                    cout << "File creation aborted.\n";
+                    return;
+                }
+            }
+        }
+
+        try {
+            createIndex(fname);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        cout << "File created successfully.\n";
+    }
+
+    // Open an existing B-Tree index file
+    void openFile() {
+        cout << "Enter the file name to open: ";
+        string fname; cin >> fname;
+        try {
+            openIndex(fname);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        cout << "File opened successfully.\n";
+    }
+
+    void insertCommand() { tree->insertCommand(); }
+    void upsertCommand() { tree->upsertCommand(); }
+    void updateCommand() { tree->updateCommand(); }
+    void searchCommand() { tree->searchCommand(); }
+    void deleteCommand() { tree->deleteCommand(); }
+    void multiGetCommand() { tree->multiGetCommand(); }
+    void loadCommand() { tree->loadCommand(); }
+    void rangeCommand() { tree->rangeCommand(); }
+    void scanCommand() { tree->scanCommand(); }
+    void bulkLoadCommand() { tree->bulkLoadCommand(); }
+    void compactCommand() { tree->compactCommand(); }
+    void printCommand() { tree->printCommand(); }
+    void extractCommand() { tree->extractCommand(); }
+    void syncCommand() { tree->syncCommand(); }
+    void statsCommand() { tree->statsCommand(); }
+    void verifyCommand() { tree->verifyCommand(); }
+    void resetStatsCommand() { tree->resetStatsCommand(); }
+
+    // Choose the page size of files created from now on (a power of two from 512 B to 64 KiB)
+    void setPageSize(size_t pageSize) {
+        if (!isSupportedPageSize(pageSize)) {
+            throw runtime_error("Unsupported page size.");
+        }
+        newPageSize = pageSize;
+    }
+
+    // Choose the node format of files created from now on (NODE_FORMAT_PLAIN or NODE_FORMAT_PACKED)
+    void setNodeFormat(uint64_t format) {
+        if (format != NODE_FORMAT_PLAIN && format != NODE_FORMAT_PACKED) {
+            throw runtime_error("Unsupported node format.");
+        }
+        newNodeFormat = format;
+        tree->setNodeFormat(format);
+    }
+
+    // Turn the write-ahead log on or off for files created or opened from now on
+    void setWalEnabled(bool enabled) {
+        walEnabled = enabled;
+        tree->setWalEnabled(enabled);
+    }
+
+    // Choose copy-on-write updates (each write copies the nodes it changes up to a new
+    // root, so snapshots can be read while writers go on) or in-place updates for files
+    // created or opened from now on
+    void setCopyOnWrite(bool enabled) {
+        copyOnWrite = enabled;
+        tree->setCopyOnWrite(enabled);
+    }
+
+    // True if the open file is in copy-on-write mode
+    bool copyOnWriteEnabled() const {
+        return tree->copyOnWriteEnabled();
+    }
+
+    // Set the durability mode: commit every n operations, or only on sync/close when n is 0
+    void setCommitInterval(uint64_t n) {
+        commitInterval = n;
+        tree->setCommitInterval(n);
+    }
+
+    // Choose the storage backend used by the next create/open
+    void setStorageKind(StorageKind kind) {
+        storageKind = kind;
+        tree->setStorageKind(kind);
+    }
+
+    // Choose how blocks are read ahead during traversals, scans and batched lookups: the
+    // engine (io_uring by default, falling back to a thread pool) and the reads it may have
+    // in flight, at most half the cache frames. IoEngine::Off turns read-ahead off.
+    void setReadAhead(IoEngine engine, size_t depth) {
+        if (engine != IoEngine::Off && (depth == 0 || depth > MAX_IO_DEPTH)) {
+            throw runtime_error("Unsupported I/O depth.");
+        }
+        ioEngine = engine;
+        ioDepth = depth;
+        tree->setReadAhead(engine, depth);
+    }
+
+    // Read-ahead engine in use: "uring", "threads" (also when io_uring is unavailable) or "off"
+    const char *readAheadEngine() const {
+        return tree->readAheadEngine();
+    }
+
+    // Keep a Bloom filter of the keys for files created or opened from now on, so lookups,
+    // updates and deletes of missing keys mostly skip the tree. rate is the target
+    // false-positive rate (0 turns the filter off) and maxBytes caps its memory (0 for no
+    // cap; a capped filter has a higher rate). The filter is saved to <index>.bloom on
+    // close and rebuilt from the tree on open when that file is missing or stale.
+    void setBloomFilter(double rate, size_t maxBytes = 0) {
+        if (!(rate >= 0 && rate < 1)) {
+            throw runtime_error("Unsupported Bloom filter false-positive rate.");
+        }
+        bloomRate = rate;
+        bloomMaxBytes = maxBytes;
+        tree->setBloomFilter(rate, maxBytes);
+    }
+
+    // Close the currently open file
+    void closeFile() {
+        tree->closeFile();
+    }
+};
@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// linux/fs.h, pulled in by io_uring.h, defines BLOCK_SIZE, which the B-Tree uses as a name
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+
+using namespace std;
+
+// Reads the buffer pool may have in flight for read-ahead unless chosen otherwise
+static const size_t DEFAULT_IO_DEPTH = 32;
+// Most reads in flight, and threads of the thread-pool engine
+static const size_t MAX_IO_DEPTH = 1024;
+
+// How read-ahead reads are issued
+enum class IoEngine {
+    Off,         // No read-ahead; every block is read when it is pinned
+    Uring,       // io_uring, falling back to Threads where the kernel does not allow it
+    Threads      // Blocking reads on a pool of threads
+};
+
+// Called when a read finishes with the tag it was submitted with; ok is false if it failed,
+// in which case the buffer contents are undefined
+typedef function<void(uint64_t tag, bool ok)> ReadDone;
+
+// One block read: len bytes of storage at offset into buffer
+struct ReadRequest {
+    Storage *storage;
+    uint64_t offset;
+    uint8_t *buffer;
+    size_t len;
+    uint64_t tag;
+};
+
+// Issues block reads without waiting for them. done is called once per read when it has
+// finished, from whichever thread notices: the reader's own threads, or a thread inside
+// submit or poll. done must not call back into the reader. At most depth() reads are in
+// flight; callers keep below that. Destroying the reader waits for the reads in flight.
+class AsyncReader {
+public:
+    virtual ~AsyncReader() {}
+    // Start a batch of reads
+    virtual void submit(const ReadRequest *requests, size_t count) = 0;
+    // Wait until at least one read in flight has finished and been reported (returns at
+    // once if none is in flight)
+    virtual void poll() = 0;
+    virtual size_t depth() const = 0;
+    virtual const char *name() const = 0;
+};
+
+// Run one read with the storage's own (blocking) read, reporting failure instead of throwing
+static bool readNow(const ReadRequest &request) {
+    try {
+        request.storage->read(request.offset, request.buffer, request.len);
+        return true;
+    } catch (runtime_error &) {
+        return false;
+    }
+}
+
+// Reads on a fixed pool of threads, each blocking in the storage's read. Works with every
+// storage backend; depth threads give a queue depth of depth.
+class ThreadPoolReader : public AsyncReader {
+private:
+    ReadDone done;
+    size_t maxInFlight;
+    deque<ReadRequest> queue;
+    size_t inFlight;           // Queued plus running requests
+    uint64_t finished;         // Requests reported so far
+    bool stopping;
+    mutex lock;
+    condition_variable work;   // Signalled when a request is queued or on shutdown
+    condition_variable idle;   // Signalled when a request finishes
+    vector<thread> workers;
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            work.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            ReadRequest request = queue.front();
+            queue.pop_front();
+            guard.unlock();
+            done(request.tag, readNow(request));
+            guard.lock();
+            inFlight--;
+            finished++;
+            idle.notify_all();
+        }
+    }
+
+public:
+    ThreadPoolReader(size_t depth, ReadDone onDone) : done(onDone) {
+        maxInFlight = max<size_t>(1, min(depth, MAX_IO_DEPTH));
+        inFlight = 0;
+        finished = 0;
+        stopping = false;
+        for (size_t i = 0; i < maxInFlight; i++) {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadPoolReader() {
+        {
+            unique_lock<mutex> guard(lock);
+            idle.wait(guard, [this] { return inFlight == 0; });
+            stopping = true;
+        }
+        work.notify_all();
+        for (auto &w : workers) w.join();
+    }
+
+    void submit(const ReadRequest *requests, size_t count) override {
+        lock_guard<mutex> guard(lock);
+        queue.insert(queue.end(), requests, requests + count);
+        inFlight += count;
+        if (count == 1) work.notify_one();
+        else work.notify_all();
+    }
+
+    void poll() override {
+        unique_lock<mutex> guard(lock);
+        uint64_t seen = finished;
+        idle.wait(guard, [&] { return finished != seen || inFlight == 0; });
+    }
+
+    size_t depth() const override {
+        return maxInFlight;
+    }
+
+    const char *name() const override {
+        return "threads";
+    }
+};
+
+// Reads through an io_uring instance set up with raw system calls. A batch of reads is
+// queued and handed to the kernel with one system call. There is no completion thread:
+// completions are reaped right after submitting (reads of cached data usually finish
+// during the submit call) and by poll, so a read that finishes quickly costs no thread
+// switch. Reads the storage cannot map to a file descriptor (such as pages still in the
+// write-ahead log) are done synchronously by submit, and a read the kernel rejects is
+// retried with the storage's read when it is reaped.
+class UringReader : public AsyncReader {
+private:
+    ReadDone done;
+    int ringFd;
+    size_t maxInFlight;
+    uint8_t *sqRing;
+    uint8_t *cqRing;
+    size_t sqRingBytes, cqRingBytes;
+    io_uring_sqe *sqes;
+    size_t sqesBytes;
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+
+    vector<ReadRequest> slots;   // Requests in flight, indexed by user_data
+    vector<size_t> freeSlots;
+    mutex submitLock;            // Protects the submission queue and the slots
+    mutex reapLock;              // Held while consuming the completion queue
+
+    static int setup(unsigned entries, io_uring_params *params) {
+        return (int)syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    size_t inFlight() {
+        lock_guard<mutex> guard(submitLock);
+        return maxInFlight - freeSlots.size();
+    }
+
+    // Queue a read of a request in a slot (called with submitLock held)
+    void queueRead(size_t slot, int fd, uint64_t fileOffset) {
+        const ReadRequest &request = slots[slot];
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)request.buffer;
+        sqe->len = (uint32_t)request.len;
+        sqe->off = fileOffset;
+        sqe->user_data = slot;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Report every completion in the queue (called with reapLock held)
+    void reapReady() {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe &cqe = cqes[head & *cqMask];
+            size_t slot = (size_t)cqe.user_data;
+            int result = cqe.res;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            complete(slot, result);
+        }
+    }
+
+    // Finish the request in a slot given the number of bytes read or a negative errno
+    void complete(size_t slot, int result) {
+        ReadRequest request = slots[slot];
+        bool ok = true;
+        if (result < 0) {
+            ok = readNow(request);
+        } else if ((size_t)result < request.len) {
+            // A short read is not necessarily end of file: read the rest with the storage's
+            // own read, which reads past end of file as zeros
+            ReadRequest rest = request;
+            rest.offset += (size_t)result;
+            rest.buffer += result;
+            rest.len -= (size_t)result;
+            ok = readNow(rest);
+        }
+        {
+            lock_guard<mutex> guard(submitLock);
+            freeSlots.push_back(slot);
+        }
+        done(request.tag, ok);
+    }
+
+    void unmapRings() {
+        if (sqes != nullptr) munmap(sqes, sqesBytes);
+        if (cqRing != nullptr && cqRing != sqRing) munmap(cqRing, cqRingBytes);
+        if (sqRing != nullptr) munmap(sqRing, sqRingBytes);
+        if (ringFd >= 0) ::close(ringFd);
+    }
+
+    UringReader(ReadDone onDone) : done(onDone) {
+        ringFd = -1;
+        sqRing = cqRing = nullptr;
+        sqes = nullptr;
+    }
+
+    // Set up and map the rings; false if the kernel refuses
+    bool start(size_t depth) {
+        maxInFlight = max<size_t>(1, min(depth, MAX_IO_DEPTH));
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = setup((unsigned)maxInFlight, &params);
+        if (ringFd < 0) return false;
+
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) sqRingBytes = cqRingBytes = max(sqRingBytes, cqRingBytes);
+        void *sq = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ringFd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) return false;
+        sqRing = (uint8_t*)sq;
+        if (singleMap) {
+            cqRing = sqRing;
+        } else {
+            void *cq = mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ringFd, IORING_OFF_CQ_RING);
+            if (cq == MAP_FAILED) return false;
+            cqRing = (uint8_t*)cq;
+        }
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void *entries = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ringFd, IORING_OFF_SQES);
+        if (entries == MAP_FAILED) return false;
+        sqes = (io_uring_sqe*)entries;
+
+        sqTail = (unsigned*)(sqRing + params.sq_off.tail);
+        sqMask = (unsigned*)(sqRing + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sqRing + params.sq_off.array);
+        cqHead = (unsigned*)(cqRing + params.cq_off.head);
+        cqTail = (unsigned*)(cqRing + params.cq_off.tail);
+        cqMask = (unsigned*)(cqRing + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cqRing + params.cq_off.cqes);
+
+        slots.resize(maxInFlight);
+        for (size_t i = maxInFlight; i > 0; i--) freeSlots.push_back(i - 1);
+        return true;
+    }
+
+public:
+    // An io_uring reader, or nullptr if io_uring cannot be set up here
+    static unique_ptr<AsyncReader> create(size_t depth, ReadDone onDone) {
+        unique_ptr<UringReader> reader(new UringReader(onDone));
+        if (!reader->start(depth)) return nullptr;
+        return unique_ptr<AsyncReader>(reader.release());
+    }
+
+    ~UringReader() {
+        if (!slots.empty()) {
+            while (inFlight() > 0) poll();
+        }
+        unmapRings();
+    }
+
+    void submit(const ReadRequest *requests, size_t count) override {
+        for (size_t i = 0; i < count; ) {
+            unsigned queued = 0;
+            {
+                lock_guard<mutex> guard(submitLock);
+                for (; i < count && !freeSlots.empty(); i++) {
+                    int fd;
+                    uint64_t fileOffset;
+                    if (!requests[i].storage->descriptorFor(requests[i].offset, requests[i].len, fd, fileOffset)) {
+                        break;
+                    }
+                    size_t slot = freeSlots.back();
+                    freeSlots.pop_back();
+                    slots[slot] = requests[i];
+                    queueRead(slot, fd, fileOffset);
+                    queued++;
+                }
+                while (queued > 0) {
+                    int n = enter(queued, 0, 0);
+                    if (n > 0) {
+                        queued -= (unsigned)n;
+                    } else if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        throw runtime_error("Unable to submit to io_uring.");
+                    }
+                }
+            }
+            if (i < count && inFlight() < maxInFlight) {
+                // Not readable through a descriptor: read it here
+                done(requests[i].tag, readNow(requests[i]));
+                i++;
+            } else if (i < count) {
+                poll();
+            }
+        }
+        if (reapLock.try_lock()) {
+            reapReady();
+            reapLock.unlock();
+        }
+    }
+
+    void poll() override {
+        lock_guard<mutex> guard(reapLock);
+        if (inFlight() == 0) return;
+        if (*cqHead == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            while (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {}
+        }
+        reapReady();
+    }
+
+    size_t depth() const override {
+        return maxInFlight;
+    }
+
+    const char *name() const override {
+        return "uring";
+    }
+};
+
+// Create the reader for an engine, or nullptr for IoEngine::Off. io_uring falls back to
+// the thread pool when the kernel does not allow it (too old, or blocked by seccomp).
+static unique_ptr<AsyncReader> makeAsyncReader(IoEngine engine, size_t depth, ReadDone onDone) {
+    if (engine == IoEngine::Off || depth == 0) return nullptr;
+    if (engine == IoEngine::Uring) {
+        unique_ptr<AsyncReader> reader = UringReader::create(depth, onDone);
+        if (reader) return reader;
+    }
+    return unique_ptr<AsyncReader>(new ThreadPoolReader(depth, onDone));
+}
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Key distributions of the synthetic datasets
+enum class KeyDistribution {
+    Sequential,   // 1, 2, 3, ... inserted in ascending order
+    Random,       // Uniformly scattered unique keys in random order
+    Zipfian,      // The random key set, read with a Zipfian (theta 0.99) skew on hot keys
+    Clustered     // Runs of 1000 consecutive keys at scattered bases, runs in random order
+};
+
+static const char *distributionName(KeyDistribution d) {
+    switch (d) {
+        case KeyDistribution::Sequential: return "sequential";
+        case KeyDistribution::Random: return "random";
+        case KeyDistribution::Zipfian: return "zipfian";
+        case KeyDistribution::Clustered: return "clustered";
+    }
+    return "unknown";
+}
+
+// Keys per run of a clustered dataset
+static const uint64_t CLUSTER_KEYS = 1000;
+
+// Bijective 64-bit mix (the splitmix64 finalizer): distinct inputs give distinct keys
+inline uint64_t mixKey(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Bijective mix of the low 48 bits, used for cluster bases so a run never overlaps another
+inline uint64_t mixKey48(uint64_t x) {
+    const uint64_t mask = (1ULL << 48) - 1;
+    x = (x * 0x9E3779B97F4BULL) & mask;
+    x ^= x >> 24;
+    x = (x * 0xC2B2AE3D27D5ULL) & mask;
+    x ^= x >> 24;
+    return x;
+}
+
+// Zipfian ranks in [0, n) following Gray et al., "Quickly generating billion-record
+// synthetic databases" (the YCSB generator); rank 0 is the most popular
+class ZipfianGenerator {
+private:
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+
+public:
+    ZipfianGenerator(uint64_t n, double theta = 0.99) : n(n), theta(theta) {
+        zetan = 0;
+        for (uint64_t i = 1; i <= n; i++) zetan += 1.0 / pow((double)i, theta);
+        double zeta2 = 1.0 + pow(0.5, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    uint64_t next(mt19937_64 &rng) {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta)) return 1;
+        uint64_t rank = (uint64_t)((double)n * pow(eta * u - eta + 1.0, alpha));
+        return rank < n ? rank : n - 1;
+    }
+};
+
+// A synthetic dataset of rows unique keys. Keys are computed from their position in
+// insertion order rather than stored, so datasets of 10^8 rows need no key array.
+class SyntheticDataset {
+private:
+    KeyDistribution distribution;
+    uint64_t rows;
+    vector<uint64_t> clusterOrder;        // Clustered: run inserted at each position
+    unique_ptr<ZipfianGenerator> zipf;    // Zipfian: popularity of the keys
+
+public:
+    SyntheticDataset(KeyDistribution distribution, uint64_t rows) : distribution(distribution), rows(rows) {
+        if (distribution == KeyDistribution::Clustered) {
+            clusterOrder.resize((rows + CLUSTER_KEYS - 1) / CLUSTER_KEYS);
+            for (uint64_t c = 0; c < clusterOrder.size(); c++) clusterOrder[c] = c;
+            shuffle(clusterOrder.begin(), clusterOrder.end(), mt19937_64(rows));
+        } else if (distribution == KeyDistribution::Zipfian) {
+            zipf.reset(new ZipfianGenerator(rows));
+        }
+    }
+
+    uint64_t size() const {
+        return rows;
+    }
+
+    // Key inserted i-th
+    uint64_t key(uint64_t i) const {
+        switch (distribution) {
+            case KeyDistribution::Sequential:
+                return i + 1;
+            case KeyDistribution::Clustered: {
+                uint64_t run = clusterOrder[i / CLUSTER_KEYS];
+                return (mixKey48(run) << 16) + i % CLUSTER_KEYS + 1;
+            }
+            default:
+                return mixKey(i + 1);
+        }
+    }
+
+    // A key that is not in the dataset but lies among its keys: past the end of a sequential
+    // dataset, scattered like the keys of a random one, or behind the keys of a cluster.
+    // Different i below the dataset size give different keys.
+    uint64_t missingKey(uint64_t i) const {
+        switch (distribution) {
+            case KeyDistribution::Sequential:
+                return rows + i + 1;
+            case KeyDistribution::Clustered: {
+                uint64_t run = clusterOrder[(i / CLUSTER_KEYS) % clusterOrder.size()];
+                return (mixKey48(run) << 16) + CLUSTER_KEYS + i % CLUSTER_KEYS + 1;
+            }
+            default:
+                return mixKey(rows + i + 1);
+        }
+    }
+
+    // Position of the key an operation accesses: uniform, or skewed for Zipfian datasets
+    // (popular ranks are scattered over the key space)
+    uint64_t pick(mt19937_64 &rng) const {
+        if (zipf) {
+            return mixKey(zipf->next(rng)) % rows;
+        }
+        return rng() % rows;
+    }
+};
+
+// Value stored for a key by the suite, so reads can be checked
+inline uint64_t suiteValue(uint64_t key) {
+    return key ^ 0x5DEECE66DULL;
+}
+
+struct SuiteOptions {
+    vector<KeyDistribution> datasets;
+    vector<uint64_t> rowCounts;
+    vector<string> workloads;
+    uint64_t lookups;        // Point lookups per dataset
+    uint64_t scans;          // Range scans per dataset
+    uint64_t scanLength;     // Entries read by each range scan
+    unsigned threads;        // Formatting threads of extract
+};
+
+// One workload's measurements, written as one line of JSON
+struct WorkloadResult {
+    string dataset;
+    uint64_t rows;
+    string workload;
+    uint64_t ops;
+    double seconds;
+    const LatencyHistogram *latency;   // nullptr when the workload is a single operation
+    uint64_t blockReads, blockWrites;
+    uint64_t fileBytes;                // Index file size after the workload, 0 if unchanged
+    uint64_t errors;
+
+    string json() const {
+        ostringstream out;
+        out.precision(6);
+        out << "{\"dataset\": \"" << dataset << "\", \"rows\": " << rows
+            << ", \"workload\": \"" << workload << "\", \"ops\": " << ops
+            << ", \"seconds\": " << fixed << seconds
+            << ", \"ops_per_sec\": " << (seconds > 0 ? (double)ops / seconds : 0.0);
+        out.unsetf(ios::floatfield);
+        if (latency != nullptr) {
+            out << ", \"latency_ns\": {\"p50\": " << latency->percentile(0.50)
+                << ", \"p99\": " << latency->percentile(0.99)
+                << ", \"p999\": " << latency->percentile(0.999)
+                << ", \"max\": " << latency->max() << "}";
+        } else {
+            out << ", \"latency_ns\": null";
+        }
+        double perOp = ops > 0 ? 1.0 / (double)ops : 0.0;
+        out << ", \"block_reads_per_op\": " << (double)blockReads * perOp
+            << ", \"block_writes_per_op\": " << (double)blockWrites * perOp
+            << ", \"file_bytes\": " << fileBytes
+            << ", \"errors\": " << errors << "}";
+        return out.str();
+    }
+};
+
+// Runs every selected workload on every dataset against real index files and prints
+// one JSON document with a result per (dataset, rows, workload).
+//
+// insert builds the index one key at a time and commits; lookup, miss, range and extract then
+// run on that index, each after reopening it so they start with an empty buffer pool.
+// load and bulkload build fresh indexes from a CSV file of the dataset in insertion
+// order. Without insert, the read workloads run on an untimed bulk-built index.
+class BenchmarkSuite {
+private:
+    BTree &tree;
+    SuiteOptions options;
+    string indexName, csvName, extractName;
+    vector<string> results;
+    uint64_t failures;       // Failed checks over all workloads
+
+    bool selected(const string &workload) const {
+        return find(options.workloads.begin(), options.workloads.end(), workload) != options.workloads.end();
+    }
+
+    uint64_t fileSize() const {
+        struct stat st;
+        return stat(indexName.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+    }
+
+    // Time one workload and record its result; body returns the number of failed checks
+    template <typename Body>
+    void measure(const SyntheticDataset &data, KeyDistribution d, const string &workload, uint64_t ops,
+                 const LatencyHistogram *latency, bool rebuildsFile, Body body) {
+        uint64_t reads = tree.blocksRead(), writes = tree.blocksWritten();
+        auto start = chrono::steady_clock::now();
+        uint64_t errors = body();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        WorkloadResult r{distributionName(d), data.size(), workload, ops, seconds, latency,
+                         tree.blocksRead() - reads, tree.blocksWritten() - writes, 0, errors};
+        tree.closeFile();
+        if (rebuildsFile) r.fileBytes = fileSize();
+        failures += errors;
+        results.push_back(r.json());
+        cerr << r.dataset << " rows=" << r.rows << " " << workload << " seconds=" << seconds << "\n";
+    }
+
+    // Write the dataset as a load file, in insertion order
+    void writeCsv(const SyntheticDataset &data) {
+        int fd = ::open(csvName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw runtime_error("Unable to create benchmark load file.");
+        }
+        vector<char> chunk(EXPORT_CHUNK_BYTES + EXPORT_LINE_BYTES);
+        size_t used = 0;
+        bool failed = false;
+        for (uint64_t i = 0; i < data.size() && !failed; i++) {
+            uint64_t key = data.key(i);
+            used += formatEntry(chunk.data() + used, key, suiteValue(key), ',');
+            if (used >= EXPORT_CHUNK_BYTES || i + 1 == data.size()) {
+                failed = ::write(fd, chunk.data(), used) != (ssize_t)used;
+                used = 0;
+            }
+        }
+        ::close(fd);
+        if (failed) {
+            throw runtime_error("Unable to write benchmark load file.");
+        }
+    }
+
+    void runDataset(KeyDistribution d, uint64_t rows) {
+        SyntheticDataset data(d, rows);
+        bool needCsv = selected("load") || selected("bulkload") || !selected("insert");
+        if (needCsv) writeCsv(data);
+
+        if (selected("insert")) {
+            LatencyHistogram latency;
+            tree.createIndex(indexName);
+            measure(data, d, "insert", rows, &latency, true, [&]() {
+                uint64_t errors = 0;
+                for (uint64_t i = 0; i < rows; i++) {
+                    uint64_t key = data.key(i);
+                    auto t0 = chrono::steady_clock::now();
+                    bool inserted = tree.insert(key, suiteValue(key));
+                    auto t1 = chrono::steady_clock::now();
+                    latency.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+                    if (!inserted) errors++;
+                }
+                tree.sync();
+                return errors;
+            });
+        } else {
+            tree.createIndex(indexName);
+            tree.bulkLoad(csvName);
+            tree.closeFile();
+        }
+
+        if (selected("lookup")) {
+            LatencyHistogram latency;
+            tree.openIndex(indexName);
+            measure(data, d, "lookup", options.lookups, &latency, false, [&]() {
+                mt19937_64 rng(rows + 1);
+                uint64_t errors = 0;
+                for (uint64_t n = 0; n < options.lookups; n++) {
+                    uint64_t key = data.key(data.pick(rng));
+                    uint64_t value;
+                    auto t0 = chrono::steady_clock::now();
+                    bool found = tree.search(key, value);
+                    auto t1 = chrono::steady_clock::now();
+                    latency.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+                    if (!found || value != suiteValue(key)) errors++;
+                }
+                return errors;
+            });
+        }
+
+        if (selected("miss")) {
+            LatencyHistogram latency;
+            tree.openIndex(indexName);
+            measure(data, d, "miss", options.lookups, &latency, false, [&]() {
+                mt19937_64 rng(rows + 3);
+                uint64_t errors = 0;
+                for (uint64_t n = 0; n < options.lookups; n++) {
+                    uint64_t key = data.missingKey(data.pick(rng));
+                    uint64_t value;
+                    auto t0 = chrono::steady_clock::now();
+                    bool found = tree.search(key, value);
+                    auto t1 = chrono::steady_clock::now();
+                    latency.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+                    if (found) errors++;
+                }
+                return errors;
+            });
+        }
+
+        if (selected("range")) {
+            LatencyHistogram latency;
+            tree.openIndex(indexName);
+            measure(data, d, "range", options.scans, &latency, false, [&]() {
+                mt19937_64 rng(rows + 2);
+                uint64_t errors = 0;
+                for (uint64_t n = 0; n < options.scans; n++) {
+                    uint64_t low = data.key(data.pick(rng));
+                    auto t0 = chrono::steady_clock::now();
+                    BTree::Cursor cursor = tree.cursor();
+                    uint64_t seen = 0, previous = 0;
+                    bool ok = cursor.seek(low) && cursor.key() == low;
+                    for (bool more = ok; more && seen < options.scanLength; more = cursor.next()) {
+                        if ((seen > 0 && cursor.key() <= previous) || cursor.value() != suiteValue(cursor.key())) {
+                            ok = false;
+                        }
+                        previous = cursor.key();
+                        seen++;
+                    }
+                    auto t1 = chrono::steady_clock::now();
+                    latency.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count());
+                    if (!ok) errors++;
+                }
+                return errors;
+            });
+        }
+
+        if (selected("extract")) {
+            tree.openIndex(indexName);
+            int fd = ::open(extractName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw runtime_error("Unable to create benchmark extract file.");
+            }
+            try {
+                measure(data, d, "extract", rows, nullptr, false, [&]() {
+                    tree.exportEntries(fd, ',', options.threads);
+                    return (uint64_t)0;
+                });
+            } catch (runtime_error &) {
+                ::close(fd);
+                throw;
+            }
+            ::close(fd);
+            remove(extractName.c_str());
+        }
+
+        if (selected("load")) {
+            tree.createIndex(indexName);
+            measure(data, d, "load", rows, nullptr, true, [&]() {
+                tree.load(csvName);
+                tree.sync();
+                return (uint64_t)0;
+            });
+        }
+
+        if (selected("bulkload")) {
+            tree.createIndex(indexName);
+            measure(data, d, "bulkload", rows, nullptr, true, [&]() {
+                tree.bulkLoad(csvName);
+                return (uint64_t)0;
+            });
+        }
+
+        if (needCsv) remove(csvName.c_str());
+        remove(indexName.c_str());
+        remove((indexName + ".bloom").c_str());
+    }
+
+public:
+    BenchmarkSuite(BTree &tree, const SuiteOptions &options, const string &fileName)
+        : tree(tree), options(options), indexName(fileName), csvName(fileName + ".load.csv"),
+          extractName(fileName + ".extract.csv"), failures(0) {}
+
+    // Run everything and write the JSON document to out; returns false if any check failed
+    bool run(ostream &out, const string &config) {
+        results.clear();
+        failures = 0;
+        for (KeyDistribution d : options.datasets) {
+            for (uint64_t rows : options.rowCounts) {
+                runDataset(d, rows);
+            }
+        }
+        out << "{\"config\": " << config << ",\n \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            out << "  " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+        return failures == 0;
+    }
+};
@@ -0,0 +1,549 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <atomic>
+
+// Include the helper and B-tree code
+#include "writeIndex.cpp"
+#include "keySearch.cpp"
+#include "blockChecksum.cpp"
+#include "storage.cpp"
+#include "writeAheadLog.cpp"
+#include "asyncReader.cpp"
+#include "bufferPool.cpp"
+#include "latchTable.cpp"
+#include "externalSort.cpp"
+#include "csvExport.cpp"
+#include "csvParser.cpp"
+#include "binaryRecords.cpp"
+#include "latencyHistogram.cpp"
+#include "indexStats.cpp"
+#include "bloomFilter.cpp"
+#include "Btree.cpp"
+#include "benchSuite.cpp"
+
+using namespace std;
+
+// Value stored for a key, so lookups can be checked without a reference map
+static uint64_t valueFor(uint64_t key) {
+    return key * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Many threads insert disjoint keys plus a set of keys every thread races for, while
+// searching keys they inserted earlier. Afterwards every key must be found with its
+// value and each raced key must have been inserted exactly once.
+static bool stressWorkload(BTree &tree, uint64_t numKeys, unsigned threads) {
+    vector<uint64_t> keys(numKeys);
+    for (uint64_t i = 0; i < numKeys; i++) keys[i] = i * 7 + 3;
+    shuffle(keys.begin(), keys.end(), mt19937_64(42));
+    vector<uint64_t> contended;
+    for (uint64_t i = 0; i < numKeys / 10 + 1; i++) contended.push_back(i * 7 + 5);
+
+    atomic<uint64_t> contendedWins(0);
+    atomic<bool> failed(false);
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            mt19937_64 rng(t + 1);
+            size_t nextContended = t % contended.size();
+            for (uint64_t i = t; i < numKeys; i += threads) {
+                if (!tree.insert(keys[i], valueFor(keys[i]))) {
+                    failed = true;
+                }
+                if (tree.insert(contended[nextContended], valueFor(contended[nextContended]))) {
+                    contendedWins++;
+                }
+                nextContended = (nextContended + 1) % contended.size();
+
+                // Look up one of this thread's earlier keys
+                uint64_t earlier = t + (rng() % (i / threads + 1)) * threads;
+                uint64_t value;
+                if (!tree.search(keys[earlier], value) || value != valueFor(keys[earlier])) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+    double elapsed = secondsSince(start);
+
+    for (uint64_t i = 0; i < numKeys; i++) {
+        uint64_t value;
+        if (!tree.search(keys[i], value) || value != valueFor(keys[i])) failed = true;
+    }
+    uint64_t present = 0;
+    for (uint64_t key : contended) {
+        uint64_t value;
+        if (tree.search(key, value)) {
+            present++;
+            if (value != valueFor(key)) failed = true;
+        }
+    }
+    if (present != contendedWins) failed = true;
+
+    cout << "stress threads=" << threads << " keys=" << numKeys
+         << " seconds=" << elapsed << " result=" << (failed ? "FAILED" : "ok") << "\n";
+    return !failed;
+}
+
+// Per-node CPU cost of checksumming and decoding blocks and searching keys, comparing the
+// kernels picked at startup with the scalar versions. Works on in-memory images of full
+// plain-format nodes (blockId, reserved, numKeys, keys, values, children) only.
+template <typename Layout>
+static void nodeMicrobench(uint64_t rounds) {
+    const size_t BLOCK_SIZE = Layout::BLOCK_SIZE;
+    const int MAX_KEYS = Layout::MAX_KEYS;
+    const size_t NODE_WORDS = Layout::NODE_WORDS;
+    const size_t nodes = 1024;
+    mt19937_64 rng(7);
+    vector<uint8_t> blocks(nodes * BLOCK_SIZE);
+    vector<uint64_t> decoded(nodes * NODE_WORDS);
+    for (size_t n = 0; n < nodes; n++) {
+        uint64_t *words = &decoded[n * NODE_WORDS];
+        words[0] = n + 1;
+        words[2] = MAX_KEYS;
+        uint64_t key = rng() % 1000;
+        for (int i = 0; i < MAX_KEYS; i++) {
+            key += 1 + rng() % 1000;
+            words[3 + i] = key;
+            words[3 + MAX_KEYS + i] = valueFor(key);
+        }
+        hostToBigArray(words, &blocks[n * BLOCK_SIZE], NODE_WORDS);
+    }
+    auto keysOf = [&](size_t n) { return &decoded[n * NODE_WORDS + 3]; };
+    vector<uint64_t> probes(nodes);
+    for (size_t n = 0; n < nodes; n++) {
+        probes[n] = keysOf(n)[rng() % MAX_KEYS] + rng() % 2;
+    }
+
+    uint64_t checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nodes; n++) {
+            const uint8_t *buffer = &blocks[n * BLOCK_SIZE];
+            uint64_t *words = &decoded[n * NODE_WORDS];
+            for (size_t i = 0; i < NODE_WORDS; i++) {
+                uint64_t be;
+                memcpy(&be, buffer + i * 8, 8);
+                words[i] = bigToHost(be);
+            }
+            checksum += keysOf(n)[r % MAX_KEYS];
+        }
+    }
+    double scalarDecode = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nodes; n++) {
+            bigToHostArray(&blocks[n * BLOCK_SIZE], &decoded[n * NODE_WORDS], NODE_WORDS);
+            checksum += keysOf(n)[r % MAX_KEYS];
+        }
+    }
+    double kernelDecode = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nodes; n++) {
+            checksum += crc32cScalar(0, &blocks[n * BLOCK_SIZE], BLOCK_SIZE);
+        }
+    }
+    double scalarCrc = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nodes; n++) {
+            checksum += crc32c(0, &blocks[n * BLOCK_SIZE], BLOCK_SIZE);
+        }
+    }
+    double kernelCrc = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nodes; n++) {
+            checksum += lowerBoundScalar(keysOf(n), MAX_KEYS, probes[(n + r) % nodes]);
+        }
+    }
+    double scalarSearch = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (uint64_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nodes; n++) {
+            checksum += lowerBound(keysOf(n), MAX_KEYS, probes[(n + r) % nodes]);
+        }
+    }
+    double kernelSearch = secondsSince(start);
+
+    double perNode = 1e9 / (double)(rounds * nodes);
+    cout << "block_checksum page_size=" << BLOCK_SIZE << " kernel=" << crc32cKernel()
+         << " ns_per_node=" << kernelCrc * perNode
+         << " scalar_ns_per_node=" << scalarCrc * perNode << "\n";
+    cout << "node_decode page_size=" << BLOCK_SIZE << " kernel=" << reverseWordsKernel()
+         << " ns_per_node=" << kernelDecode * perNode
+         << " scalar_ns_per_node=" << scalarDecode * perNode << "\n";
+    cout << "node_search page_size=" << BLOCK_SIZE << " kernel=" << lowerBoundKernel()
+         << " ns_per_node=" << kernelSearch * perNode
+         << " scalar_ns_per_node=" << scalarSearch * perNode
+         << " checksum=" << (checksum & 0xFFFF) << "\n";
+}
+
+// Export every entry as CSV with the given number of formatting threads
+static void extractThroughput(BTree &tree, const string &outName, unsigned threads) {
+    int fd = open(outName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw runtime_error("Unable to open extract output file.");
+    }
+    auto start = chrono::steady_clock::now();
+    try {
+        tree.exportEntries(fd, ',', threads);
+    } catch (runtime_error &) {
+        close(fd);
+        throw;
+    }
+    double elapsed = secondsSince(start);
+    off_t bytes = lseek(fd, 0, SEEK_CUR);
+    close(fd);
+    remove(outName.c_str());
+    cout << "extract threads=" << threads << " bytes=" << bytes << " seconds=" << elapsed
+         << " mb_per_sec=" << bytes / elapsed / 1e6 << "\n";
+}
+
+// Check the whole file with the given number of scan threads; fails if verify finds a problem
+static bool verifyThroughput(BTree &tree, unsigned threads) {
+    VerifyReport report = tree.verify(threads);
+    cout << "verify threads=" << threads << " bytes=" << report.bytes << " seconds=" << report.seconds
+         << " mb_per_sec=" << report.bytes / report.seconds / 1e6
+         << " checksum_errors=" << report.checksumErrors
+         << " structure_errors=" << report.structureErrors << "\n";
+    return report.ok();
+}
+
+// Many threads erase half of the keys stressWorkload inserted while looking up keys of
+// the other half, which must stay visible throughout. Afterwards exactly the erased keys
+// must be gone.
+static bool eraseWorkload(BTree &tree, uint64_t numKeys, unsigned threads) {
+    atomic<bool> failed(false);
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            mt19937_64 rng(500 + t);
+            for (uint64_t i = 2 * t; i < numKeys; i += 2 * threads) {
+                if (!tree.erase(i * 7 + 3) || tree.erase(i * 7 + 3)) {
+                    failed = true;
+                }
+                uint64_t kept = (rng() % (numKeys / 2)) * 2 + 1;
+                uint64_t value;
+                if (kept < numKeys && (!tree.search(kept * 7 + 3, value) || value != valueFor(kept * 7 + 3))) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto &w : workers) w.join();
+    double elapsed = secondsSince(start);
+
+    for (uint64_t i = 0; i < numKeys; i++) {
+        uint64_t value;
+        if (tree.search(i * 7 + 3, value) != (i % 2 == 1)) failed = true;
+    }
+
+    cout << "erase threads=" << threads << " keys=" << (numKeys + 1) / 2
+         << " seconds=" << elapsed << " result=" << (failed ? "FAILED" : "ok") << "\n";
+    return !failed;
+}
+
+// Scan a snapshot twice; both scans must see the same ascending entries with the right
+// values, including every key eraseWorkload kept. Returns the number of stressWorkload's
+// own keys (the raced keys are left out).
+static uint64_t scanSnapshot(BTree::Snapshot &snapshot, uint64_t numKeys, atomic<bool> &failed) {
+    uint64_t counts[2] = {0, 0}, sums[2] = {0, 0};
+    for (int pass = 0; pass < 2; pass++) {
+        BTree::Cursor cursor = snapshot.cursor();
+        uint64_t previous = 0, kept = 0;
+        bool any = false;
+        for (bool more = cursor.first(); more; more = cursor.next()) {
+            uint64_t key = cursor.key();
+            if ((any && key <= previous) || cursor.value() != valueFor(key)) failed = true;
+            previous = key;
+            any = true;
+            sums[pass] += key;
+            if (key % 7 != 3) continue;
+            counts[pass]++;
+            if ((key / 7) % 2 == 1) kept++;
+        }
+        if (kept != numKeys / 2) failed = true;
+    }
+    if (counts[0] != counts[1] || sums[0] != sums[1]) failed = true;
+    return counts[0];
+}
+
+// In copy-on-write mode, writer threads insert the keys eraseWorkload erased again while
+// this thread keeps opening snapshots and scanning them. No snapshot may change while it
+// is scanned, and each must hold at least as many keys as the one before.
+static bool snapshotWorkload(BTree &tree, uint64_t numKeys, unsigned threads) {
+    atomic<bool> failed(false);
+    atomic<unsigned> running(max(1u, threads - 1));
+    unsigned writers = running;
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < writers; t++) {
+        workers.emplace_back([&, t]() {
+            for (uint64_t i = 2 * t; i < numKeys; i += 2 * writers) {
+                if (!tree.insert(i * 7 + 3, valueFor(i * 7 + 3))) failed = true;
+            }
+            running--;
+        });
+    }
+    uint64_t scans = 0, lastCount = 0;
+    while (running > 0) {
+        BTree::Snapshot snapshot = tree.snapshot();
+        uint64_t count = scanSnapshot(snapshot, numKeys, failed);
+        if (count < lastCount) failed = true;
+        lastCount = count;
+        scans++;
+    }
+    for (auto &w : workers) w.join();
+    double elapsed = secondsSince(start);
+
+    BTree::Snapshot after = tree.snapshot();
+    if (scanSnapshot(after, numKeys, failed) != numKeys) failed = true;
+
+    cout << "snapshot writers=" << writers << " keys=" << (numKeys + 1) / 2 << " scans=" << scans
+         << " seconds=" << elapsed << " result=" << (failed ? "FAILED" : "ok") << "\n";
+    return !failed;
+}
+
+// Random point lookups of existing keys with 1, 2, 4, ... threads
+static void lookupScaling(BTree &tree, uint64_t numKeys, unsigned maxThreads, uint64_t lookups) {
+    for (unsigned threads = 1; ; threads = min(threads * 2, maxThreads)) {
+        vector<thread> workers;
+        atomic<uint64_t> misses(0);
+        auto start = chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                mt19937_64 rng(1000 + t);
+                for (uint64_t n = 0; n < lookups / threads; n++) {
+                    uint64_t key = (rng() % numKeys) * 7 + 3;
+                    uint64_t value;
+                    if (!tree.search(key, value)) misses++;
+                }
+            });
+        }
+        for (auto &w : workers) w.join();
+        double elapsed = secondsSince(start);
+        uint64_t done = lookups / threads * threads;
+        cout << "lookup threads=" << threads << " lookups=" << done
+             << " lookups_per_sec=" << (uint64_t)(done / elapsed)
+             << " misses=" << misses.load() << "\n";
+        if (threads == maxThreads) break;
+    }
+}
+
+// Split a comma-separated option value
+static vector<string> splitList(const string &text) {
+    vector<string> items;
+    string item;
+    istringstream in(text);
+    while (getline(in, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char *argv[]) {
+    string fileName = "bench.idx";
+    uint64_t numKeys = 200000;
+    uint64_t lookups = 1000000;
+    bool lookupsGiven = false;
+    uint64_t nodeRounds = 2000;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    size_t cacheFrames = 4096;
+    StorageKind storageKind = StorageKind::Pread;
+    size_t pageSize = DEFAULT_PAGE_SIZE;
+    uint64_t nodeFormat = DEFAULT_NODE_FORMAT;
+    bool walEnabled = true;
+    bool copyOnWrite = false;
+    uint64_t commitInterval = 0;
+    IoEngine ioEngine = IoEngine::Uring;
+    size_t ioDepth = DEFAULT_IO_DEPTH;
+    double bloomRate = 0;
+    size_t bloomMaxBytes = 0;
+    bool suite = false;
+    SuiteOptions suiteOptions{{KeyDistribution::Sequential, KeyDistribution::Random, KeyDistribution::Zipfian,
+                               KeyDistribution::Clustered},
+                              {10000, 100000},
+                              {"insert", "lookup", "miss", "range", "extract", "load", "bulkload"},
+                              100000, 10000, 100, 0};
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--file" && i + 1 < argc) {
+            fileName = argv[++i];
+        } else if (arg == "--keys" && i + 1 < argc) {
+            numKeys = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--lookups" && i + 1 < argc) {
+            lookups = strtoull(argv[++i], nullptr, 10);
+            lookupsGiven = true;
+        } else if (arg == "--node-rounds" && i + 1 < argc) {
+            nodeRounds = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--cache-frames" && i + 1 < argc) {
+            cacheFrames = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--storage" && i + 1 < argc) {
+            string kind = argv[++i];
+            storageKind = kind == "mmap" ? StorageKind::Mmap
+                        : kind == "stream" ? StorageKind::Stream : StorageKind::Pread;
+        } else if (arg == "--page-size" && i + 1 < argc) {
+            pageSize = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--node-format" && i + 1 < argc) {
+            nodeFormat = string(argv[++i]) == "plain" ? NODE_FORMAT_PLAIN : NODE_FORMAT_PACKED;
+        } else if (arg == "--wal" && i + 1 < argc) {
+            walEnabled = string(argv[++i]) != "off";
+        } else if (arg == "--cow" && i + 1 < argc) {
+            copyOnWrite = string(argv[++i]) == "on";
+        } else if (arg == "--commit-every" && i + 1 < argc) {
+            commitInterval = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--io-engine" && i + 1 < argc) {
+            string engine = argv[++i];
+            ioEngine = engine == "off" ? IoEngine::Off : engine == "threads" ? IoEngine::Threads : IoEngine::Uring;
+        } else if (arg == "--io-depth" && i + 1 < argc) {
+            ioDepth = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--bloom-fpr" && i + 1 < argc) {
+            bloomRate = strtod(argv[++i], nullptr);
+        } else if (arg == "--bloom-memory" && i + 1 < argc) {
+            bloomMaxBytes = (size_t)strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (arg == "--suite") {
+            suite = true;
+        } else if (arg == "--datasets" && i + 1 < argc) {
+            suiteOptions.datasets.clear();
+            for (const string &name : splitList(argv[++i])) {
+                if (name == "sequential") suiteOptions.datasets.push_back(KeyDistribution::Sequential);
+                else if (name == "random") suiteOptions.datasets.push_back(KeyDistribution::Random);
+                else if (name == "zipfian") suiteOptions.datasets.push_back(KeyDistribution::Zipfian);
+                else if (name == "clustered") suiteOptions.datasets.push_back(KeyDistribution::Clustered);
+                else {
+                    cerr << "Error: unknown dataset " << name << ".\n";
+                    return 1;
+                }
+            }
+        } else if (arg == "--rows" && i + 1 < argc) {
+            suiteOptions.rowCounts.clear();
+            for (const string &count : splitList(argv[++i])) {
+                suiteOptions.rowCounts.push_back(strtoull(count.c_str(), nullptr, 10));
+            }
+        } else if (arg == "--workloads" && i + 1 < argc) {
+            suiteOptions.workloads = splitList(argv[++i]);
+            for (const string &name : suiteOptions.workloads) {
+                if (name != "insert" && name != "lookup" && name != "miss" && name != "range" && name != "extract"
+                    && name != "load" && name != "bulkload") {
+                    cerr << "Error: unknown workload " << name << ".\n";
+                    return 1;
+                }
+            }
+        } else if (arg == "--scans" && i + 1 < argc) {
+            suiteOptions.scans = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--scan-length" && i + 1 < argc) {
+            suiteOptions.scanLength = strtoull(argv[++i], nullptr, 10);
+        } else {
+            cerr << "Usage: " << argv[0] << " [--file F] [--keys N] [--lookups N] [--node-rounds N] [--threads N]"
+                 << " [--cache-frames N] [--storage pread|stream|mmap] [--page-size N]"
+                 << " [--node-format packed|plain] [--wal on|off] [--cow on|off] [--commit-every N]"
+                 << " [--io-engine uring|threads|off] [--io-depth N] [--bloom-fpr P] [--bloom-memory MB]\n"
+                 << "       " << argv[0] << " --suite [--datasets sequential,random,zipfian,clustered]"
+                 << " [--rows N,N,...] [--workloads insert,lookup,miss,range,extract,load,bulkload]"
+                 << " [--lookups N] [--scans N] [--scan-length N] [tree options as above]\n"
+                 << "--storage mmap reads blocks in place only with --wal off.\n";
+            return 1;
+        }
+    }
+    if (numKeys == 0 || threads == 0 || cacheFrames == 0 || ioDepth == 0 || ioDepth > MAX_IO_DEPTH) {
+        cerr << "Error: --keys, --threads, --cache-frames and --io-depth must be at least 1"
+             << " (--io-depth at most " << MAX_IO_DEPTH << ").\n";
+        return 1;
+    }
+    if (!isSupportedPageSize(pageSize)) {
+        cerr << "Error: --page-size must be a power of two from 512 to 65536.\n";
+        return 1;
+    }
+    if (!(bloomRate >= 0 && bloomRate < 1)) {
+        cerr << "Error: --bloom-fpr must be from 0 (no filter) to below 1.\n";
+        return 1;
+    }
+
+    BTree tree(cacheFrames);
+    tree.setStorageKind(storageKind);
+    tree.setCommitInterval(commitInterval);
+    tree.setPageSize(pageSize);
+    tree.setNodeFormat(nodeFormat);
+    tree.setWalEnabled(walEnabled);
+    tree.setCopyOnWrite(copyOnWrite);
+    tree.setReadAhead(ioEngine, ioDepth);
+    tree.setBloomFilter(bloomRate, bloomMaxBytes);
+
+    if (suite) {
+        for (uint64_t rows : suiteOptions.rowCounts) {
+            if (rows == 0) {
+                cerr << "Error: --rows must be at least 1.\n";
+                return 1;
+            }
+        }
+        suiteOptions.lookups = lookupsGiven ? lookups : suiteOptions.lookups;
+        suiteOptions.threads = threads;
+        ostringstream config;
+        config << "{\"page_size\": " << pageSize
+               << ", \"node_format\": \"" << (nodeFormat == NODE_FORMAT_PLAIN ? "plain" : "packed") << "\""
+               << ", \"storage\": \"" << (storageKind == StorageKind::Mmap ? "mmap"
+                                         : storageKind == StorageKind::Stream ? "stream" : "pread") << "\""
+               << ", \"cache_frames\": " << cacheFrames
+               << ", \"wal\": " << (walEnabled ? "true" : "false")
+               << ", \"cow\": " << (copyOnWrite ? "true" : "false")
+               << ", \"commit_every\": " << commitInterval
+               << ", \"io_engine\": \"" << tree.readAheadEngine() << "\""
+               << ", \"io_depth\": " << ioDepth
+               << ", \"bloom_fpr\": " << bloomRate
+               << ", \"bloom_memory_mb\": " << (bloomMaxBytes >> 20)
+               << ", \"threads\": " << threads
+               << ", \"lookups\": " << suiteOptions.lookups
+               << ", \"scans\": " << suiteOptions.scans
+               << ", \"scan_length\": " << suiteOptions.scanLength << "}";
+        try {
+            BenchmarkSuite bench(tree, suiteOptions, fileName);
+            return bench.run(cout, config.str()) ? 0 : 1;
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        nodeMicrobench<NodeLayout<512>>(nodeRounds);
+        nodeMicrobench<NodeLayout<4096>>(nodeRounds / 8 + 1);
+        tree.createIndex(fileName);
+        bool ok = stressWorkload(tree, numKeys, threads);
+        tree.sync();
+        lookupScaling(tree, numKeys, threads, lookups);
+        extractThroughput(tree, fileName + ".csv", threads);
+        ok = verifyThroughput(tree, threads) && ok;
+        ok = eraseWorkload(tree, numKeys, threads) && ok;
+        if (copyOnWrite) ok = snapshotWorkload(tree, numKeys, threads) && ok;
+        tree.closeFile();
+        remove(fileName.c_str());
+        remove((fileName + ".bloom").c_str());
+        return ok ? 0 : 1;
+    } catch (runtime_error &e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
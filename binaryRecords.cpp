@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const string RECORD_MAGIC = "4337REC1";
+// A record file starts with the magic and the big-endian record count
+static const size_t RECORD_HEADER_BYTES = 16;
+// Each record is a big-endian key followed by a big-endian value
+static const size_t RECORD_BYTES = 16;
+// Records converted to host order per batch while reading
+static const size_t RECORD_BATCH = 4096;
+
+// True if the file at path starts with the record file magic
+inline bool isRecordFile(const string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    char magic[8];
+    bool match = ::read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic)
+                 && memcmp(magic, RECORD_MAGIC.data(), sizeof(magic)) == 0;
+    ::close(fd);
+    return match;
+}
+
+// True if extract should write a file of this name as binary records
+inline bool isRecordFileName(const string &name) {
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0;
+}
+
+// Write a record file header with a count of 0 at fd's current offset, which must be the
+// start of the file; the records follow it
+inline bool startRecordFile(int fd) {
+    uint8_t header[RECORD_HEADER_BYTES] = {0};
+    memcpy(header, RECORD_MAGIC.data(), 8);
+    return ::write(fd, header, sizeof(header)) == (ssize_t)sizeof(header);
+}
+
+// Fill in the record count of a record file from its size, once all records are written
+inline bool finishRecordFile(int fd) {
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < (off_t)RECORD_HEADER_BYTES) return false;
+    uint64_t count = hostToBig(((uint64_t)end - RECORD_HEADER_BYTES) / RECORD_BYTES);
+    return pwrite(fd, &count, sizeof(count), 8) == (ssize_t)sizeof(count);
+}
+
+// Reads a binary record file. The file is mapped and read front to back; records are
+// converted to host order in batches with the SIMD word reversal used for nodes.
+class RecordReader {
+private:
+    const uint8_t *data;       // The records, after the header
+    size_t mappedSize;
+    uint64_t records;
+    uint64_t position;         // Next record next returns
+    vector<KeyValue> batch;    // Records from batchStart on, in host order
+    uint64_t batchStart;
+
+    void convert(uint64_t start) {
+        size_t n = (size_t)min<uint64_t>(RECORD_BATCH, records - start);
+        batch.resize(n);
+        bigToHostArray(data + start * RECORD_BYTES, (uint64_t*)batch.data(), n * 2);
+        batchStart = start;
+    }
+
+public:
+    RecordReader() : data(nullptr), mappedSize(0), records(0), position(0), batchStart(0) {}
+
+    ~RecordReader() {
+        if (mappedSize > 0) munmap((void*)(data - RECORD_HEADER_BYTES), mappedSize);
+    }
+
+    // Map a record file; returns false if it cannot be read and throws runtime_error if its
+    // size does not match the count in its header
+    bool open(const string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < RECORD_HEADER_BYTES) {
+            ::close(fd);
+            return false;
+        }
+        void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return false;
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+        mappedSize = (size_t)st.st_size;
+        data = (const uint8_t*)map + RECORD_HEADER_BYTES;
+
+        uint64_t beCount;
+        memcpy(&beCount, (const uint8_t*)map + 8, sizeof(beCount));
+        records = bigToHost(beCount);
+        if (memcmp(map, RECORD_MAGIC.data(), 8) != 0
+            || records != (mappedSize - RECORD_HEADER_BYTES) / RECORD_BYTES
+            || (mappedSize - RECORD_HEADER_BYTES) % RECORD_BYTES != 0) {
+            throw runtime_error("Binary input file is truncated or corrupt.");
+        }
+        return true;
+    }
+
+    uint64_t count() const {
+        return records;
+    }
+
+    // True if the keys are strictly ascending, as extract writes them
+    bool sorted() const {
+        uint64_t previous = 0;
+        for (uint64_t i = 0; i < records; i++) {
+            uint64_t beKey;
+            memcpy(&beKey, data + i * RECORD_BYTES, sizeof(beKey));
+            uint64_t key = bigToHost(beKey);
+            if (i > 0 && key <= previous) return false;
+            previous = key;
+        }
+        return true;
+    }
+
+    // Read the next record in file order; returns false at the end
+    bool next(KeyValue &out) {
+        if (position == records) return false;
+        if (position == batchStart + batch.size()) convert(position);
+        out = batch[position - batchStart];
+        position++;
+        return true;
+    }
+
+    // Call onRow(key, value) for every record in file order
+    template <typename RowFn>
+    void forEach(RowFn onRow) {
+        for (uint64_t start = 0; start < records; start += RECORD_BATCH) {
+            convert(start);
+            for (const KeyValue &kv : batch) onRow(kv.key, kv.value);
+        }
+    }
+};
+
+// Input file of load and bulkload: binary records when the file starts with the record
+// magic, CSV lines otherwise
+class LoadInput {
+private:
+    CsvReader csv;
+    RecordReader records;
+    bool binary;
+
+public:
+    LoadInput() : binary(false) {}
+
+    // Open the file, starting the CSV parser threads for a text file; returns false if it
+    // cannot be read
+    bool open(const string &path, unsigned threads = 0) {
+        binary = isRecordFile(path);
+        return binary ? records.open(path) : csv.open(path, threads);
+    }
+
+    // True for a binary file whose keys are strictly ascending, which can be streamed
+    // into a bulk build without sorting
+    bool sortedRecords() const {
+        return binary && records.sorted();
+    }
+
+    RecordReader &recordReader() {
+        return records;
+    }
+
+    // Call onRow(key, value) for every row in file order
+    template <typename RowFn>
+    void forEach(RowFn onRow) {
+        if (binary) {
+            records.forEach(onRow);
+        } else {
+            csv.forEach(onRow);
+        }
+    }
+};
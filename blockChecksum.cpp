@@ -0,0 +1,100 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOCK_CHECKSUM_X86 1
+#endif
+
+// Offset of the checksum word in every block of a file with checksums: the second word,
+// which nodes otherwise leave reserved and free blocks leave 0
+static const size_t BLOCK_CHECKSUM_OFFSET = 8;
+
+// CRC32C (the Castagnoli polynomial, as computed by the SSE4.2 crc32 instruction) of len
+// bytes, continuing from crc. Every function takes and returns the inverted register, so
+// a checksum starts from 0 and pieces can be chained.
+
+// Byte-at-a-time table for the reflected polynomial 0x82F63B78
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (c & 1 ? 0x82F63B78u : 0);
+            entries[i] = c;
+        }
+    }
+};
+
+static const Crc32cTable crc32cTable;
+
+uint32_t crc32cScalar(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) crc = crc32cTable.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef BLOCK_CHECKSUM_X86
+// Eight bytes per crc32 instruction
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t len) {
+    uint64_t c = ~crc;
+    size_t i = 0;
+#if defined(__x86_64__)
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+#endif
+    for (; i < len; i++) c = _mm_crc32_u8((uint32_t)c, data[i]);
+    return ~(uint32_t)c;
+}
+#endif
+
+typedef uint32_t (*Crc32cFn)(uint32_t crc, const uint8_t *data, size_t len);
+
+// Pick the hardware instruction when the CPU has it
+static Crc32cFn selectCrc32c() {
+#ifdef BLOCK_CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) return crc32cSse42;
+#endif
+    return crc32cScalar;
+}
+
+static const Crc32cFn crc32cImpl = selectCrc32c();
+
+// Name of the CRC32C kernel in use, for benchmarks
+const char *crc32cKernel() {
+    if (crc32cImpl == crc32cScalar) return "scalar";
+#ifdef BLOCK_CHECKSUM_X86
+    if (crc32cImpl == crc32cSse42) return "sse4.2";
+#endif
+    return "unknown";
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len) {
+    return crc32cImpl(crc, data, len);
+}
+
+// Checksum of a block: the CRC32C of everything but the checksum word itself
+inline uint64_t blockChecksum(const uint8_t *block, size_t size) {
+    uint32_t crc = crc32c(0, block, BLOCK_CHECKSUM_OFFSET);
+    return crc32c(crc, block + BLOCK_CHECKSUM_OFFSET + 8, size - BLOCK_CHECKSUM_OFFSET - 8);
+}
+
+// Store a block's checksum in its checksum word, big-endian like the rest of the block
+inline void stampBlockChecksum(uint8_t *block, size_t size) {
+    uint64_t beChecksum = hostToBig(blockChecksum(block, size));
+    memcpy(block + BLOCK_CHECKSUM_OFFSET, &beChecksum, sizeof(beChecksum));
+}
+
+// True if a block's checksum word matches its contents
+inline bool blockChecksumValid(const uint8_t *block, size_t size) {
+    uint64_t beChecksum;
+    memcpy(&beChecksum, block + BLOCK_CHECKSUM_OFFSET, sizeof(beChecksum));
+    return bigToHost(beChecksum) == blockChecksum(block, size);
+}
@@ -0,0 +1,352 @@
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Keys the filter of a new or small index is sized for before it first grows
+static const uint64_t BLOOM_MIN_KEYS = 1 << 16;
+// A filter built for an existing set of keys has room for this share more (1/8)
+static const uint64_t BLOOM_HEADROOM_SHIFT = 3;
+// Layers a filter may grow to; each holds twice the keys of the one before
+static const int BLOOM_MAX_LAYERS = 32;
+// A key's bits all fall into one block of 512 bits (a cache line)
+static const uint64_t BLOOM_BLOCK_WORDS = 8;
+static const uint64_t BLOOM_BLOCK_BITS = BLOOM_BLOCK_WORDS * 64;
+static const string BLOOM_MAGIC = "4337BLM1";
+// Words converted per write or read of the sidecar file
+static const size_t BLOOM_IO_WORDS = 1 << 16;
+
+uint64_t hostToBig(uint64_t x);
+uint64_t bigToHost(uint64_t x);
+void bigToHostArray(const uint8_t *src, uint64_t *dst, size_t n);
+void hostToBigArray(const uint64_t *src, uint8_t *dst, size_t n);
+
+// The murmur3 finalizer, spreading a key's bits over the whole word
+inline uint64_t bloomHash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Blocked Bloom filter over 64-bit keys, answering "certainly not present" or "maybe
+// present". Each key sets a fixed number of bits within one 512-bit block, so a lookup
+// touches a single cache line per layer. A filter starts with one layer sized for the
+// keys expected; when more keys arrive than it was sized for, a layer twice as large is
+// added and new keys go there, so the false-positive rate stays near the target while
+// the tree grows without reading it again. Keys cannot be removed: deleted keys keep
+// their bits until the filter is rebuilt.
+//
+// mark, countAdded, countRemoved and mayContain may be called from several threads at once.
+class BloomFilter {
+private:
+    struct Layer {
+        uint64_t blocks;                       // Blocks of BLOOM_BLOCK_BITS bits
+        uint64_t capacity;                     // Keys the layer was sized for
+        atomic<uint64_t> added;                // Keys counted into it
+        unique_ptr<atomic<uint64_t>[]> words;
+
+        Layer(uint64_t blocks, uint64_t capacity) : blocks(blocks), capacity(capacity), added(0),
+            words(new atomic<uint64_t>[blocks * BLOOM_BLOCK_WORDS]()) {}
+    };
+
+    double rate;              // Target false-positive rate
+    int hashes;               // Bits set per key
+    double bitsPerKey;        // Bits a layer gets per key it is sized for
+    size_t maxBytes;          // Memory the layers may use together, 0 for no limit
+    unique_ptr<Layer> layerList[BLOOM_MAX_LAYERS];
+    atomic<int> layerCount;
+    atomic<bool> canGrow;     // False once the layer limit or the memory limit is reached
+    atomic<uint64_t> removed; // Keys deleted from the tree since the filter was built
+    mutex growLatch;
+
+    // Block and bit mask words of a key in one layer
+    void locate(const Layer &layer, uint64_t hash, uint64_t &block, uint64_t *mask) const {
+        block = (uint64_t)(((unsigned __int128)hash * layer.blocks) >> 64);
+        uint64_t h2 = hash * 0x9E3779B97F4A7C15ULL;
+        uint32_t a = (uint32_t)h2, b = (uint32_t)(h2 >> 32) | 1;
+        memset(mask, 0, BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+        for (int i = 0; i < hashes; i++) {
+            uint32_t bit = (a + (uint32_t)i * b) >> 23;   // Top 9 bits: 0 to 511
+            mask[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    // Hash of a key in layer l, so the layers' false positives are independent
+    static uint64_t layerHash(uint64_t hash, int l) {
+        return l == 0 ? hash : bloomHash(hash + (uint64_t)l);
+    }
+
+    // Blocks a new layer for capacity keys gets, within what the memory limit leaves; 0 if none fit
+    uint64_t blocksFor(uint64_t capacity) const {
+        uint64_t blocks = max<uint64_t>(1, (uint64_t)ceil((double)capacity * bitsPerKey / (double)BLOOM_BLOCK_BITS));
+        if (maxBytes != 0) {
+            uint64_t used = bytes();
+            uint64_t left = used < maxBytes ? (maxBytes - used) / (BLOOM_BLOCK_WORDS * 8) : 0;
+            blocks = min(blocks, left);
+        }
+        return blocks;
+    }
+
+    // Add a layer twice as large as the newest one, unless another thread already did
+    void grow(int seen) {
+        lock_guard<mutex> guard(growLatch);
+        if (layerCount.load(memory_order_relaxed) != seen) return;
+        uint64_t capacity = layerList[seen - 1]->capacity * 2;
+        uint64_t blocks = seen < BLOOM_MAX_LAYERS ? blocksFor(capacity) : 0;
+        if (blocks == 0) {
+            canGrow = false;
+            return;
+        }
+        layerList[seen].reset(new Layer(blocks, capacity));
+        layerCount.store(seen + 1, memory_order_release);
+    }
+
+public:
+    // Keys to size a filter for when it is built over a number of existing keys
+    static uint64_t capacityFor(uint64_t keys) {
+        return max(BLOOM_MIN_KEYS, keys + (keys >> BLOOM_HEADROOM_SHIFT));
+    }
+
+    // A filter with one layer sized for capacity keys at the given false-positive rate,
+    // using at most maxBytes of memory (0 for no limit)
+    BloomFilter(double rate, size_t maxBytes, uint64_t capacity) : rate(rate), maxBytes(maxBytes),
+        layerCount(0), canGrow(true), removed(0) {
+        bitsPerKey = -log(rate) / (M_LN2 * M_LN2);
+        hashes = max(1, min(16, (int)lround(bitsPerKey * M_LN2)));
+        capacity = max<uint64_t>(capacity, 1);
+        layerList[0].reset(new Layer(max<uint64_t>(1, blocksFor(capacity)), capacity));
+        layerCount = 1;
+    }
+
+    // Set key's bits in the newest layer. Writers mark a key before it goes into the tree,
+    // so a search can never find it in the tree but not in the filter.
+    void mark(uint64_t key) {
+        int n = layerCount.load(memory_order_acquire);
+        Layer &layer = *layerList[n - 1];
+        uint64_t block, mask[BLOOM_BLOCK_WORDS];
+        locate(layer, layerHash(bloomHash(key), n - 1), block, mask);
+        atomic<uint64_t> *words = &layer.words[block * BLOOM_BLOCK_WORDS];
+        for (uint64_t w = 0; w < BLOOM_BLOCK_WORDS; w++) {
+            if (mask[w] != 0 && (words[w].load(memory_order_relaxed) & mask[w]) != mask[w]) {
+                words[w].fetch_or(mask[w], memory_order_relaxed);
+            }
+        }
+    }
+
+    // Count a key that was new to the tree, growing the filter once the newest layer is full
+    void countAdded() {
+        int n = layerCount.load(memory_order_acquire);
+        Layer &layer = *layerList[n - 1];
+        if (layer.added.fetch_add(1, memory_order_relaxed) + 1 >= layer.capacity && canGrow.load(memory_order_relaxed)) {
+            grow(n);
+        }
+    }
+
+    // Mark a key and count it, for keys known to be new
+    void add(uint64_t key) {
+        mark(key);
+        countAdded();
+    }
+
+    void countRemoved() {
+        removed.fetch_add(1, memory_order_relaxed);
+    }
+
+    // False if key was certainly never marked
+    bool mayContain(uint64_t key) const {
+        uint64_t hash = bloomHash(key);
+        int n = layerCount.load(memory_order_acquire);
+        for (int l = 0; l < n; l++) {
+            const Layer &layer = *layerList[l];
+            uint64_t block, mask[BLOOM_BLOCK_WORDS];
+            locate(layer, layerHash(hash, l), block, mask);
+            const atomic<uint64_t> *words = &layer.words[block * BLOOM_BLOCK_WORDS];
+            bool all = true;
+            for (uint64_t w = 0; w < BLOOM_BLOCK_WORDS && all; w++) {
+                all = (words[w].load(memory_order_relaxed) & mask[w]) == mask[w];
+            }
+            if (all) return true;
+        }
+        return false;
+    }
+
+    double targetRate() const {
+        return rate;
+    }
+
+    int layers() const {
+        return layerCount.load(memory_order_acquire);
+    }
+
+    // Keys counted into the filter (deleted keys included)
+    uint64_t keys() const {
+        uint64_t total = 0;
+        for (int l = 0; l < layers(); l++) total += layerList[l]->added.load(memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t keysRemoved() const {
+        return removed.load(memory_order_relaxed);
+    }
+
+    uint64_t bytes() const {
+        uint64_t total = 0;
+        for (int l = 0; l < layers(); l++) total += layerList[l]->blocks * BLOOM_BLOCK_WORDS * 8;
+        return total;
+    }
+
+    // False-positive rate estimated from the share of bits set in each block, averaged
+    // over the blocks a missing key may hash to. Reads every word, so it is meant for
+    // statistics.
+    double estimatedRate() const {
+        double pass = 1.0;
+        for (int l = 0; l < layers(); l++) {
+            const Layer &layer = *layerList[l];
+            double sum = 0;
+            for (uint64_t b = 0; b < layer.blocks; b++) {
+                int set = 0;
+                for (uint64_t w = 0; w < BLOOM_BLOCK_WORDS; w++) {
+                    set += __builtin_popcountll(layer.words[b * BLOOM_BLOCK_WORDS + w].load(memory_order_relaxed));
+                }
+                sum += pow((double)set / (double)BLOOM_BLOCK_BITS, hashes);
+            }
+            pass *= 1.0 - sum / (double)layer.blocks;
+        }
+        return 1.0 - pass;
+    }
+
+    // True if the filter should be rebuilt from the tree: it has grown past its first layer
+    // (each layer adds to the false-positive rate), half of its keys have been deleted, or
+    // it was built for another rate or a larger memory limit
+    bool stale(double wantedRate, size_t wantedMaxBytes) const {
+        return layers() > 1 || keysRemoved() * 2 > keys() || wantedRate != rate
+            || (wantedMaxBytes != 0 && bytes() > wantedMaxBytes);
+    }
+
+    // Write the filter to path, tagged with the index generation it describes: a header of
+    // big-endian words (magic, generation, rate, removed keys, layer count, then blocks,
+    // capacity and added keys per layer) followed by each layer's words. The file is
+    // written under a temporary name, synced and renamed, so it is whole or absent.
+    bool save(const string &path, uint64_t generation) const {
+        int n = layers();
+        vector<uint64_t> header;
+        uint64_t magic, rateBits;
+        memcpy(&magic, BLOOM_MAGIC.data(), 8);
+        memcpy(&rateBits, &rate, 8);
+        header.push_back(bigToHost(magic));
+        header.push_back(generation);
+        header.push_back(rateBits);
+        header.push_back(keysRemoved());
+        header.push_back((uint64_t)n);
+        for (int l = 0; l < n; l++) {
+            header.push_back(layerList[l]->blocks);
+            header.push_back(layerList[l]->capacity);
+            header.push_back(layerList[l]->added.load(memory_order_relaxed));
+        }
+
+        string tempPath = path + ".tmp";
+        int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        vector<uint8_t> out(max(header.size(), BLOOM_IO_WORDS) * 8);
+        hostToBigArray(header.data(), out.data(), header.size());
+        bool ok = ::write(fd, out.data(), header.size() * 8) == (ssize_t)(header.size() * 8);
+        vector<uint64_t> chunk(BLOOM_IO_WORDS);
+        for (int l = 0; l < n && ok; l++) {
+            const Layer &layer = *layerList[l];
+            uint64_t words = layer.blocks * BLOOM_BLOCK_WORDS;
+            for (uint64_t at = 0; at < words && ok; at += BLOOM_IO_WORDS) {
+                size_t count = (size_t)min<uint64_t>(BLOOM_IO_WORDS, words - at);
+                for (size_t w = 0; w < count; w++) chunk[w] = layer.words[at + w].load(memory_order_relaxed);
+                hostToBigArray(chunk.data(), out.data(), count);
+                ok = ::write(fd, out.data(), count * 8) == (ssize_t)(count * 8);
+            }
+        }
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        ok = fdatasync(fd) == 0 && ok;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+            remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Read a filter saved for the given index generation; nullptr if the file is missing,
+    // damaged or was saved for another generation
+    static unique_ptr<BloomFilter> load(const string &path, uint64_t generation, size_t maxBytes) {
+        unique_ptr<BloomFilter> filter;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return filter;
+        struct stat st;
+        uint8_t raw[5 * 8];
+        uint64_t header[5];
+        if (fstat(fd, &st) != 0 || ::read(fd, raw, sizeof(raw)) != (ssize_t)sizeof(raw)) {
+            ::close(fd);
+            return filter;
+        }
+        bigToHostArray(raw, header, 5);
+        uint64_t magic;
+        memcpy(&magic, BLOOM_MAGIC.data(), 8);
+        double rate;
+        memcpy(&rate, &header[2], 8);
+        int n = (int)header[4];
+        if (header[0] != bigToHost(magic) || header[1] != generation || !(rate > 0 && rate < 1)
+            || header[4] == 0 || header[4] > (uint64_t)BLOOM_MAX_LAYERS) {
+            ::close(fd);
+            return filter;
+        }
+
+        vector<uint8_t> layerRaw(n * 3 * 8);
+        vector<uint64_t> layerWords(n * 3);
+        bool ok = ::read(fd, layerRaw.data(), layerRaw.size()) == (ssize_t)layerRaw.size();
+        bigToHostArray(layerRaw.data(), layerWords.data(), layerWords.size());
+        uint64_t expected = sizeof(raw) + layerRaw.size();
+        for (int l = 0; l < n && ok; l++) {
+            uint64_t blocks = layerWords[l * 3];
+            ok = blocks != 0 && blocks <= ((uint64_t)st.st_size) / (BLOOM_BLOCK_WORDS * 8);
+            expected += blocks * BLOOM_BLOCK_WORDS * 8;
+        }
+        if (!ok || expected != (uint64_t)st.st_size) {
+            ::close(fd);
+            return filter;
+        }
+
+        filter.reset(new BloomFilter(rate, maxBytes, 1));
+        filter->removed = header[3];
+        vector<uint8_t> in(BLOOM_IO_WORDS * 8);
+        vector<uint64_t> chunk(BLOOM_IO_WORDS);
+        for (int l = 0; l < n && ok; l++) {
+            Layer *layer = new Layer(layerWords[l * 3], max<uint64_t>(1, layerWords[l * 3 + 1]));
+            filter->layerList[l].reset(layer);
+            layer->added = layerWords[l * 3 + 2];
+            uint64_t words = layer->blocks * BLOOM_BLOCK_WORDS;
+            for (uint64_t at = 0; at < words && ok; at += BLOOM_IO_WORDS) {
+                size_t count = (size_t)min<uint64_t>(BLOOM_IO_WORDS, words - at);
+                ok = ::read(fd, in.data(), count * 8) == (ssize_t)(count * 8);
+                bigToHostArray(in.data(), chunk.data(), count);
+                for (size_t w = 0; w < count; w++) layer->words[at + w].store(chunk[w], memory_order_relaxed);
+            }
+        }
+        ::close(fd);
+        if (!ok) {
+            filter.reset();
+            return filter;
+        }
+        filter->layerCount = n;
+        return filter;
+    }
+};
@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Default number of block frames kept in memory (matches the original 3-node limit)
+static const size_t DEFAULT_POOL_FRAMES = 3;
+
+// Fixed-budget cache of index blocks sitting between the B-Tree and the index file.
+// Blocks are pinned while in use, evicted with the CLOCK algorithm and written back
+// only when dirty (on eviction or flushAll). The pool never flushes the storage
+// itself; making writes durable is up to the caller's commit points. When the
+// storage exposes the file directly (mmap), pins hand out pointers into it and
+// no frames are used.
+//
+// pin and unpin are thread-safe. Misses are read outside the pool mutex, so
+// several threads can wait on storage at once; a thread asking for a block that
+// is still being read waits for that read instead of issuing its own. The pool
+// does not protect frame contents: callers latch blocks before modifying them.
+//
+// With a read-ahead engine set, prefetch starts reads of blocks the caller will pin
+// soon without waiting for them. A prefetched block occupies an unpinned frame that
+// cannot be evicted until its read completes; pinning it meanwhile waits for the read.
+// At most half the frames are used for reads in flight, so read-ahead never crowds
+// out the blocks in use.
+class BufferPool {
+private:
+    struct Frame {
+        uint64_t blockId;   // Block held by this frame, 0 if the frame is free
+        int pinCount;       // Number of outstanding pins, pinned frames are never evicted
+        bool dirty;         // Frame differs from the copy on disk
+        bool referenced;    // CLOCK reference bit
+        bool loading;       // Block is being read from storage, contents not valid yet
+        bool readingAhead;  // The read in progress is a read-ahead by the engine
+        bool failed;        // A read-ahead of the block failed, the first pin reads it again
+    };
+
+    Storage *storage;                       // Index file the blocks belong to
+    size_t blockSize;                       // Size of one block in bytes
+    vector<Frame> frames;                   // Frame descriptors
+    vector<uint8_t> data;                   // Frame contents, frames.size() * blockSize bytes
+    unordered_map<uint64_t, size_t> table;  // Block ID -> frame index
+    size_t clockHand;                       // Next frame the CLOCK sweep looks at
+    bool directAccess;                      // Storage is memory-mapped, frames are bypassed
+    unordered_set<uint64_t> directDirty;    // Blocks changed in the mapping since flushAll
+    bool checksums;                         // Blocks carry a CRC32C, stamped on write and checked on read
+    vector<uint8_t> stamped;                // Copy of the block being written, with its checksum
+    mutex lock;                             // Protects frames, table and clockHand
+    condition_variable loaded;              // Signalled when a frame finishes loading
+    condition_variable unpinned;            // Signalled when a frame's last pin is released
+    atomic<uint64_t> blocksRead;            // Blocks read from storage since the pool was created
+    atomic<uint64_t> blocksWritten;         // Blocks written back to storage
+    atomic<uint64_t> blocksPrefetched;      // Blocks read ahead, also counted in blocksRead
+    unique_ptr<AsyncReader> reader;         // Read-ahead engine, nullptr if off
+    size_t prefetching;                     // Read-ahead reads in flight (protected by lock)
+    bool polling;                           // A thread is waiting in reader->poll()
+
+    uint8_t *frameData(size_t index) {
+        return data.data() + index * blockSize;
+    }
+
+    // Read a block from disk into a frame, zero-filling anything past end of file. Throws
+    // runtime_error if the block's checksum does not match.
+    void readBlock(uint64_t blockId, uint8_t *buffer) {
+        storage->read(blockId * blockSize, buffer, blockSize);
+        blocksRead.fetch_add(1, memory_order_relaxed);
+        if (checksums && !blockChecksumValid(buffer, blockSize)) {
+            throw runtime_error("Checksum mismatch in block " + to_string(blockId) + ".");
+        }
+    }
+
+    // Write a frame's contents back to its block on disk (called with lock held). The
+    // checksum is stamped into a copy, since other threads may be reading the frame.
+    void writeBlock(uint64_t blockId, const uint8_t *buffer) {
+        if (checksums) {
+            memcpy(stamped.data(), buffer, blockSize);
+            stampBlockChecksum(stamped.data(), blockSize);
+            buffer = stamped.data();
+        }
+        storage->write(blockId * blockSize, buffer, blockSize);
+        blocksWritten.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Read the block of a frame this thread has pinned and marked loading, with lock held
+    // on entry and exit. If the read throws, the frame is left failed for the next pin.
+    void loadFrame(unique_lock<mutex> &guard, size_t index) {
+        uint64_t blockId = frames[index].blockId;
+        guard.unlock();
+        try {
+            readBlock(blockId, frameData(index));
+        } catch (...) {
+            guard.lock();
+            frames[index].loading = false;
+            frames[index].failed = true;
+            frames[index].pinCount--;
+            loaded.notify_all();
+            if (frames[index].pinCount == 0) unpinned.notify_all();
+            throw;
+        }
+        guard.lock();
+        frames[index].loading = false;
+        loaded.notify_all();
+    }
+
+    // Completion of a read-ahead read into a frame (called by the engine, never with lock
+    // held). A block whose checksum does not match counts as failed, so the pin that wants
+    // it reads it again and reports the error.
+    void prefetchDone(size_t index, bool ok) {
+        if (ok && checksums) ok = blockChecksumValid(frameData(index), blockSize);
+        lock_guard<mutex> guard(lock);
+        frames[index].loading = false;
+        frames[index].readingAhead = false;
+        frames[index].failed = !ok;
+        if (ok) {
+            blocksRead.fetch_add(1, memory_order_relaxed);
+            blocksPrefetched.fetch_add(1, memory_order_relaxed);
+        }
+        prefetching--;
+        loaded.notify_all();
+    }
+
+    // Wait for the engine to finish a read-ahead read, with lock held on entry and exit.
+    // The engine may need a thread to collect its completions, so one waiting thread at a
+    // time polls it and the others wait to be woken.
+    void waitForReadAhead(unique_lock<mutex> &guard) {
+        if (polling) {
+            loaded.wait(guard);
+            return;
+        }
+        polling = true;
+        guard.unlock();
+        reader->poll();
+        guard.lock();
+        polling = false;
+        loaded.notify_all();
+    }
+
+    // Wait until a frame is no longer loading (lock held)
+    void waitForLoad(unique_lock<mutex> &guard, size_t index) {
+        while (frames[index].loading) {
+            if (frames[index].readingAhead) waitForReadAhead(guard);
+            else loaded.wait(guard);
+        }
+    }
+
+    // Wait until no read-ahead read is in flight, so frames can be reset
+    void waitForPrefetches() {
+        unique_lock<mutex> guard(lock);
+        while (prefetching > 0) waitForReadAhead(guard);
+    }
+
+    // Pick a frame to reuse, writing it back first if dirty (called with lock held).
+    // Returns frames.size() if every frame is pinned or being read ahead.
+    size_t evictFrame() {
+        // Two full sweeps clear every reference bit, so a third finds a victim if one exists
+        for (size_t step = 0; step < 3 * frames.size(); step++) {
+            size_t index = clockHand;
+            clockHand = (clockHand + 1) % frames.size();
+            Frame &frame = frames[index];
+            if (frame.pinCount > 0 || frame.loading) continue;
+            if (frame.blockId != 0 && frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            if (frame.blockId != 0) {
+                if (frame.dirty) {
+                    writeBlock(frame.blockId, frameData(index));
+                }
+                table.erase(frame.blockId);
+            }
+            frame = Frame{0, 0, false, false, false, false, false};
+            return index;
+        }
+        return frames.size();
+    }
+
+public:
+    BufferPool(size_t blockSize, size_t frameCount = DEFAULT_POOL_FRAMES)
+        : blocksRead(0), blocksWritten(0), blocksPrefetched(0) {
+        storage = nullptr;
+        this->blockSize = blockSize;
+        clockHand = 0;
+        directAccess = false;
+        checksums = false;
+        stamped.assign(blockSize, 0);
+        prefetching = 0;
+        polling = false;
+        if (frameCount == 0) {
+            throw runtime_error("Buffer pool needs at least one frame.");
+        }
+        frames.assign(frameCount, Frame{0, 0, false, false, false, false, false});
+        data.assign(frameCount * blockSize, 0);
+    }
+
+    ~BufferPool() {
+        waitForPrefetches();
+        reader.reset();
+    }
+
+    // Choose how prefetch reads blocks: up to depth reads in flight with the given engine,
+    // or no read-ahead for IoEngine::Off
+    void setReadAhead(IoEngine engine, size_t depth) {
+        waitForPrefetches();
+        reader.reset();
+        reader = makeAsyncReader(engine, depth, [this](uint64_t tag, bool ok) {
+            prefetchDone((size_t)tag, ok);
+        });
+    }
+
+    // Name of the read-ahead engine in use ("off", "uring" or "threads")
+    const char *readAheadEngine() const {
+        return reader ? reader->name() : "off";
+    }
+
+    // How many blocks ahead callers should prefetch: the reads the pool lets be in
+    // flight at once, 0 without read-ahead or for a memory-mapped file
+    size_t readAheadWindow() const {
+        if (!reader || directAccess) return 0;
+        return min(reader->depth(), frames.size() / 2);
+    }
+
+    // Attach the pool to an open index file, dropping anything cached for a previous file
+    void attach(Storage *indexStorage) {
+        discard();
+        storage = indexStorage;
+        directAccess = storage != nullptr && storage->isMapped();
+    }
+
+    // Turn block checksums on or off for the attached file, whose format decides whether
+    // its blocks carry them. Blocks of a memory-mapped file are stamped when a pin that
+    // changed them is released; they are read in place, so only verify checks them.
+    void setChecksums(bool on) {
+        checksums = on;
+    }
+
+    bool checksumsEnabled() const {
+        return checksums;
+    }
+
+    size_t capacity() const {
+        return frames.size();
+    }
+
+    // Blocks read from and written to storage so far. Blocks of a memory-mapped file are
+    // accessed in place and not counted.
+    uint64_t readCount() const {
+        return blocksRead.load(memory_order_relaxed);
+    }
+
+    uint64_t writeCount() const {
+        return blocksWritten.load(memory_order_relaxed);
+    }
+
+    uint64_t prefetchCount() const {
+        return blocksPrefetched.load(memory_order_relaxed);
+    }
+
+    // Pin a block in memory and return its frame. When load is false the caller
+    // promises to overwrite the whole block, so it is not read from disk.
+    uint8_t *pin(uint64_t blockId, bool load = true) {
+        if (directAccess) {
+            return storage->mapped(blockId * blockSize, blockSize);
+        }
+
+        unique_lock<mutex> guard(lock);
+        size_t index;
+        while (true) {
+            auto it = table.find(blockId);
+            if (it != table.end()) {
+                index = it->second;
+                frames[index].pinCount++;
+                frames[index].referenced = true;
+                waitForLoad(guard, index);
+                if (frames[index].failed) {
+                    // Read-ahead failed; read it here so the error reaches this caller
+                    frames[index].failed = false;
+                    frames[index].loading = true;
+                    loadFrame(guard, index);
+                }
+                return frameData(index);
+            }
+            index = evictFrame();
+            if (index < frames.size()) break;
+            // Every frame is pinned by another thread or being read ahead; wait for one
+            // to be released or for a read-ahead to finish
+            if (prefetching > 0) waitForReadAhead(guard);
+            else unpinned.wait(guard);
+        }
+
+        uint8_t *buffer = frameData(index);
+        frames[index] = Frame{blockId, 1, false, true, load, false, false};
+        table[blockId] = index;
+        if (!load) {
+            memset(buffer, 0, blockSize);
+            return buffer;
+        }
+
+        // Read outside the lock; the pin keeps the frame from being evicted meanwhile
+        loadFrame(guard, index);
+        return buffer;
+    }
+
+    // Start reading blocks that are about to be pinned, in the given order, without
+    // waiting. Blocks already cached are skipped; once readAheadWindow() reads are in
+    // flight or no frame can be taken, the rest are left to be read when pinned.
+    void prefetch(const uint64_t *blockIds, size_t count) {
+        size_t window = readAheadWindow();
+        if (window == 0 || count == 0) return;
+        vector<ReadRequest> reads;
+        {
+            lock_guard<mutex> guard(lock);
+            for (size_t i = 0; i < count && prefetching < window; i++) {
+                uint64_t blockId = blockIds[i];
+                if (blockId == 0) continue;
+                auto it = table.find(blockId);
+                if (it != table.end()) {
+                    frames[it->second].referenced = true;
+                    continue;
+                }
+                size_t index = evictFrame();
+                if (index == frames.size()) break;
+                frames[index] = Frame{blockId, 0, false, true, true, true, false};
+                table[blockId] = index;
+                prefetching++;
+                reads.push_back(ReadRequest{storage, blockId * blockSize, frameData(index), blockSize, index});
+            }
+        }
+        // Submitted outside the lock: completions take it, and submit may report some at once
+        if (!reads.empty()) reader->submit(reads.data(), reads.size());
+    }
+
+    // Release a pin, marking the frame dirty if the caller modified it
+    void unpin(uint64_t blockId, bool dirty) {
+        if (directAccess) {
+            if (!dirty) return;
+            if (checksums) stampBlockChecksum(storage->mapped(blockId * blockSize, blockSize), blockSize);
+            lock_guard<mutex> guard(lock);
+            directDirty.insert(blockId);
+            return;
+        }
+
+        lock_guard<mutex> guard(lock);
+        auto it = table.find(blockId);
+        if (it == table.end()) {
+            throw runtime_error("Unpin of a block that is not cached.");
+        }
+        Frame &frame = frames[it->second];
+        if (frame.pinCount <= 0) {
+            throw runtime_error("Unpin of a block that is not pinned.");
+        }
+        frame.pinCount--;
+        if (dirty) frame.dirty = true;
+        if (frame.pinCount == 0) unpinned.notify_all();
+    }
+
+    // Write every dirty frame back to disk in block order (frames stay cached). For a
+    // memory-mapped file, hand the runs of blocks changed in place to the storage so
+    // its sync covers only those. Callers make sure no block is being modified while
+    // this runs.
+    void flushAll() {
+        if (storage == nullptr) return;
+        lock_guard<mutex> guard(lock);
+        if (directAccess) {
+            vector<uint64_t> blockIds(directDirty.begin(), directDirty.end());
+            directDirty.clear();
+            sort(blockIds.begin(), blockIds.end());
+            size_t i = 0;
+            while (i < blockIds.size()) {
+                size_t run = 1;
+                while (i + run < blockIds.size() && blockIds[i + run] == blockIds[i] + run) run++;
+                storage->writeBack(blockIds[i] * blockSize, run * blockSize);
+                i += run;
+            }
+            return;
+        }
+        vector<size_t> dirtyFrames;
+        for (size_t i = 0; i < frames.size(); i++) {
+            if (frames[i].blockId != 0 && frames[i].dirty) {
+                dirtyFrames.push_back(i);
+            }
+        }
+        sort(dirtyFrames.begin(), dirtyFrames.end(), [this](size_t a, size_t b) {
+            return frames[a].blockId < frames[b].blockId;
+        });
+        for (size_t index : dirtyFrames) {
+            writeBlock(frames[index].blockId, frameData(index));
+            frames[index].dirty = false;
+        }
+    }
+
+    // Forget all cached blocks without writing them back (not thread-safe)
+    void discard() {
+        waitForPrefetches();
+        table.clear();
+        directDirty.clear();
+        for (auto &frame : frames) {
+            frame = Frame{0, 0, false, false, false, false, false};
+        }
+        clockHand = 0;
+    }
+};
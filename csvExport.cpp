@@ -0,0 +1,173 @@
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+// Bytes of output a worker formats before handing the chunk to the writer (1 MiB)
+static const size_t EXPORT_CHUNK_BYTES = 1 << 20;
+// Formatted output that may wait in memory for earlier ranges to be written (64 MiB)
+static const size_t EXPORT_BUFFER_BYTES = 64 << 20;
+// Longest line: two 20-digit numbers, a separator and a newline
+static const size_t EXPORT_LINE_BYTES = 42;
+// Separator that makes the export functions write 16-byte binary records (a big-endian
+// key and value, see binaryRecords.cpp) instead of text lines
+static const char BINARY_RECORDS = '\0';
+
+// Format "key<separator>value\n" into line with std::to_chars; returns the length
+inline size_t formatEntry(char *line, uint64_t key, uint64_t value, char separator) {
+    char *end = line + EXPORT_LINE_BYTES;
+    char *p = to_chars(line, end, key).ptr;
+    *p++ = separator;
+    p = to_chars(p, end, value).ptr;
+    *p++ = '\n';
+    return (size_t)(p - line);
+}
+
+// Writes the output of consecutive parts to a file descriptor in part order while the
+// parts are produced concurrently. Producers hand over chunks of a part with put and
+// mark it complete with finish; one thread runs writeAll, which writes the chunks of
+// part 0, then part 1, and so on as they arrive. Producers of later parts wait while
+// more than EXPORT_BUFFER_BYTES are queued, except for the part being written, so memory
+// stays bounded and the output can always make progress.
+class OrderedWriter {
+private:
+    struct Part {
+        deque<string> chunks;
+        bool finished = false;
+    };
+
+    int fd;
+    vector<Part> parts;
+    size_t head;              // Part currently being written
+    size_t queuedBytes;       // Bytes waiting in chunks
+    exception_ptr error;      // First failure of a producer or the writer
+    mutex lock;
+    condition_variable changed;
+
+    void writeChunk(const string &chunk) {
+        size_t done = 0;
+        while (done < chunk.size()) {
+            ssize_t n = ::write(fd, chunk.data() + done, chunk.size() - done);
+            if (n <= 0) {
+                throw runtime_error("Unable to write output file.");
+            }
+            done += (size_t)n;
+        }
+    }
+
+public:
+    OrderedWriter(int fd, size_t partCount) : fd(fd), parts(partCount), head(0), queuedBytes(0) {}
+
+    // Queue a chunk of a part's output; chunks of one part are written in the order given
+    void put(size_t part, string &&chunk) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] {
+            return error || part == head || queuedBytes + chunk.size() <= EXPORT_BUFFER_BYTES;
+        });
+        if (error) {
+            throw runtime_error("Export aborted.");
+        }
+        queuedBytes += chunk.size();
+        parts[part].chunks.push_back(move(chunk));
+        changed.notify_all();
+    }
+
+    // Mark a part as complete
+    void finish(size_t part) {
+        lock_guard<mutex> guard(lock);
+        parts[part].finished = true;
+        changed.notify_all();
+    }
+
+    // Record a failure; writeAll stops and rethrows it, and waiting producers give up
+    void abort(exception_ptr failure) {
+        lock_guard<mutex> guard(lock);
+        if (!error) error = failure;
+        changed.notify_all();
+    }
+
+    // Write all parts in order, returning once the last one is complete and written
+    void writeAll() {
+        unique_lock<mutex> guard(lock);
+        while (head < parts.size()) {
+            Part &part = parts[head];
+            changed.wait(guard, [&] { return error || !part.chunks.empty() || part.finished; });
+            if (error) {
+                rethrow_exception(error);
+            }
+            if (part.chunks.empty()) {
+                // Finished and fully written: a producer of the next part may now go over budget
+                head++;
+                changed.notify_all();
+                continue;
+            }
+            string chunk = move(part.chunks.front());
+            part.chunks.pop_front();
+            guard.unlock();
+            try {
+                writeChunk(chunk);
+            } catch (...) {
+                guard.lock();
+                if (!error) error = current_exception();
+                changed.notify_all();
+                throw;
+            }
+            guard.lock();
+            queuedBytes -= chunk.size();
+            changed.notify_all();
+        }
+    }
+};
+
+// Formats the entries of one part (as text lines or binary records) into chunks and hands
+// them to an OrderedWriter
+class PartOutput {
+private:
+    OrderedWriter &writer;
+    size_t part;
+    char separator;
+    string chunk;
+
+    void handOver() {
+        writer.put(part, move(chunk));
+        chunk = string();
+        chunk.reserve(EXPORT_CHUNK_BYTES + EXPORT_LINE_BYTES);
+    }
+
+public:
+    PartOutput(OrderedWriter &writer, size_t part, char separator)
+        : writer(writer), part(part), separator(separator) {
+        chunk.reserve(EXPORT_CHUNK_BYTES + EXPORT_LINE_BYTES);
+    }
+
+    void add(uint64_t key, uint64_t value) {
+        if (separator == BINARY_RECORDS) {
+            uint64_t record[2] = {hostToBig(key), hostToBig(value)};
+            chunk.append((const char*)record, sizeof(record));
+        } else {
+            char line[EXPORT_LINE_BYTES];
+            chunk.append(line, formatEntry(line, key, value, separator));
+        }
+        if (chunk.size() >= EXPORT_CHUNK_BYTES) {
+            handOver();
+        }
+    }
+
+    // Hand over what is left and mark the part complete
+    void finish() {
+        if (!chunk.empty()) {
+            handOver();
+        }
+        writer.finish(part);
+    }
+};
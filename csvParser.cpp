@@ -0,0 +1,210 @@
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Bytes of input parsed as one batch (1 MiB)
+static const size_t PARSE_PIECE_BYTES = 1 << 20;
+// Parsed batches that may wait for the insertion stage
+static const size_t PARSE_QUEUE_BATCHES = 16;
+
+// Read one field of a load file line the way stoull reads a string: leading whitespace,
+// an optional sign, then decimal digits up to the first other character. Returns false
+// where stoull would throw (no digits, or a value that does not fit 64 bits).
+inline bool parseLoadField(const char *p, const char *end, uint64_t &out) {
+    while (p < end && isspace((unsigned char)*p)) p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (from_chars(p, end, out).ec != errc()) return false;
+    if (negative) out = 0 - out;
+    return true;
+}
+
+// Reads "key,value" lines from a load file in parallel. The file is mapped (or read
+// whole when it cannot be mapped) and cut into pieces of PARSE_PIECE_BYTES; worker
+// threads parse the pieces with from_chars, without allocating per line, and the
+// calling thread receives the rows in file order through forEach while later pieces
+// are still being parsed. At most PARSE_QUEUE_BATCHES parsed pieces wait for the caller.
+//
+// Lines are split as getline splits them and empty lines are skipped. Malformed lines
+// are reported to cerr with the same messages as before, at their place in the input.
+class CsvReader {
+private:
+    struct Batch {
+        vector<KeyValue> rows;
+        vector<pair<size_t, string>> errors;   // Message to print before rows[first]
+        bool ready = false;
+    };
+
+    const char *data;          // The input file
+    size_t size;
+    bool mapped;               // data is a mapping (else it points into copy)
+    vector<char> copy;
+    size_t pieces;
+    vector<Batch> slots;       // Batch of piece k is in slots[k % PARSE_QUEUE_BATCHES]
+    size_t consumed;           // Pieces handed to the caller so far
+    atomic<size_t> nextPiece;
+    bool stopping;
+    mutex lock;
+    condition_variable changed;
+    vector<thread> workers;
+
+    // Start of the first line that begins at or after offset
+    size_t lineStart(size_t offset) const {
+        if (offset == 0) return 0;
+        if (offset >= size) return size;
+        const void *newline = memchr(data + offset - 1, '\n', size - offset + 1);
+        return newline ? (size_t)((const char*)newline - data) + 1 : size;
+    }
+
+    // Parse the lines that begin inside piece k
+    void parsePiece(size_t k, Batch &batch) {
+        batch.rows.clear();
+        batch.errors.clear();
+        size_t pos = lineStart(k * PARSE_PIECE_BYTES);
+        size_t stop = lineStart((k + 1) * PARSE_PIECE_BYTES);
+        while (pos < stop) {
+            const char *line = data + pos;
+            const char *newline = (const char*)memchr(line, '\n', size - pos);
+            const char *end = newline ? newline : data + size;
+            pos = (size_t)(end - data) + 1;
+            if (end == line) continue;
+
+            const char *comma = (const char*)memchr(line, ',', (size_t)(end - line));
+            KeyValue kv;
+            if (comma == nullptr) {
+                batch.errors.emplace_back(batch.rows.size(),
+                    "Invalid line format in load file: " + string(line, end) + "\n");
+            } else if (!parseLoadField(line, comma, kv.key) || !parseLoadField(comma + 1, end, kv.value)) {
+                batch.errors.emplace_back(batch.rows.size(),
+                    "Invalid integer in line: " + string(line, end) + "\n");
+            } else {
+                batch.rows.push_back(kv);
+            }
+        }
+    }
+
+    void work() {
+        Batch batch;
+        while (true) {
+            size_t k = nextPiece++;
+            if (k >= pieces) return;
+            {
+                // Wait for the slot of piece k to be free
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&] { return stopping || k < consumed + PARSE_QUEUE_BATCHES; });
+                if (stopping) return;
+            }
+            parsePiece(k, batch);
+            lock_guard<mutex> guard(lock);
+            Batch &slot = slots[k % PARSE_QUEUE_BATCHES];
+            swap(slot.rows, batch.rows);
+            swap(slot.errors, batch.errors);
+            slot.ready = true;
+            changed.notify_all();
+        }
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            changed.notify_all();
+        }
+        for (auto &w : workers) w.join();
+        workers.clear();
+    }
+
+public:
+    CsvReader() : data(nullptr), size(0), mapped(false), pieces(0), slots(PARSE_QUEUE_BATCHES),
+                  consumed(0), nextPiece(0), stopping(false) {}
+
+    ~CsvReader() {
+        stop();
+        if (mapped) munmap((void*)data, size);
+    }
+
+    // Open the input file and start parsing it with the given number of threads (0 for one
+    // per CPU); returns false if it cannot be read
+    bool open(const string &path, unsigned threads = 0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+        void *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            data = (const char*)map;
+            mapped = true;
+        } else {
+            // Not mappable (or empty): read it in large chunks instead
+            char chunk[1 << 16];
+            ssize_t n;
+            while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+                copy.insert(copy.end(), chunk, chunk + n);
+            }
+            data = copy.data();
+            size = copy.size();
+        }
+        ::close(fd);
+
+        pieces = (size + PARSE_PIECE_BYTES - 1) / PARSE_PIECE_BYTES;
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        threads = (unsigned)min<size_t>(threads, pieces);
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([this]() { work(); });
+        }
+        return true;
+    }
+
+    // Call onRow(key, value) for every valid line in file order, printing the errors of
+    // malformed lines in between
+    template <typename RowFn>
+    void forEach(RowFn onRow) {
+        Batch batch;
+        for (size_t k = 0; k < pieces; k++) {
+            {
+                unique_lock<mutex> guard(lock);
+                Batch &slot = slots[k % PARSE_QUEUE_BATCHES];
+                changed.wait(guard, [&] { return slot.ready; });
+                swap(slot.rows, batch.rows);
+                swap(slot.errors, batch.errors);
+                slot.ready = false;
+                consumed = k + 1;
+                changed.notify_all();
+            }
+            size_t e = 0;
+            for (size_t i = 0; i < batch.rows.size(); i++) {
+                for (; e < batch.errors.size() && batch.errors[e].first == i; e++) {
+                    cerr << batch.errors[e].second;
+                }
+                onRow(batch.rows[i].key, batch.rows[i].value);
+            }
+            for (; e < batch.errors.size(); e++) {
+                cerr << batch.errors[e].second;
+            }
+        }
+    }
+};
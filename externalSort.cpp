@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Number of key/value records the sorter keeps in memory before spilling a run (16 MiB)
+static const size_t DEFAULT_SORT_RECORDS = 1 << 20;
+// Records read or written per run file I/O call
+static const size_t RUN_IO_RECORDS = 4096;
+
+struct KeyValue {
+    uint64_t key;
+    uint64_t value;
+};
+
+// Sorts key/value pairs that may not fit in memory. Records are buffered, spilled to
+// sorted run files next to the index, and k-way merged with duplicate keys rejected.
+// For equal keys the record added first wins, so earlier sources take precedence.
+class ExternalSorter {
+private:
+    // Sequential buffered reader over one run file
+    struct RunReader {
+        ifstream in;
+        vector<KeyValue> buffer;
+        size_t pos = 0;
+
+        bool next(KeyValue &out) {
+            if (pos == buffer.size()) {
+                buffer.resize(RUN_IO_RECORDS);
+                in.read((char*)buffer.data(), RUN_IO_RECORDS * sizeof(KeyValue));
+                buffer.resize((size_t)in.gcount() / sizeof(KeyValue));
+                pos = 0;
+                if (buffer.empty()) return false;
+            }
+            out = buffer[pos++];
+            return true;
+        }
+    };
+
+    string tempPrefix;          // Prefix used for run file names
+    size_t memoryRecords;       // Records buffered before a spill
+    vector<KeyValue> records;   // Current in-memory run (or the merged result if nothing spilled)
+    vector<string> runFiles;    // Spilled run files, in the order they were written
+    string mergedFile;          // Merged output when runs were spilled
+    ifstream mergedIn;          // Reader over mergedFile
+    vector<KeyValue> readBuffer;
+    size_t readPos;
+    bool finished;
+
+    // Sort the buffered records (stable, so earlier additions stay first) and write them as a run
+    void spill() {
+        if (records.empty()) return;
+        stable_sort(records.begin(), records.end(),
+                    [](const KeyValue &a, const KeyValue &b) { return a.key < b.key; });
+        string name = tempPrefix + ".run" + to_string(runFiles.size());
+        ofstream out(name, ios::binary | ios::trunc);
+        if (!out.is_open()) {
+            throw runtime_error("Unable to create sort run file.");
+        }
+        out.write((const char*)records.data(), records.size() * sizeof(KeyValue));
+        if (!out) {
+            throw runtime_error("Unable to write sort run file.");
+        }
+        runFiles.push_back(name);
+        records.clear();
+    }
+
+    void removeTempFiles() {
+        for (auto &name : runFiles) remove(name.c_str());
+        runFiles.clear();
+        if (!mergedFile.empty()) {
+            if (mergedIn.is_open()) mergedIn.close();
+            remove(mergedFile.c_str());
+            mergedFile.clear();
+        }
+    }
+
+public:
+    ExternalSorter(const string &prefix, size_t memoryRecords = DEFAULT_SORT_RECORDS) {
+        tempPrefix = prefix;
+        this->memoryRecords = max<size_t>(memoryRecords, 1);
+        readPos = 0;
+        finished = false;
+    }
+
+    ~ExternalSorter() {
+        removeTempFiles();
+    }
+
+    // Add one record to be sorted
+    void add(uint64_t key, uint64_t value) {
+        records.push_back(KeyValue{key, value});
+        if (records.size() >= memoryRecords) {
+            spill();
+        }
+    }
+
+    // Sort and merge everything added so far. Records whose key was already emitted are
+    // passed to onDuplicate and dropped. Returns the number of unique records, which can
+    // then be read back in key order with next().
+    uint64_t finish(const function<void(const KeyValue&)> &onDuplicate) {
+        finished = true;
+        uint64_t unique = 0;
+
+        if (runFiles.empty()) {
+            // Everything fit in memory: sort and deduplicate in place
+            stable_sort(records.begin(), records.end(),
+                        [](const KeyValue &a, const KeyValue &b) { return a.key < b.key; });
+            size_t out = 0;
+            for (size_t i = 0; i < records.size(); i++) {
+                if (out > 0 && records[out-1].key == records[i].key) {
+                    onDuplicate(records[i]);
+                    continue;
+                }
+                records[out++] = records[i];
+            }
+            records.resize(out);
+            return out;
+        }
+
+        spill();
+        vector<KeyValue>().swap(records);
+
+        // K-way merge; ties go to the lower run index, i.e. the earlier record
+        vector<RunReader> readers(runFiles.size());
+        typedef pair<KeyValue, size_t> HeapEntry;
+        auto cmp = [](const HeapEntry &a, const HeapEntry &b) {
+            if (a.first.key != b.first.key) return a.first.key > b.first.key;
+            return a.second > b.second;
+        };
+        priority_queue<HeapEntry, vector<HeapEntry>, decltype(cmp)> heap(cmp);
+        for (size_t i = 0; i < runFiles.size(); i++) {
+            readers[i].in.open(runFiles[i], ios::binary);
+            if (!readers[i].in.is_open()) {
+                throw runtime_error("Unable to reopen sort run file.");
+            }
+            KeyValue kv;
+            if (readers[i].next(kv)) heap.push(HeapEntry(kv, i));
+        }
+
+        mergedFile = tempPrefix + ".merged";
+        ofstream out(mergedFile, ios::binary | ios::trunc);
+        if (!out.is_open()) {
+            throw runtime_error("Unable to create merged sort file.");
+        }
+        vector<KeyValue> outBuffer;
+        outBuffer.reserve(RUN_IO_RECORDS);
+        bool haveLast = false;
+        uint64_t lastKey = 0;
+        while (!heap.empty()) {
+            HeapEntry top = heap.top();
+            heap.pop();
+            KeyValue kv;
+            if (readers[top.second].next(kv)) heap.push(HeapEntry(kv, top.second));
+
+            if (haveLast && top.first.key == lastKey) {
+                onDuplicate(top.first);
+                continue;
+            }
+            haveLast = true;
+            lastKey = top.first.key;
+            unique++;
+            outBuffer.push_back(top.first);
+            if (outBuffer.size() == RUN_IO_RECORDS) {
+                out.write((const char*)outBuffer.data(), outBuffer.size() * sizeof(KeyValue));
+                outBuffer.clear();
+            }
+        }
+        out.write((const char*)outBuffer.data(), outBuffer.size() * sizeof(KeyValue));
+        out.close();
+        if (!out) {
+            throw runtime_error("Unable to write merged sort file.");
+        }
+
+        // The individual runs are no longer needed
+        readers.clear();
+        for (auto &name : runFiles) remove(name.c_str());
+        runFiles.clear();
+
+        mergedIn.open(mergedFile, ios::binary);
+        if (!mergedIn.is_open()) {
+            throw runtime_error("Unable to reopen merged sort file.");
+        }
+        return unique;
+    }
+
+    // Read the next record of the sorted, deduplicated output
+    bool next(KeyValue &out) {
+        if (!finished) {
+            throw runtime_error("ExternalSorter::next called before finish.");
+        }
+        if (mergedFile.empty()) {
+            if (readPos == records.size()) return false;
+            out = records[readPos++];
+            return true;
+        }
+        if (readPos == readBuffer.size()) {
+            readBuffer.resize(RUN_IO_RECORDS);
+            mergedIn.read((char*)readBuffer.data(), RUN_IO_RECORDS * sizeof(KeyValue));
+            readBuffer.resize((size_t)mergedIn.gcount() / sizeof(KeyValue));
+            readPos = 0;
+            if (readBuffer.empty()) return false;
+        }
+        out = readBuffer[readPos++];
+        return true;
+    }
+};
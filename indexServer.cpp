@@ -0,0 +1,691 @@
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Request opcodes of the server protocol
+static const uint8_t REQUEST_GET = 1;       // key -> value
+static const uint8_t REQUEST_PUT = 2;       // key, value
+static const uint8_t REQUEST_DELETE = 3;    // key
+static const uint8_t REQUEST_MULTIGET = 4;  // count, count keys -> count, count (found, value)
+static const uint8_t REQUEST_RANGE = 5;     // low, high, limit -> count, count (key, value)
+
+// Response status codes
+static const uint8_t STATUS_OK = 0;
+static const uint8_t STATUS_NOT_FOUND = 1;  // GET/DELETE of a missing key
+static const uint8_t STATUS_EXISTS = 2;     // PUT of a key that is already present
+static const uint8_t STATUS_BAD_REQUEST = 3;
+static const uint8_t STATUS_ERROR = 4;      // The index could not carry out the request
+
+// Largest request frame accepted (1 MiB); a longer frame closes the connection
+static const uint32_t SERVER_MAX_FRAME = 1 << 20;
+// Most keys in one MULTIGET and most entries returned by one RANGE
+static const uint32_t SERVER_MAX_ITEMS = 65536;
+// Unsent responses and unserved requests per connection before the server stops reading
+// from it (16 MiB)
+static const size_t SERVER_CONNECTION_BUFFER = 16 << 20;
+
+inline uint32_t loadBig32(const char *p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return ntohl(x);
+}
+
+inline uint64_t loadBig64(const char *p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return bigToHost(x);
+}
+
+inline void appendBig32(string &out, uint32_t x) {
+    x = htonl(x);
+    out.append((const char*)&x, 4);
+}
+
+inline void appendBig64(string &out, uint64_t x) {
+    x = hostToBig(x);
+    out.append((const char*)&x, 8);
+}
+
+// Serves one open index over a Unix domain socket.
+//
+// Every message is a frame: a 32-bit length counting the bytes that follow, a 32-bit
+// request ID echoed in the response, then an opcode (requests) or status (responses)
+// byte and the payload. All integers are big-endian. Clients may pipeline any number of
+// requests; each connection's responses come back in request order.
+//
+// One thread runs an epoll loop that owns all socket I/O. Complete frames are handed to
+// a pool of workers, one batch per connection at a time, so a connection's requests run
+// in order while different connections run in parallel. Reads answer at once. Writes
+// are applied straight away but not acknowledged until a commit makes them durable:
+// a commit thread commits whatever writes have accumulated since its last commit, so
+// writes from many clients share one commit (and one fsync of the write-ahead log).
+// Responses queued behind an unacknowledged write wait for it, keeping the order.
+class IndexServer {
+private:
+    struct Connection {
+        int fd;
+        uint32_t events;            // epoll events currently requested (event loop only)
+        string in;                  // Bytes of an incomplete frame (event loop only)
+        bool readClosed;            // Peer finished sending (event loop only)
+        bool closed;                // Socket closed; late responses are dropped
+
+        mutex lock;                 // Guards everything below
+        string requests;            // Complete frames waiting for a worker
+        bool scheduled;             // Queued for or being served by a worker
+        string out;                 // Responses ready to send
+        string held;                // Responses waiting for a commit, in order
+        deque<pair<uint64_t, size_t>> heldEnds; // (commit needed, end offset in held)
+
+        bool flushQueued;           // In flushList (guarded by IndexServer::flushLock)
+        bool awaitingCommit;        // In committed (guarded by IndexServer::commitLock)
+
+        Connection(int fd) : fd(fd), events(0), readClosed(false), closed(false),
+                             scheduled(false), flushQueued(false), awaitingCommit(false) {}
+
+        // Move the held responses whose commit has completed to out
+        void release(uint64_t durable) {
+            size_t end = 0;
+            while (!heldEnds.empty() && heldEnds.front().first <= durable) {
+                end = heldEnds.front().second;
+                heldEnds.pop_front();
+            }
+            if (end == 0) return;
+            out.append(held, 0, end);
+            held.erase(0, end);
+            for (auto &h : heldEnds) h.second -= end;
+        }
+    };
+
+    BTree &btree;
+    unsigned threadCount;
+    int listenFd;
+    int epollFd;
+    int wakeFd;                     // eventfd telling the event loop to flush connections
+    int signalFd;                   // SIGINT/SIGTERM stop the server
+    atomic<bool> stopping;
+    map<int, shared_ptr<Connection>> connections;
+
+    shared_mutex scanLatch;         // Held shared by writes, exclusively by RANGE (in-place mode)
+
+    mutex queueLock;                // Connections with requests for the workers
+    condition_variable queueChanged;
+    deque<shared_ptr<Connection>> queue;
+    vector<thread> workers;
+
+    mutex flushLock;                // Connections with new responses for the event loop
+    vector<shared_ptr<Connection>> flushList;
+
+    mutex commitLock;               // Group commit state
+    condition_variable commitChanged;
+    uint64_t startedCommits;        // Commits begun so far
+    uint64_t durableCommits;        // Commits completed so far
+    uint64_t uncommittedWrites;     // Writes applied since the last commit began
+    vector<shared_ptr<Connection>> committed; // Connections holding responses for a commit
+    thread committer;
+
+    // Ask the event loop to send a connection's new responses
+    void wakeLoop(const shared_ptr<Connection> &conn) {
+        {
+            lock_guard<mutex> guard(flushLock);
+            if (conn->flushQueued) return;
+            conn->flushQueued = true;
+            flushList.push_back(conn);
+        }
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    // Count an applied write; returns the commit that will make it durable
+    uint64_t noteWrite() {
+        lock_guard<mutex> guard(commitLock);
+        uncommittedWrites++;
+        commitChanged.notify_one();
+        return startedCommits + 1;
+    }
+
+    // Queue responses for a connection; commit is the commit they must wait for (0 for none)
+    void respond(const shared_ptr<Connection> &conn, const string &replies, uint64_t commit) {
+        if (replies.empty()) return;
+        lock_guard<mutex> guard(conn->lock);
+        if (commit != 0) {
+            lock_guard<mutex> state(commitLock);
+            if (commit <= durableCommits) {
+                commit = 0;
+            } else if (!conn->awaitingCommit) {
+                conn->awaitingCommit = true;
+                committed.push_back(conn);
+            }
+        }
+        if (commit == 0 && conn->heldEnds.empty()) {
+            conn->out += replies;
+            return;
+        }
+        if (!conn->heldEnds.empty()) {
+            commit = max(commit, conn->heldEnds.back().first);
+        }
+        conn->held += replies;
+        if (!conn->heldEnds.empty() && conn->heldEnds.back().first == commit) {
+            conn->heldEnds.back().second = conn->held.size();
+        } else {
+            conn->heldEnds.emplace_back(commit, conn->held.size());
+        }
+    }
+
+    // Start a response: length placeholder, request ID and status
+    static size_t beginReply(string &out, uint32_t id, uint8_t status) {
+        size_t start = out.size();
+        appendBig32(out, 0);
+        appendBig32(out, id);
+        out.push_back((char)status);
+        return start;
+    }
+
+    static void endReply(string &out, size_t start) {
+        uint32_t length = htonl((uint32_t)(out.size() - start - 4));
+        memcpy(&out[start], &length, 4);
+    }
+
+    // Carry out one request, appending its response to out; returns true if it changed the index
+    bool execute(uint32_t id, uint8_t op, const char *p, size_t n, string &out,
+                 vector<uint64_t> &keys, vector<uint64_t> &values, vector<bool> &found) {
+        if (op == REQUEST_GET && n == 8) {
+            uint64_t value;
+            if (btree.search(loadBig64(p), value)) {
+                size_t start = beginReply(out, id, STATUS_OK);
+                appendBig64(out, value);
+                endReply(out, start);
+            } else {
+                endReply(out, beginReply(out, id, STATUS_NOT_FOUND));
+            }
+            return false;
+        }
+        if (op == REQUEST_PUT && n == 16) {
+            bool inserted;
+            {
+                shared_lock<shared_mutex> guard(scanLatch);
+                inserted = btree.insert(loadBig64(p), loadBig64(p + 8));
+            }
+            endReply(out, beginReply(out, id, inserted ? STATUS_OK : STATUS_EXISTS));
+            return inserted;
+        }
+        if (op == REQUEST_DELETE && n == 8) {
+            bool erased;
+            {
+                shared_lock<shared_mutex> guard(scanLatch);
+                erased = btree.erase(loadBig64(p));
+            }
+            endReply(out, beginReply(out, id, erased ? STATUS_OK : STATUS_NOT_FOUND));
+            return erased;
+        }
+        if (op == REQUEST_MULTIGET && n >= 4) {
+            uint32_t count = loadBig32(p);
+            if (count <= SERVER_MAX_ITEMS && n == 4 + (size_t)count * 8) {
+                keys.resize(count);
+                for (uint32_t i = 0; i < count; i++) keys[i] = loadBig64(p + 4 + i * 8);
+                btree.multiGet(keys, values, found);
+                size_t start = beginReply(out, id, STATUS_OK);
+                appendBig32(out, count);
+                for (uint32_t i = 0; i < count; i++) {
+                    out.push_back(found[i] ? 1 : 0);
+                    appendBig64(out, found[i] ? values[i] : 0);
+                }
+                endReply(out, start);
+                return false;
+            }
+        }
+        if (op == REQUEST_RANGE && n == 20) {
+            uint64_t low = loadBig64(p), high = loadBig64(p + 8);
+            uint32_t limit = loadBig32(p + 16);
+            if (limit == 0 || limit > SERVER_MAX_ITEMS) limit = SERVER_MAX_ITEMS;
+            size_t start = beginReply(out, id, STATUS_OK);
+            size_t countAt = out.size();
+            appendBig32(out, 0);
+            uint32_t count = 0;
+            {
+                // Cursors expect no concurrent writers, unless they read a snapshot
+                unique_ptr<BTree::Snapshot> snapshot;
+                unique_lock<shared_mutex> guard(scanLatch, defer_lock);
+                if (btree.copyOnWriteEnabled()) {
+                    snapshot.reset(new BTree::Snapshot(btree.snapshot()));
+                } else {
+                    guard.lock();
+                }
+                BTree::Cursor cursor = snapshot ? snapshot->cursor() : btree.cursor();
+                if (low <= high && cursor.seek(low)) {
+                    while (count < limit && cursor.key() <= high) {
+                        appendBig64(out, cursor.key());
+                        appendBig64(out, cursor.value());
+                        count++;
+                        if (!cursor.next()) break;
+                    }
+                }
+            }
+            uint32_t big = htonl(count);
+            memcpy(&out[countAt], &big, 4);
+            endReply(out, start);
+            return false;
+        }
+        endReply(out, beginReply(out, id, STATUS_BAD_REQUEST));
+        return false;
+    }
+
+    // Run a batch of complete frames from one connection in order
+    void serveFrames(const shared_ptr<Connection> &conn, const string &frames, string &replies,
+                     vector<uint64_t> &keys, vector<uint64_t> &values, vector<bool> &found) {
+        // Responses are handed over in runs that wait for the same commit
+        uint64_t repliesCommit = 0;
+        size_t pos = 0;
+        while (pos < frames.size()) {
+            uint32_t length = loadBig32(frames.data() + pos);
+            const char *body = frames.data() + pos + 4;
+            pos += 4 + (size_t)length;
+            uint32_t id = loadBig32(body);
+            uint8_t op = (uint8_t)body[4];
+
+            size_t start = replies.size();
+            bool changed = false;
+            try {
+                changed = execute(id, op, body + 5, length - 5, replies, keys, values, found);
+            } catch (runtime_error &e) {
+                cerr << "Error: " << e.what() << "\n";
+                replies.resize(start);
+                endReply(replies, beginReply(replies, id, STATUS_ERROR));
+            }
+            if (changed) {
+                uint64_t commit = noteWrite();
+                if (commit != repliesCommit) {
+                    string reply = replies.substr(start);
+                    replies.resize(start);
+                    respond(conn, replies, repliesCommit);
+                    replies = move(reply);
+                    repliesCommit = commit;
+                }
+            }
+        }
+        respond(conn, replies, repliesCommit);
+        replies.clear();
+    }
+
+    void work() {
+        string frames, replies;
+        vector<uint64_t> keys, values;
+        vector<bool> found;
+        while (true) {
+            shared_ptr<Connection> conn;
+            {
+                unique_lock<mutex> guard(queueLock);
+                queueChanged.wait(guard, [&] { return stopping || !queue.empty(); });
+                if (stopping) return;
+                conn = move(queue.front());
+                queue.pop_front();
+            }
+            while (true) {
+                {
+                    lock_guard<mutex> guard(conn->lock);
+                    if (conn->requests.empty()) {
+                        conn->scheduled = false;
+                        break;
+                    }
+                    frames.clear();
+                    swap(frames, conn->requests);
+                }
+                serveFrames(conn, frames, replies, keys, values, found);
+                wakeLoop(conn);
+            }
+            wakeLoop(conn);
+        }
+    }
+
+    // Commit writes as they accumulate and release the responses that waited for them
+    void commitLoop() {
+        while (true) {
+            uint64_t commit;
+            {
+                unique_lock<mutex> guard(commitLock);
+                commitChanged.wait(guard, [&] { return stopping || uncommittedWrites > 0; });
+                if (uncommittedWrites == 0) return;
+                commit = ++startedCommits;
+                uncommittedWrites = 0;
+            }
+            try {
+                btree.sync();
+            } catch (runtime_error &e) {
+                // Writes that cannot be made durable are never acknowledged
+                cerr << "Error: " << e.what() << "\n";
+                stop();
+                return;
+            }
+            vector<shared_ptr<Connection>> waiting;
+            {
+                lock_guard<mutex> guard(commitLock);
+                durableCommits = commit;
+                swap(waiting, committed);
+                for (auto &conn : waiting) conn->awaitingCommit = false;
+            }
+            for (auto &conn : waiting) {
+                {
+                    lock_guard<mutex> guard(conn->lock);
+                    conn->release(commit);
+                    if (!conn->heldEnds.empty()) {
+                        lock_guard<mutex> state(commitLock);
+                        if (!conn->awaitingCommit) {
+                            conn->awaitingCommit = true;
+                            committed.push_back(conn);
+                        }
+                    }
+                }
+                wakeLoop(conn);
+            }
+        }
+    }
+
+    void stop() {
+        stopping = true;
+        {
+            lock_guard<mutex> guard(queueLock);
+            queueChanged.notify_all();
+        }
+        {
+            lock_guard<mutex> guard(commitLock);
+            commitChanged.notify_all();
+        }
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void watch(Connection &conn, uint32_t events) {
+        if (conn.events == events) return;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = conn.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.events = events;
+    }
+
+    void closeConnection(const shared_ptr<Connection> &conn) {
+        if (conn->closed) return;
+        conn->closed = true;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+        connections.erase(conn->fd);
+    }
+
+    // Send what is ready, then decide whether to keep reading from the connection
+    void flush(const shared_ptr<Connection> &conn) {
+        if (conn->closed) return;
+        bool failed = false, idle;
+        size_t buffered;
+        {
+            lock_guard<mutex> guard(conn->lock);
+            size_t sent = 0;
+            while (sent < conn->out.size()) {
+                ssize_t n = ::send(conn->fd, conn->out.data() + sent, conn->out.size() - sent, MSG_NOSIGNAL);
+                if (n > 0) {
+                    sent += (size_t)n;
+                } else if (n < 0 && errno == EINTR) {
+                    continue;
+                } else {
+                    failed = n < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+                    break;
+                }
+            }
+            conn->out.erase(0, sent);
+            buffered = conn->out.size() + conn->held.size() + conn->requests.size();
+            idle = !conn->scheduled && buffered == 0;
+        }
+        if (failed || (conn->readClosed && idle)) {
+            closeConnection(conn);
+            return;
+        }
+        uint32_t events = 0;
+        if (!conn->readClosed && buffered + conn->in.size() < SERVER_CONNECTION_BUFFER) events |= EPOLLIN;
+        {
+            lock_guard<mutex> guard(conn->lock);
+            if (!conn->out.empty()) events |= EPOLLOUT;
+        }
+        watch(*conn, events);
+    }
+
+    // Read what the peer sent and hand complete frames to the workers
+    void receive(const shared_ptr<Connection> &conn) {
+        char chunk[1 << 16];
+        size_t got = 0;
+        while (got < SERVER_CONNECTION_BUFFER / 4) {
+            ssize_t n = ::read(conn->fd, chunk, sizeof(chunk));
+            if (n > 0) {
+                conn->in.append(chunk, (size_t)n);
+                got += (size_t)n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (n == 0) {
+                    conn->readClosed = true;
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    closeConnection(conn);
+                    return;
+                }
+                break;
+            }
+        }
+
+        size_t complete = 0;
+        while (conn->in.size() - complete >= 4) {
+            uint32_t length = loadBig32(conn->in.data() + complete);
+            if (length < 5 || length > SERVER_MAX_FRAME) {
+                cerr << "Error: Malformed request frame, closing connection.\n";
+                closeConnection(conn);
+                return;
+            }
+            if (conn->in.size() - complete < 4 + (size_t)length) break;
+            complete += 4 + (size_t)length;
+        }
+        if (complete > 0) {
+            bool schedule;
+            {
+                lock_guard<mutex> guard(conn->lock);
+                conn->requests.append(conn->in, 0, complete);
+                schedule = !conn->scheduled;
+                conn->scheduled = true;
+            }
+            conn->in.erase(0, complete);
+            if (schedule) {
+                lock_guard<mutex> guard(queueLock);
+                queue.push_back(conn);
+                queueChanged.notify_one();
+            }
+        }
+        flush(conn);
+    }
+
+    void accept() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            auto conn = make_shared<Connection>(fd);
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                ::close(fd);
+                continue;
+            }
+            conn->events = EPOLLIN;
+            connections[fd] = conn;
+        }
+    }
+
+    void addWatch(int fd) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            throw runtime_error("Unable to set up the server event loop.");
+        }
+    }
+
+    void eventLoop() {
+        struct epoll_event events[64];
+        while (!stopping) {
+            int n = epoll_wait(epollFd, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error("Server event loop failed.");
+            }
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    accept();
+                } else if (fd == signalFd) {
+                    struct signalfd_siginfo info;
+                    ssize_t ignored = ::read(signalFd, &info, sizeof(info));
+                    (void)ignored;
+                    stop();
+                } else if (fd == wakeFd) {
+                    uint64_t count;
+                    ssize_t ignored = ::read(wakeFd, &count, sizeof(count));
+                    (void)ignored;
+                    vector<shared_ptr<Connection>> ready;
+                    {
+                        lock_guard<mutex> guard(flushLock);
+                        swap(ready, flushList);
+                        for (auto &conn : ready) conn->flushQueued = false;
+                    }
+                    for (auto &conn : ready) flush(conn);
+                } else {
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) continue;
+                    shared_ptr<Connection> conn = it->second;
+                    if (events[i].events & EPOLLIN) {
+                        receive(conn);
+                    } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        closeConnection(conn);
+                    } else if (events[i].events & EPOLLOUT) {
+                        flush(conn);
+                    }
+                }
+            }
+        }
+    }
+
+    // Stop the threads, commit the last writes and send the responses they release
+    void shutdown(const string &socketPath, const sigset_t &oldMask) {
+        for (auto &w : workers) w.join();
+        workers.clear();
+        if (committer.joinable()) committer.join();
+        for (auto &entry : vector<pair<int, shared_ptr<Connection>>>(connections.begin(), connections.end())) {
+            flush(entry.second);
+            closeConnection(entry.second);
+        }
+        connections.clear();
+        if (listenFd >= 0) ::close(listenFd);
+        if (epollFd >= 0) ::close(epollFd);
+        if (wakeFd >= 0) ::close(wakeFd);
+        if (signalFd >= 0) ::close(signalFd);
+        listenFd = epollFd = wakeFd = signalFd = -1;
+        unlink(socketPath.c_str());
+        pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+    }
+
+public:
+    // Serve btree, which must have an index open, with the given number of worker threads
+    // (0 for one per CPU)
+    IndexServer(BTree &btree, unsigned threads = 0)
+        : btree(btree), listenFd(-1), epollFd(-1), wakeFd(-1), signalFd(-1), stopping(false),
+          startedCommits(0), durableCommits(0), uncommittedWrites(0) {
+        threadCount = threads == 0 ? max(1u, thread::hardware_concurrency()) : threads;
+    }
+
+    // Listen on socketPath and serve until SIGINT or SIGTERM; committed writes are durable
+    // when this returns. Throws runtime_error if the socket cannot be set up.
+    void run(const string &socketPath) {
+        if (!btree.isOpen()) {
+            throw runtime_error("No index file is open.");
+        }
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path)) {
+            throw runtime_error("Invalid socket path.");
+        }
+        memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+
+        // Replace a socket left behind by an earlier server, but nothing else
+        struct stat st;
+        if (lstat(socketPath.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                throw runtime_error("Socket path exists and is not a socket.");
+            }
+            unlink(socketPath.c_str());
+        }
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 128) != 0) {
+            if (listenFd >= 0) ::close(listenFd);
+            throw runtime_error("Unable to listen on " + socketPath + ".");
+        }
+
+        // Deliver SIGINT/SIGTERM through the event loop (the mask is inherited by the threads)
+        sigset_t stopSignals, oldMask;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signalFd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+        try {
+            if (epollFd < 0 || wakeFd < 0 || signalFd < 0) {
+                throw runtime_error("Unable to set up the server event loop.");
+            }
+            addWatch(listenFd);
+            addWatch(wakeFd);
+            addWatch(signalFd);
+
+            for (unsigned t = 0; t < threadCount; t++) {
+                workers.emplace_back([this]() { work(); });
+            }
+            committer = thread([this]() { commitLoop(); });
+            cout << "Serving on " << socketPath << " with " << threadCount << " worker threads.\n";
+            cout.flush();
+            eventLoop();
+        } catch (...) {
+            stop();
+            shutdown(socketPath, oldMask);
+            throw;
+        }
+        shutdown(socketPath, oldMask);
+        cout << "Server stopped.\n";
+    }
+};
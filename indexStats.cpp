@@ -0,0 +1,239 @@
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Levels tracked separately by per-level statistics; deeper levels share the last slot
+static const int STATS_LEVELS = 16;
+// Buckets of the node fill distribution, each 1/FILL_BUCKETS of a node wide
+static const int FILL_BUCKETS = 10;
+// Problems verify describes one by one; any more are only counted
+static const size_t VERIFY_MAX_PROBLEMS = 20;
+
+// Percentiles of one latency histogram, in nanoseconds
+struct LatencySummary {
+    uint64_t count, p50, p99, p999, max;
+
+    static LatencySummary of(const LatencyHistogram &h) {
+        return LatencySummary{h.count(), h.percentile(0.50), h.percentile(0.99), h.percentile(0.999), h.max()};
+    }
+};
+
+// What an index has done since it was created, opened or last reset
+struct IndexStats {
+    uint64_t nodeLoads, nodeLoadBytes;     // Nodes decoded by loadNode
+    uint64_t nodeSaves, nodeSaveBytes;     // Nodes encoded by saveNode
+    uint64_t blockReads, blockWrites;      // Blocks the buffer pool read and wrote back
+    uint64_t blockPrefetches;              // Blocks of blockReads that were read ahead
+    uint64_t commits;                      // Commit points (flushes of dirty blocks)
+    uint64_t fsyncs;                       // fsync/fdatasync/msync calls by the storage
+    uint64_t blocksAppended;               // Blocks allocated by growing the file
+    uint64_t blocksReused;                 // Blocks allocated from the free list
+    uint64_t blocksFreed;                  // Blocks put on the free list
+    uint64_t splits[STATS_LEVELS];         // Node splits by depth of the node (0 = root)
+    uint64_t searchDepths[STATS_LEVELS];   // Searches by nodes visited (index 0 = 1 node)
+    uint64_t bloomChecks;                  // Lookups, updates and deletes the Bloom filter was asked about
+    uint64_t bloomSkips;                   // Of those, the ones it ruled out without a descent
+    uint64_t bloomFalsePositives;          // Of those, the ones it let through for a missing key
+    uint64_t bloomBytes, bloomKeys, bloomLayers; // Size of the filter, all 0 when it is off
+    double bloomTargetRate, bloomEstimatedRate;  // Configured and current false-positive rate
+    bool copyOnWrite;                      // Copy-on-write update mode
+    uint64_t blocksCopied;                 // Published nodes copied to a new block before a change
+    uint64_t version;                      // Version new snapshots see, 0 in in-place mode
+    uint64_t snapshotsOpen;                // Snapshots not yet closed
+    uint64_t blocksRetired;                // Replaced blocks an open snapshot may still read
+    LatencySummary search, insert, erase, commit;
+};
+
+// Shape of the tree, found by walking every node
+struct TreeShape {
+    uint64_t height;                       // Levels, 0 for an empty tree
+    uint64_t internalNodes, leafNodes;
+    uint64_t keys;
+    uint64_t fileBlocks;                   // Blocks in the file, the header excluded
+    uint64_t freeBlocks;                   // Blocks on the free list
+    uint64_t internalFill[FILL_BUCKETS];   // Internal nodes by how full they are
+    uint64_t leafFill[FILL_BUCKETS];       // Leaves by how full they are
+    double averageInternalFill, averageLeafFill;
+};
+
+// What verify found by reading every block of an index file
+struct VerifyReport {
+    bool checksums;                        // The file's blocks carry checksums
+    uint64_t blocks, bytes;                // Blocks scanned (the header excluded) and bytes read
+    double seconds;                        // Time the whole check took
+    uint64_t height;                       // Levels of the tree, 0 for an empty tree
+    uint64_t internalNodes, leafNodes;     // Nodes the tree reaches
+    uint64_t keys;                         // Keys in those nodes
+    uint64_t freeBlocks;                   // Blocks on the free list
+    uint64_t unreachableBlocks;            // Blocks neither the tree nor the free list reaches
+    uint64_t checksumErrors;               // Blocks whose checksum does not match
+    uint64_t structureErrors;              // Other problems: bad blocks, key order, links
+    vector<string> problems;               // The first VERIFY_MAX_PROBLEMS problems found
+
+    VerifyReport() : checksums(false), blocks(0), bytes(0), seconds(0), height(0), internalNodes(0),
+                     leafNodes(0), keys(0), freeBlocks(0), unreachableBlocks(0), checksumErrors(0),
+                     structureErrors(0) {}
+
+    bool ok() const {
+        return checksumErrors == 0 && structureErrors == 0;
+    }
+
+    // Describe a problem, unless enough have been described already
+    void note(const string &problem) {
+        if (problems.size() < VERIFY_MAX_PROBLEMS) problems.push_back(problem);
+    }
+};
+
+// Live counters behind IndexStats, updated on the hot paths with relaxed atomics so that
+// concurrent operations only pay for an uncontended add
+struct IndexCounters {
+    atomic<uint64_t> nodeLoads, nodeSaves;
+    atomic<uint64_t> commits;
+    atomic<uint64_t> blocksAppended, blocksReused, blocksFreed, blocksCopied;
+    atomic<uint64_t> splits[STATS_LEVELS];
+    atomic<uint64_t> searchDepths[STATS_LEVELS];
+    atomic<uint64_t> bloomChecks, bloomSkips, bloomFalsePositives;
+    LatencyHistogram search, insert, erase, commit;
+
+    IndexCounters() {
+        reset();
+    }
+
+    static void add(atomic<uint64_t> &counter) {
+        counter.fetch_add(1, memory_order_relaxed);
+    }
+
+    static void addAtLevel(atomic<uint64_t> *counters, int level) {
+        add(counters[level < STATS_LEVELS ? level : STATS_LEVELS - 1]);
+    }
+
+    // Zero everything (operations running meanwhile may or may not be counted)
+    void reset() {
+        nodeLoads = nodeSaves = commits = 0;
+        blocksAppended = blocksReused = blocksFreed = blocksCopied = 0;
+        bloomChecks = bloomSkips = bloomFalsePositives = 0;
+        for (int i = 0; i < STATS_LEVELS; i++) {
+            splits[i] = 0;
+            searchDepths[i] = 0;
+        }
+        search.reset();
+        insert.reset();
+        erase.reset();
+        commit.reset();
+    }
+
+    // Fill the counter part of stats (block I/O, fsyncs, the filter's size and the versions
+    // are counted elsewhere)
+    void snapshot(IndexStats &stats, size_t blockSize) const {
+        stats.nodeLoads = nodeLoads.load(memory_order_relaxed);
+        stats.nodeLoadBytes = stats.nodeLoads * blockSize;
+        stats.nodeSaves = nodeSaves.load(memory_order_relaxed);
+        stats.nodeSaveBytes = stats.nodeSaves * blockSize;
+        stats.commits = commits.load(memory_order_relaxed);
+        stats.blocksAppended = blocksAppended.load(memory_order_relaxed);
+        stats.blocksReused = blocksReused.load(memory_order_relaxed);
+        stats.blocksFreed = blocksFreed.load(memory_order_relaxed);
+        stats.blocksCopied = blocksCopied.load(memory_order_relaxed);
+        for (int i = 0; i < STATS_LEVELS; i++) {
+            stats.splits[i] = splits[i].load(memory_order_relaxed);
+            stats.searchDepths[i] = searchDepths[i].load(memory_order_relaxed);
+        }
+        stats.bloomChecks = bloomChecks.load(memory_order_relaxed);
+        stats.bloomSkips = bloomSkips.load(memory_order_relaxed);
+        stats.bloomFalsePositives = bloomFalsePositives.load(memory_order_relaxed);
+        stats.search = LatencySummary::of(search);
+        stats.insert = LatencySummary::of(insert);
+        stats.erase = LatencySummary::of(erase);
+        stats.commit = LatencySummary::of(commit);
+    }
+};
+
+// Print "<label>: 0:n 1:n ..." for the non-zero entries of a per-level array
+static void printLevels(ostream &out, const char *label, const uint64_t *counts, int offset) {
+    out << label << ":";
+    bool any = false;
+    for (int i = 0; i < STATS_LEVELS; i++) {
+        if (counts[i] == 0) continue;
+        out << " " << (i + offset) << (i == STATS_LEVELS - 1 ? "+" : "") << ":" << counts[i];
+        any = true;
+    }
+    out << (any ? "\n" : " none\n");
+}
+
+static void printLatency(ostream &out, const char *label, const LatencySummary &l) {
+    out << label << ": count=" << l.count << " p50=" << l.p50 << "ns p99=" << l.p99
+        << "ns p999=" << l.p999 << "ns max=" << l.max << "ns\n";
+}
+
+static void printFill(ostream &out, const char *label, const uint64_t *buckets, double average) {
+    out << label << ":";
+    for (int b = 0; b < FILL_BUCKETS; b++) {
+        out << " " << b * 100 / FILL_BUCKETS << "-" << (b + 1) * 100 / FILL_BUCKETS << "%:" << buckets[b];
+    }
+    out << " (average " << (int)(average * 100 + 0.5) << "%)\n";
+}
+
+// Print the statistics the stats command shows
+static void printIndexStats(ostream &out, const IndexStats &s, const TreeShape &shape) {
+    out << "Operations since the index was opened or the statistics were reset:\n";
+    out << "  node loads: " << s.nodeLoads << " (" << s.nodeLoadBytes << " bytes)\n";
+    out << "  node saves: " << s.nodeSaves << " (" << s.nodeSaveBytes << " bytes)\n";
+    out << "  block reads: " << s.blockReads << " (" << s.blockPrefetches << " read ahead), block writes: "
+        << s.blockWrites << "\n";
+    out << "  commits: " << s.commits << ", fsyncs: " << s.fsyncs << "\n";
+    out << "  blocks appended: " << s.blocksAppended << ", reused: " << s.blocksReused
+        << ", freed: " << s.blocksFreed << "\n";
+    if (s.bloomLayers == 0) {
+        out << "  bloom filter: off\n";
+    } else {
+        out << "  bloom filter: " << s.bloomBytes << " bytes in " << s.bloomLayers << " layer"
+            << (s.bloomLayers == 1 ? "" : "s") << ", " << s.bloomKeys << " keys, target fpr "
+            << s.bloomTargetRate * 100 << "%, estimated " << s.bloomEstimatedRate * 100 << "%\n";
+        out << "  bloom checks: " << s.bloomChecks << ", skipped descents: " << s.bloomSkips
+            << ", false positives: " << s.bloomFalsePositives << "\n";
+    }
+    if (!s.copyOnWrite) {
+        out << "  copy-on-write: off\n";
+    } else {
+        out << "  copy-on-write: version " << s.version << ", blocks copied: " << s.blocksCopied
+            << ", snapshots open: " << s.snapshotsOpen << ", blocks waiting for reclamation: "
+            << s.blocksRetired << "\n";
+    }
+    printLevels(out, "  splits by depth", s.splits, 0);
+    printLevels(out, "  searches by nodes visited", s.searchDepths, 1);
+    printLatency(out, "  search latency", s.search);
+    printLatency(out, "  insert latency", s.insert);
+    printLatency(out, "  delete latency", s.erase);
+    printLatency(out, "  commit latency", s.commit);
+    out << "Tree shape:\n";
+    out << "  height: " << shape.height << ", keys: " << shape.keys << "\n";
+    out << "  internal nodes: " << shape.internalNodes << ", leaves: " << shape.leafNodes << "\n";
+    out << "  file blocks: " << shape.fileBlocks << ", free blocks: " << shape.freeBlocks << "\n";
+    printFill(out, "  internal fill", shape.internalFill, shape.averageInternalFill);
+    printFill(out, "  leaf fill", shape.leafFill, shape.averageLeafFill);
+}
+
+// Print the result the verify command shows
+static void printVerifyReport(ostream &out, const VerifyReport &r) {
+    double megabytes = (double)r.bytes / (1 << 20);
+    out << "Scanned " << r.blocks << " blocks (" << megabytes << " MiB) in " << r.seconds << " s";
+    if (r.seconds > 0) out << ", " << megabytes / r.seconds << " MiB/s";
+    out << ", checksums " << (r.checksums ? "on" : "off (compact adds them)") << "\n";
+    out << "  height: " << r.height << ", internal nodes: " << r.internalNodes << ", leaves: "
+        << r.leafNodes << ", keys: " << r.keys << "\n";
+    out << "  free blocks: " << r.freeBlocks << ", unreachable blocks: " << r.unreachableBlocks;
+    out << (r.unreachableBlocks > 0 ? " (compact reclaims them)\n" : "\n");
+    out << "  checksum errors: " << r.checksumErrors << ", structure errors: " << r.structureErrors << "\n";
+    for (const string &problem : r.problems) {
+        out << "  " << problem << "\n";
+    }
+    uint64_t described = r.problems.size();
+    if (r.checksumErrors + r.structureErrors > described) {
+        out << "  ... and " << r.checksumErrors + r.structureErrors - described << " more\n";
+    }
+    out << (r.ok() ? "Index is consistent.\n" : "Index is damaged.\n");
+}
@@ -0,0 +1,90 @@
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_SEARCH_X86 1
+#endif
+
+// Nodes with more keys than this are narrowed by binary search before the kernel counts
+static const int LINEAR_SEARCH_KEYS = 32;
+
+// Lower-bound search over the sorted key array of a node: every function returns the
+// index of the first key that is >= key, or n if all keys are smaller. Because the keys
+// are sorted that index is the number of keys smaller than key, which the vector
+// kernels count without branching on the data. Keys are unsigned, so the vector
+// kernels flip the sign bit before their signed compares.
+
+int lowerBoundScalar(const uint64_t *keys, int n, uint64_t key) {
+    int i = 0;
+    while (i < n && keys[i] < key) i++;
+    return i;
+}
+
+#ifdef KEY_SEARCH_X86
+// Count smaller keys four at a time
+__attribute__((target("avx2")))
+int lowerBoundAvx2(const uint64_t *keys, int n, uint64_t key) {
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i target = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+    int i = 0, count = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i group = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), sign);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, group))));
+    }
+    for (; i < n; i++) count += keys[i] < key;
+    return count;
+}
+
+// Count smaller keys two at a time (pcmpgtq needs SSE4.2)
+__attribute__((target("sse4.2")))
+int lowerBoundSse42(const uint64_t *keys, int n, uint64_t key) {
+    const __m128i sign = _mm_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m128i target = _mm_xor_si128(_mm_set1_epi64x((long long)key), sign);
+    int i = 0, count = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i group = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), sign);
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, group))));
+    }
+    for (; i < n; i++) count += keys[i] < key;
+    return count;
+}
+#endif
+
+typedef int (*LowerBoundFn)(const uint64_t *keys, int n, uint64_t key);
+
+// Pick the widest search kernel the CPU supports
+static LowerBoundFn selectLowerBound() {
+#ifdef KEY_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return lowerBoundAvx2;
+    if (__builtin_cpu_supports("sse4.2")) return lowerBoundSse42;
+#endif
+    return lowerBoundScalar;
+}
+
+static const LowerBoundFn lowerBoundImpl = selectLowerBound();
+
+// Name of the search kernel in use, for benchmarks
+const char *lowerBoundKernel() {
+    if (lowerBoundImpl == lowerBoundScalar) return "scalar";
+#ifdef KEY_SEARCH_X86
+    if (lowerBoundImpl == lowerBoundAvx2) return "avx2";
+    if (lowerBoundImpl == lowerBoundSse42) return "sse4.2";
+#endif
+    return "unknown";
+}
+
+int lowerBound(const uint64_t *keys, int n, uint64_t key) {
+    // The answer stays within [base, base + n]
+    int base = 0;
+    while (n > LINEAR_SEARCH_KEYS) {
+        int half = n / 2;
+        if (keys[base + half] < key) {
+            base += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return base + lowerBoundImpl(keys + base, n, key);
+}
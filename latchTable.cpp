@@ -0,0 +1,126 @@
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+using namespace std;
+
+// Number of independently locked shards in the latch table
+static const size_t LATCH_SHARDS = 64;
+
+// Reader/writer latches for individual blocks. A latch only exists while some thread
+// holds or waits for it, so memory use follows the number of threads, not the tree size.
+class LatchTable {
+private:
+    struct Latch {
+        shared_mutex latch;
+        int users = 0;   // Threads holding or waiting for this latch
+    };
+
+    struct Shard {
+        mutex lock;
+        unordered_map<uint64_t, unique_ptr<Latch>> latches;
+    };
+
+    Shard shards[LATCH_SHARDS];
+
+    Shard &shardFor(uint64_t blockId) {
+        return shards[blockId % LATCH_SHARDS];
+    }
+
+    // Find or create the latch for a block and register the caller as a user
+    Latch *acquire(uint64_t blockId) {
+        Shard &shard = shardFor(blockId);
+        lock_guard<mutex> guard(shard.lock);
+        unique_ptr<Latch> &latch = shard.latches[blockId];
+        if (!latch) latch.reset(new Latch());
+        latch->users++;
+        return latch.get();
+    }
+
+    // Unlock a block's latch and drop it once nobody uses it any more
+    void release(uint64_t blockId, bool exclusive) {
+        Shard &shard = shardFor(blockId);
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.latches.find(blockId);
+        if (exclusive) {
+            it->second->latch.unlock();
+        } else {
+            it->second->latch.unlock_shared();
+        }
+        if (--it->second->users == 0) {
+            shard.latches.erase(it);
+        }
+    }
+
+public:
+    void lockShared(uint64_t blockId) {
+        acquire(blockId)->latch.lock_shared();
+    }
+
+    void unlockShared(uint64_t blockId) {
+        release(blockId, false);
+    }
+
+    void lock(uint64_t blockId) {
+        acquire(blockId)->latch.lock();
+    }
+
+    void unlock(uint64_t blockId) {
+        release(blockId, true);
+    }
+};
+
+// Holds one block latch and releases it when destroyed. Moving a guard hands the
+// latch over, which is how latch crabbing passes a latch from parent to child.
+class LatchGuard {
+private:
+    LatchTable *table;
+    uint64_t blockId;
+    bool exclusive;
+
+public:
+    LatchGuard() : table(nullptr), blockId(0), exclusive(false) {}
+
+    LatchGuard(LatchTable &latches, uint64_t blockId, bool exclusive)
+        : table(&latches), blockId(blockId), exclusive(exclusive) {
+        if (exclusive) {
+            table->lock(blockId);
+        } else {
+            table->lockShared(blockId);
+        }
+    }
+
+    LatchGuard(const LatchGuard &) = delete;
+    LatchGuard &operator=(const LatchGuard &) = delete;
+
+    LatchGuard(LatchGuard &&other) : table(other.table), blockId(other.blockId), exclusive(other.exclusive) {
+        other.table = nullptr;
+    }
+
+    LatchGuard &operator=(LatchGuard &&other) {
+        if (this != &other) {
+            release();
+            table = other.table;
+            blockId = other.blockId;
+            exclusive = other.exclusive;
+            other.table = nullptr;
+        }
+        return *this;
+    }
+
+    ~LatchGuard() {
+        release();
+    }
+
+    void release() {
+        if (table == nullptr) return;
+        if (exclusive) {
+            table->unlock(blockId);
+        } else {
+            table->unlockShared(blockId);
+        }
+        table = nullptr;
+    }
+};
@@ -0,0 +1,78 @@
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Histogram of durations in nanoseconds with log-linear buckets: values below 32 get a
+// bucket each, larger ones 32 buckets per power of two, so a percentile read back is
+// within about 3% of the recorded value. Recording is lock-free and thread-safe.
+class LatencyHistogram {
+private:
+    static const int SUB_BITS = 5;
+    static const uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> total;
+    atomic<uint64_t> largest;
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS) return (size_t)ns;
+        int exponent = 63 - __builtin_clzll(ns);
+        return (size_t)(exponent - SUB_BITS + 1) * SUB_BUCKETS + ((ns >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that falls into a bucket
+    static uint64_t bucketHigh(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        int exponent = (int)(bucket / SUB_BUCKETS) + SUB_BITS - 1;
+        uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BITS);
+        return low + ((uint64_t)1 << (exponent - SUB_BITS)) - 1;
+    }
+
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void record(uint64_t ns) {
+        counts[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        uint64_t seen = largest.load(memory_order_relaxed);
+        while (ns > seen && !largest.compare_exchange_weak(seen, ns, memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const {
+        return total.load(memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return largest.load(memory_order_relaxed);
+    }
+
+    // Smallest recorded value v such that a fraction q (0 to 1) of the values are <= v,
+    // to the histogram's precision; 0 when nothing was recorded
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (n == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (double)n);
+        if ((double)rank < q * (double)n) rank++;
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t high = bucketHigh(b);
+                return high < max() ? high : max();
+            }
+        }
+        return max();
+    }
+
+    // Forget everything recorded (not atomic with respect to concurrent record calls)
+    void reset() {
+        for (auto &c : counts) c.store(0, memory_order_relaxed);
+        total.store(0, memory_order_relaxed);
+        largest.store(0, memory_order_relaxed);
+    }
+};
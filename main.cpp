@@ -7,24 +7,54 @@
 #include <stdexcept>
 #include <vector>
 #include <cctype>
+#include <cstdlib>
 
 // Include the helper and B-tree code
 #include "writeIndex.cpp"
+#include "keySearch.cpp"
+#include "blockChecksum.cpp"
+#include "storage.cpp"
+#include "writeAheadLog.cpp"
+#include "asyncReader.cpp"
+#include "bufferPool.cpp"
+#include "latchTable.cpp"
+#include "externalSort.cpp"
+#include "csvExport.cpp"
+#include "csvParser.cpp"
+#include "binaryRecords.cpp"
+#include "latencyHistogram.cpp"
+#include "indexStats.cpp"
+#include "bloomFilter.cpp"
 #include "Btree.cpp"
+#include "shardedIndex.cpp"
+#include "indexServer.cpp"
 
 using namespace std;
 
-int main() {
-    BTree btree;
+// Run the interactive command loop on a BTree or a ShardedIndex until quit
+template <typename Index>
+static void runCommands(Index &index) {
     while (true) {
         cout << "\nCommands:\n";
         cout << "  create\n";
         cout << "  open\n";
         cout << "  insert\n";
+        cout << "  upsert\n";
+        cout << "  update\n";
         cout << "  search\n";
+        cout << "  delete\n";
+        cout << "  multiget\n";
+        cout << "  range\n";
+        cout << "  scan\n";
         cout << "  load\n";
+        cout << "  bulkload\n";
+        cout << "  compact\n";
         cout << "  print\n";
         cout << "  extract\n";
+        cout << "  sync\n";
+        cout << "  stats\n";
+        cout << "  verify\n";
+        cout << "  resetstats\n";
         cout << "  quit\n";
         cout << "Enter a command: ";
 
@@ -35,34 +65,247 @@ int main() {
         for (auto &ch : command) ch = (char)tolower((unsigned char)ch);
 
         if (command == "create") {
-            btree.createFile();
+            index.createFile();
         } 
         else if (command == "open") {
-            btree.closeFile();
-            btree.openFile();
+            index.closeFile();
+            index.openFile();
         }
         else if (command == "insert") {
-            btree.insertCommand();
+            index.insertCommand();
+        }
+        else if (command == "upsert") {
+            index.upsertCommand();
+        }
+        else if (command == "update") {
+            index.updateCommand();
         }
         else if (command == "search") {
-            btree.searchCommand();
+            index.searchCommand();
+        }
+        else if (command == "delete") {
+            index.deleteCommand();
+        }
+        else if (command == "multiget") {
+            index.multiGetCommand();
+        }
+        else if (command == "range") {
+            index.rangeCommand();
+        }
+        else if (command == "scan") {
+            index.scanCommand();
         }
         else if (command == "load") {
-            btree.loadCommand();
+            index.loadCommand();
         } 
+        else if (command == "bulkload") {
+            index.bulkLoadCommand();
+        }
+        else if (command == "compact") {
+            index.compactCommand();
+        }
         else if (command == "print") {
-            btree.printCommand();
+            index.printCommand();
         } 
         else if (command == "extract") {
-            btree.extractCommand();
+            index.extractCommand();
         } 
+        else if (command == "sync") {
+            index.syncCommand();
+        }
+        else if (command == "stats") {
+            index.statsCommand();
+        }
+        else if (command == "verify") {
+            index.verifyCommand();
+        }
+        else if (command == "resetstats") {
+            index.resetStatsCommand();
+        }
         else if (command == "quit") {
             cout << "Exiting the program.\n";
-            break;
+            return;
         } 
         else {
             cout << "Invalid command. Please try again.\n";
         }
     }
+}
+
+int main(int argc, char *argv[]) {
+    // Optional command line settings
+    size_t cacheFrames = DEFAULT_POOL_FRAMES;
+    uint64_t commitInterval = DEFAULT_COMMIT_INTERVAL;
+    StorageKind storageKind = StorageKind::Pread;
+    size_t pageSize = DEFAULT_PAGE_SIZE;
+    uint64_t nodeFormat = DEFAULT_NODE_FORMAT;
+    bool walEnabled = true;
+    bool copyOnWrite = false;
+    IoEngine ioEngine = IoEngine::Uring;
+    size_t ioDepth = DEFAULT_IO_DEPTH;
+    double bloomRate = 0;
+    size_t bloomMaxBytes = 0;
+    uint64_t shardCount = 0;
+    ShardPartitioning partitioning = ShardPartitioning::Hash;
+    string serveSocket, serveIndex;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--cache-frames" && i + 1 < argc) {
+            cacheFrames = strtoull(argv[++i], nullptr, 10);
+            if (cacheFrames == 0) {
+                cerr << "Error: --cache-frames must be at least 1.\n";
+                return 1;
+            }
+        } else if (arg == "--commit-every" && i + 1 < argc) {
+            commitInterval = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--storage" && i + 1 < argc) {
+            string kind = argv[++i];
+            if (kind == "mmap") {
+                storageKind = StorageKind::Mmap;
+            } else if (kind == "pread") {
+                storageKind = StorageKind::Pread;
+            } else if (kind == "stream") {
+                storageKind = StorageKind::Stream;
+            } else {
+                cerr << "Error: --storage must be pread, stream or mmap.\n";
+                return 1;
+            }
+        } else if (arg == "--page-size" && i + 1 < argc) {
+            pageSize = strtoull(argv[++i], nullptr, 10);
+            if (!isSupportedPageSize(pageSize)) {
+                cerr << "Error: --page-size must be a power of two from 512 to 65536.\n";
+                return 1;
+            }
+        } else if (arg == "--node-format" && i + 1 < argc) {
+            string format = argv[++i];
+            if (format == "packed") {
+                nodeFormat = NODE_FORMAT_PACKED;
+            } else if (format == "plain") {
+                nodeFormat = NODE_FORMAT_PLAIN;
+            } else {
+                cerr << "Error: --node-format must be packed or plain.\n";
+                return 1;
+            }
+        } else if (arg == "--wal" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "on") {
+                walEnabled = true;
+            } else if (mode == "off") {
+                walEnabled = false;
+            } else {
+                cerr << "Error: --wal must be on or off.\n";
+                return 1;
+            }
+        } else if (arg == "--cow" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "on") {
+                copyOnWrite = true;
+            } else if (mode == "off") {
+                copyOnWrite = false;
+            } else {
+                cerr << "Error: --cow must be on or off.\n";
+                return 1;
+            }
+        } else if (arg == "--io-engine" && i + 1 < argc) {
+            string engine = argv[++i];
+            if (engine == "uring") {
+                ioEngine = IoEngine::Uring;
+            } else if (engine == "threads") {
+                ioEngine = IoEngine::Threads;
+            } else if (engine == "off") {
+                ioEngine = IoEngine::Off;
+            } else {
+                cerr << "Error: --io-engine must be uring, threads or off.\n";
+                return 1;
+            }
+        } else if (arg == "--io-depth" && i + 1 < argc) {
+            ioDepth = strtoull(argv[++i], nullptr, 10);
+            if (ioDepth == 0 || ioDepth > MAX_IO_DEPTH) {
+                cerr << "Error: --io-depth must be from 1 to " << MAX_IO_DEPTH << ".\n";
+                return 1;
+            }
+        } else if (arg == "--bloom-fpr" && i + 1 < argc) {
+            bloomRate = strtod(argv[++i], nullptr);
+            if (!(bloomRate >= 0 && bloomRate < 1)) {
+                cerr << "Error: --bloom-fpr must be from 0 (no filter) to below 1.\n";
+                return 1;
+            }
+        } else if (arg == "--bloom-memory" && i + 1 < argc) {
+            bloomMaxBytes = (size_t)strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shardCount = strtoull(argv[++i], nullptr, 10);
+            if (shardCount == 0 || shardCount > MAX_SHARDS) {
+                cerr << "Error: --shards must be from 1 to " << MAX_SHARDS << ".\n";
+                return 1;
+            }
+        } else if (arg == "--partition" && i + 1 < argc) {
+            string kind = argv[++i];
+            if (kind == "hash") {
+                partitioning = ShardPartitioning::Hash;
+            } else if (kind == "range") {
+                partitioning = ShardPartitioning::Range;
+            } else {
+                cerr << "Error: --partition must be hash or range.\n";
+                return 1;
+            }
+        } else if (arg == "--serve" && i + 2 < argc) {
+            serveSocket = argv[++i];
+            serveIndex = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--cache-frames N] [--commit-every N] [--storage pread|stream|mmap]"
+                 << " [--page-size N] [--node-format packed|plain] [--wal on|off] [--cow on|off]"
+                 << " [--io-engine uring|threads|off] [--io-depth N] [--bloom-fpr P] [--bloom-memory MB]"
+                 << " [--shards N] [--partition hash|range] [--serve SOCKET INDEX]\n"
+                 << "--storage mmap reads blocks in place only with --wal off.\n";
+            return 1;
+        }
+    }
+
+    if (shardCount > 0 && !serveSocket.empty()) {
+        cerr << "Error: --serve does not support sharded indexes.\n";
+        return 1;
+    }
+
+    // The tree settings, for the index or for each shard of a sharded index
+    auto configure = [&](BTree &tree) {
+        tree.setCommitInterval(commitInterval);
+        tree.setStorageKind(storageKind);
+        tree.setPageSize(pageSize);
+        tree.setNodeFormat(nodeFormat);
+        tree.setWalEnabled(walEnabled);
+        tree.setCopyOnWrite(copyOnWrite);
+        tree.setReadAhead(ioEngine, ioDepth);
+        tree.setBloomFilter(bloomRate, bloomMaxBytes);
+    };
+    BTree btree(cacheFrames);
+    configure(btree);
+
+    // Server mode: serve one index (created if missing) until SIGINT/SIGTERM. The server
+    // commits batches of writes itself, so writes are not committed one by one.
+    if (!serveSocket.empty()) {
+        try {
+            btree.setCommitInterval(0);
+            if (ifstream(serveIndex, ios::binary).is_open()) {
+                btree.openIndex(serveIndex);
+            } else {
+                btree.createIndex(serveIndex);
+            }
+            IndexServer server(btree);
+            server.run(serveSocket);
+            btree.closeFile();
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (shardCount > 0) {
+        ShardedIndex sharded(cacheFrames, configure);
+        sharded.setShards(shardCount, partitioning);
+        runCommands(sharded);
+    } else {
+        runCommands(btree);
+    }
     return 0;
 }
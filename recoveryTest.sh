@@ -0,0 +1,81 @@
+#!/bin/sh
+# Crash recovery check: kill btree_program with SIGKILL in the middle of a load and
+# check that the reopened index passes verify and holds exactly the rows of its last
+# commit. Run from the source directory; builds btree_program first.
+#
+#   sh recoveryTest.sh [rows] [commit-every]
+
+set -u
+
+ROWS=${1:-200000}
+COMMIT_EVERY=${2:-1000}
+SRC=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+g++ -O2 -pthread "$SRC/main.cpp" -o "$WORK/btree_program" || exit 1
+cd "$WORK" || exit 1
+
+# Distinct keys in scrambled order (multiplying by an odd constant is a bijection mod 2^32)
+awk -v n="$ROWS" 'BEGIN { for (i = 1; i <= n; i++) printf "%.0f,%d\n", (i * 2654435761) % 4294967296, i }' > input.csv
+
+failures=0
+
+# Run one configuration: create an index, load input.csv with the given flags, kill the
+# program after delay seconds, then reopen, verify and extract it
+check() {
+    name=$1
+    delay=$2
+    shift 2
+    rm -f index.idx index.idx.* extract.csv
+    # Commands go through a FIFO kept open, so the program never sees end of input
+    rm -f commands
+    mkfifo commands
+    ./btree_program --commit-every "$COMMIT_EVERY" "$@" < commands > load.log 2>&1 &
+    pid=$!
+    exec 3> commands
+    printf 'create\nindex.idx\nload\ninput.csv\n' >&3
+    sleep "$delay"
+    kill -9 "$pid" 2> /dev/null
+    wait "$pid" 2> /dev/null
+    exec 3>&-
+
+    printf 'open\nindex.idx\nverify\nextract\nextract.csv\nquit\n' | ./btree_program "$@" > reopen.log 2>&1
+    if ! grep -q 'Index is consistent.' reopen.log; then
+        echo "FAIL $name: verify after the crash"
+        cat reopen.log
+        failures=$((failures + 1))
+        return
+    fi
+    count=$(wc -l < extract.csv)
+    if [ "$count" -eq 0 ] || [ "$count" -eq "$ROWS" ]; then
+        echo "FAIL $name: crash did not land mid-load ($count rows); adjust the delay"
+        failures=$((failures + 1))
+        return
+    fi
+    if [ $((count % COMMIT_EVERY)) -ne 0 ]; then
+        echo "FAIL $name: $count rows is not a whole number of commits"
+        failures=$((failures + 1))
+        return
+    fi
+    # The index must hold exactly the first count input rows
+    head -n "$count" input.csv | sort > expected.csv
+    sort extract.csv > actual.csv
+    if ! cmp -s expected.csv actual.csv; then
+        echo "FAIL $name: index differs from the first $count rows"
+        failures=$((failures + 1))
+        return
+    fi
+    echo "ok   $name: recovered $count of $ROWS rows"
+}
+
+check "packed leaves" 1
+check "plain nodes" 1 --node-format plain
+check "copy-on-write" 1 --cow on
+check "4 KiB pages, mmap" 1 --page-size 4096 --storage mmap
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures configuration(s) failed"
+    exit 1
+fi
+echo "All configurations recovered their last commit."
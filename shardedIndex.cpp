@@ -0,0 +1,986 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const string SHARD_MAGIC = "4337SHD1";
+static const uint64_t SHARD_MANIFEST_VERSION = 1;
+static const uint64_t MAX_SHARDS = 1024;
+// Bytes of rows a shard's spill buffer collects before they are written out (1 MiB)
+static const size_t SHARD_SPILL_BYTES = 1 << 20;
+
+// How a sharded index assigns keys to its shards
+enum class ShardPartitioning : uint64_t {
+    Hash = 1,       // By a hash of the key: an even spread, and ordered reads merge all shards
+    Range = 2       // By key range: each shard holds one interval, and ordered reads go shard by shard
+};
+
+// Rows of a load or bulkload that go to one shard, buffered and appended to a binary
+// record file next to the shard's index file. Rows of a sorted input stay sorted, so the
+// shard can build from its file without sorting it again.
+class ShardSpill {
+private:
+    int fd;
+    vector<uint64_t> buffer;    // Keys and values in host order
+
+    void writeOut() {
+        vector<uint8_t> out(buffer.size() * 8);
+        hostToBigArray(buffer.data(), out.data(), buffer.size());
+        size_t done = 0;
+        while (done < out.size()) {
+            ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+            if (n <= 0) {
+                throw runtime_error("Unable to write shard input file.");
+            }
+            done += (size_t)n;
+        }
+        buffer.clear();
+    }
+
+public:
+    string path;
+    uint64_t rows;
+
+    explicit ShardSpill(const string &path) : path(path), rows(0) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || !startRecordFile(fd)) {
+            if (fd >= 0) ::close(fd);
+            remove(path.c_str());
+            throw runtime_error("Unable to create shard input file.");
+        }
+        buffer.reserve(SHARD_SPILL_BYTES / 8);
+    }
+
+    ~ShardSpill() {
+        if (fd >= 0) ::close(fd);
+        remove(path.c_str());
+    }
+
+    void add(uint64_t key, uint64_t value) {
+        buffer.push_back(key);
+        buffer.push_back(value);
+        rows++;
+        if (buffer.size() * 8 >= SHARD_SPILL_BYTES) writeOut();
+    }
+
+    // Write out what is buffered, fill in the header and close the file (it is removed
+    // when the spill is destroyed)
+    void finish() {
+        writeOut();
+        bool ok = finishRecordFile(fd);
+        int closing = fd;
+        fd = -1;
+        if (::close(closing) != 0 || !ok) {
+            throw runtime_error("Unable to write shard input file.");
+        }
+    }
+};
+
+// Index split across several B-tree files. The index's own file is a small manifest
+// holding the partitioning, the shard count and, for range partitioning, the first key
+// of every shard but the first. Shard i is an ordinary index file named <index>.shard<i>
+// with its own buffer pool, log and Bloom filter, so point operations touch one shard and
+// the shards can be loaded, compacted, synced and exported in parallel.
+//
+// Range partitioning starts with the key space cut evenly. The first load or bulkload
+// into an empty range-partitioned index sorts its input first and moves the boundaries
+// so every shard gets the same number of rows.
+class ShardedIndex {
+private:
+    string manifestName;
+    ShardPartitioning partitioning;
+    vector<uint64_t> bounds;             // Range partitioning: first key of shards 1 to n-1
+    vector<unique_ptr<BTree>> shards;
+    size_t cacheFrames;                  // Buffer pool frames of each shard
+    function<void(BTree &)> configure;   // Applies the tree settings to a new shard
+    uint64_t newShardCount;              // Shards of the next create
+    ShardPartitioning newPartitioning;   // Partitioning of the next create
+
+    static string shardFileName(const string &manifest, size_t i) {
+        return manifest + ".shard" + to_string(i);
+    }
+
+    size_t shardOf(uint64_t key) const {
+        if (partitioning == ShardPartitioning::Hash) {
+            return (size_t)(((unsigned __int128)bloomHash(key) * shards.size()) >> 64);
+        }
+        return (size_t)(upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin());
+    }
+
+    // Boundaries cutting the whole key space into n intervals of equal width
+    static vector<uint64_t> evenBounds(size_t n) {
+        vector<uint64_t> result;
+        for (size_t i = 1; i < n; i++) {
+            result.push_back((uint64_t)(((unsigned __int128)i << 64) / n));
+        }
+        return result;
+    }
+
+    // Run fn(i) for every shard on up to one thread per CPU; the first exception thrown
+    // is rethrown once all threads are done
+    void runOnShards(const function<void(size_t)> &fn) {
+        unsigned threads = (unsigned)min<size_t>(max(1u, thread::hardware_concurrency()), shards.size());
+        atomic<size_t> nextShard(0);
+        exception_ptr error;
+        mutex errorLatch;
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                for (size_t i = nextShard++; i < shards.size(); i = nextShard++) {
+                    try {
+                        fn(i);
+                    } catch (...) {
+                        lock_guard<mutex> guard(errorLatch);
+                        if (!error) error = current_exception();
+                    }
+                }
+            });
+        }
+        for (auto &w : workers) w.join();
+        if (error) rethrow_exception(error);
+    }
+
+    // Write the manifest to a temporary file, sync it and move it over the old one
+    void writeManifest() {
+        vector<uint64_t> words;
+        uint64_t magic;
+        memcpy(&magic, SHARD_MAGIC.data(), 8);
+        words.push_back(bigToHost(magic));
+        words.push_back(SHARD_MANIFEST_VERSION);
+        words.push_back((uint64_t)partitioning);
+        words.push_back(shards.size());
+        words.insert(words.end(), bounds.begin(), bounds.end());
+        vector<uint8_t> out(words.size() * 8);
+        hostToBigArray(words.data(), out.data(), words.size());
+
+        string tempPath = manifestName + ".tmp";
+        int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw runtime_error("Unable to write shard manifest.");
+        }
+        bool ok = ::write(fd, out.data(), out.size()) == (ssize_t)out.size();
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        ok = fdatasync(fd) == 0 && ok;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tempPath.c_str(), manifestName.c_str()) != 0) {
+            remove(tempPath.c_str());
+            throw runtime_error("Unable to write shard manifest.");
+        }
+    }
+
+    // Read a manifest's partitioning, shard count and boundaries; throws runtime_error if
+    // the file is missing or is not a manifest
+    static void readManifest(const string &path, ShardPartitioning &kind, uint64_t &count, vector<uint64_t> &boundaries) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Unable to open shard manifest.");
+        }
+        uint8_t raw[4 * 8];
+        uint64_t header[4];
+        bool ok = ::read(fd, raw, sizeof(raw)) == (ssize_t)sizeof(raw);
+        bigToHostArray(raw, header, 4);
+        uint64_t magic;
+        memcpy(&magic, SHARD_MAGIC.data(), 8);
+        if (!ok || header[0] != bigToHost(magic)) {
+            ::close(fd);
+            throw runtime_error("Not a sharded index manifest.");
+        }
+        if (header[1] != SHARD_MANIFEST_VERSION
+            || (header[2] != (uint64_t)ShardPartitioning::Hash && header[2] != (uint64_t)ShardPartitioning::Range)
+            || header[3] == 0 || header[3] > MAX_SHARDS) {
+            ::close(fd);
+            throw runtime_error("Unsupported shard manifest.");
+        }
+        kind = (ShardPartitioning)header[2];
+        count = header[3];
+        boundaries.assign(kind == ShardPartitioning::Range ? count - 1 : 0, 0);
+        vector<uint8_t> boundRaw(boundaries.size() * 8);
+        ok = boundRaw.empty() || ::read(fd, boundRaw.data(), boundRaw.size()) == (ssize_t)boundRaw.size();
+        ::close(fd);
+        bigToHostArray(boundRaw.data(), boundaries.data(), boundaries.size());
+        if (!ok || !is_sorted(boundaries.begin(), boundaries.end())) {
+            throw runtime_error("Shard manifest is truncated or corrupt.");
+        }
+    }
+
+    // Make an unopened shard with the tree settings
+    BTree *newShard() {
+        BTree *shard = new BTree(cacheFrames);
+        configure(*shard);
+        return shard;
+    }
+
+    // True if no shard holds a key
+    bool empty() {
+        for (auto &shard : shards) {
+            if (shard->cursor().first()) return false;
+        }
+        return true;
+    }
+
+    // Send the count pairs of a sorted source (an ExternalSorter or a RecordReader) to the
+    // shards in equal runs, and make the runs' first keys the range boundaries
+    template <typename Source>
+    void spreadSorted(Source &source, uint64_t count, vector<unique_ptr<ShardSpill>> &spills) {
+        vector<uint64_t> firstKeys;
+        KeyValue kv;
+        for (uint64_t row = 0; row < count && source.next(kv); row++) {
+            size_t shard = (size_t)((unsigned __int128)row * shards.size() / count);
+            while (firstKeys.size() < shard) firstKeys.push_back(kv.key);
+            spills[shard]->add(kv.key, kv.value);
+        }
+        while (firstKeys.size() < shards.size() - 1) firstKeys.push_back(UINT64_MAX);
+        bounds = firstKeys;
+        writeManifest();
+    }
+
+    // Split a CSV or binary record file into one spill per shard. A range-partitioned index
+    // that is still empty gets its boundaries from the input: the rows are sorted first
+    // (duplicates are reported and dropped, as the load would; a sorted binary file needs
+    // no sort) and cut into equal runs.
+    void splitInput(const string &path, vector<unique_ptr<ShardSpill>> &spills) {
+        LoadInput input;
+        if (!input.open(path)) {
+            throw runtime_error("Unable to open input file for load.");
+        }
+        for (size_t i = 0; i < shards.size(); i++) {
+            spills.emplace_back(new ShardSpill(shardFileName(manifestName, i) + ".in"));
+        }
+
+        if (partitioning == ShardPartitioning::Range && shards.size() > 1 && empty()) {
+            if (input.sortedRecords()) {
+                RecordReader &records = input.recordReader();
+                if (records.count() > 0) spreadSorted(records, records.count(), spills);
+            } else {
+                ExternalSorter sorter(manifestName);
+                input.forEach([&sorter](uint64_t key, uint64_t value) {
+                    sorter.add(key, value);
+                });
+                uint64_t count = sorter.finish([](const KeyValue &kv) {
+                    cerr << "Error: key " << kv.key << " already exists. Skipping.\n";
+                });
+                if (count > 0) spreadSorted(sorter, count, spills);
+            }
+        } else {
+            input.forEach([&](uint64_t key, uint64_t value) {
+                spills[shardOf(key)]->add(key, value);
+            });
+        }
+        for (auto &spill : spills) spill->finish();
+    }
+
+    // Split a CSV or binary record file to the shards and hand each its rows with load (one
+    // insert at a time) or bulkLoad, all shards in parallel
+    void loadSharded(const string &path, bool bulk) {
+        if (shards.empty()) {
+            throw runtime_error("No index file is open.");
+        }
+        vector<unique_ptr<ShardSpill>> spills;
+        splitInput(path, spills);
+        runOnShards([&](size_t i) {
+            if (spills[i]->rows == 0) return;
+            if (bulk) {
+                shards[i]->bulkLoad(spills[i]->path);
+            } else {
+                shards[i]->load(spills[i]->path);
+            }
+        });
+    }
+
+    // Write the entries with low <= key < high (or all from low on when last) as
+    // "key<separator>value" lines to out, merged across the shards
+    void exportMerged(uint64_t low, uint64_t high, bool last, PartOutput &out) {
+        Cursor c(this);
+        for (bool more = c.seek(low); more && (last || c.key() < high); more = c.next()) {
+            out.add(c.key(), c.value());
+        }
+    }
+
+public:
+    // Forward position in the index. With hash partitioning it merges a cursor per shard
+    // through a min-heap; with range partitioning the shards' cursors take turns the same
+    // way, since only one of them is ever at the smallest key. Like BTree::Cursor, any
+    // write invalidates open cursors.
+    class Cursor {
+    private:
+        vector<BTree::Cursor> cursors;
+        vector<size_t> heap;    // Shards whose cursor is valid, smallest key on top
+
+        bool later(size_t a, size_t b) const {
+            return cursors[a].key() > cursors[b].key();
+        }
+
+        bool rebuild() {
+            heap.clear();
+            for (size_t i = 0; i < cursors.size(); i++) {
+                if (cursors[i].valid()) heap.push_back(i);
+            }
+            make_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return later(a, b); });
+            return !heap.empty();
+        }
+
+    public:
+        explicit Cursor(ShardedIndex *owner) {
+            for (auto &shard : owner->shards) cursors.push_back(shard->cursor());
+        }
+
+        // Position on the first key >= key; returns false if there is none
+        bool seek(uint64_t key) {
+            for (auto &c : cursors) c.seek(key);
+            return rebuild();
+        }
+
+        // Position on the smallest key; returns false if the index is empty
+        bool first() {
+            for (auto &c : cursors) c.first();
+            return rebuild();
+        }
+
+        // Move to the next key in ascending order; returns false past the end
+        bool next() {
+            if (heap.empty()) return false;
+            auto order = [this](size_t a, size_t b) { return later(a, b); };
+            pop_heap(heap.begin(), heap.end(), order);
+            if (cursors[heap.back()].next()) {
+                push_heap(heap.begin(), heap.end(), order);
+            } else {
+                heap.pop_back();
+            }
+            return !heap.empty();
+        }
+
+        bool valid() const { return !heap.empty(); }
+        uint64_t key() const { return cursors[heap.front()].key(); }
+        uint64_t value() const { return cursors[heap.front()].value(); }
+    };
+
+    ShardedIndex(size_t cacheFrames, function<void(BTree &)> configure)
+        : partitioning(ShardPartitioning::Hash), cacheFrames(cacheFrames), configure(configure),
+          newShardCount(1), newPartitioning(ShardPartitioning::Hash) {}
+
+    ~ShardedIndex() {
+        try {
+            closeFile();
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Choose the number of shards and the partitioning of indexes created from now on
+    void setShards(uint64_t count, ShardPartitioning kind) {
+        if (count == 0 || count > MAX_SHARDS) {
+            throw runtime_error("Unsupported shard count.");
+        }
+        newShardCount = count;
+        newPartitioning = kind;
+    }
+
+    // Create (or truncate) a manifest and its shard files, all empty; throws runtime_error
+    // on failure
+    void createIndex(const string &path) {
+        closeFile();
+        manifestName = path;
+        partitioning = newPartitioning;
+        bounds = partitioning == ShardPartitioning::Range ? evenBounds(newShardCount) : vector<uint64_t>();
+        for (uint64_t i = 0; i < newShardCount; i++) shards.emplace_back(newShard());
+        try {
+            runOnShards([this](size_t i) { shards[i]->createIndex(shardFileName(manifestName, i)); });
+            writeManifest();
+        } catch (runtime_error &) {
+            closeFile();
+            throw;
+        }
+    }
+
+    // Open a manifest and all its shards; throws runtime_error if any is missing or invalid
+    void openIndex(const string &path) {
+        closeFile();
+        ShardPartitioning kind;
+        uint64_t count;
+        vector<uint64_t> boundaries;
+        readManifest(path, kind, count, boundaries);
+        manifestName = path;
+        partitioning = kind;
+        bounds = boundaries;
+        for (uint64_t i = 0; i < count; i++) shards.emplace_back(newShard());
+        try {
+            runOnShards([this](size_t i) { shards[i]->openIndex(shardFileName(manifestName, i)); });
+        } catch (runtime_error &) {
+            closeFile();
+            throw;
+        }
+    }
+
+    bool isOpen() const {
+        return !shards.empty();
+    }
+
+    size_t shardCount() const {
+        return shards.size();
+    }
+
+    // Shard i, for per-shard statistics and settings
+    BTree &shard(size_t i) {
+        return *shards.at(i);
+    }
+
+    // The point operations go to the key's shard, with BTree's semantics and thread safety
+    bool insert(uint64_t key, uint64_t value) {
+        return shards[shardOf(key)]->insert(key, value);
+    }
+
+    bool upsert(uint64_t key, uint64_t value, uint64_t &previous) {
+        return shards[shardOf(key)]->upsert(key, value, previous);
+    }
+
+    bool update(uint64_t key, uint64_t value, uint64_t &previous) {
+        return shards[shardOf(key)]->update(key, value, previous);
+    }
+
+    bool search(uint64_t key, uint64_t &value) {
+        return shards[shardOf(key)]->search(key, value);
+    }
+
+    bool erase(uint64_t key) {
+        return shards[shardOf(key)]->erase(key);
+    }
+
+    // Look up many keys at once: each shard gets one batch with its keys.
+    // values[i] and found[i] answer keys[i].
+    void multiGet(const vector<uint64_t> &keys, vector<uint64_t> &values, vector<bool> &found) {
+        values.assign(keys.size(), 0);
+        found.assign(keys.size(), false);
+        vector<vector<size_t>> positions(shards.size());
+        for (size_t i = 0; i < keys.size(); i++) positions[shardOf(keys[i])].push_back(i);
+
+        vector<uint64_t> batch, batchValues;
+        vector<bool> batchFound;
+        for (size_t s = 0; s < shards.size(); s++) {
+            if (positions[s].empty()) continue;
+            batch.clear();
+            for (size_t i : positions[s]) batch.push_back(keys[i]);
+            shards[s]->multiGet(batch, batchValues, batchFound);
+            for (size_t k = 0; k < batch.size(); k++) {
+                values[positions[s][k]] = batchValues[k];
+                found[positions[s][k]] = batchFound[k];
+            }
+        }
+    }
+
+    Cursor cursor() {
+        return Cursor(this);
+    }
+
+    // Commit all pending changes of every shard
+    void sync() {
+        runOnShards([this](size_t i) { shards[i]->sync(); });
+    }
+
+    // Compact every shard, in parallel
+    void compact(CompactOrder order) {
+        runOnShards([this, order](size_t i) { shards[i]->compact(order); });
+    }
+
+    // Insert every row of a CSV or binary record file one at a time, each shard on its own thread
+    void load(const string &path) {
+        loadSharded(path, false);
+    }
+
+    // Merge a CSV or binary record file into the index by rebuilding every shard bottom-up,
+    // in parallel
+    void bulkLoad(const string &path) {
+        loadSharded(path, true);
+    }
+
+    // Write all keys/values in ascending order to fd as "key<separator>value" lines, with
+    // the given number of threads (0 for one per CPU). Range-partitioned shards are
+    // exported one after the other. With hash partitioning the key space is cut into
+    // ranges at shard 0's upper-level separators, which stand for every shard since the
+    // hash spreads keys evenly, and each thread merges one range at a time across all
+    // shards; the ranges' output is written in order as in BTree::exportEntries.
+    void exportEntries(int fd, char separator = ',', unsigned threads = 0) {
+        if (shards.empty()) {
+            throw runtime_error("No index file is open.");
+        }
+        if (partitioning == ShardPartitioning::Range) {
+            for (auto &shard : shards) shard->exportEntries(fd, separator, threads);
+            return;
+        }
+
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        vector<uint64_t> splits = shards[0]->splitKeys(threads == 1 ? 1 : (size_t)threads * 8);
+        size_t parts = splits.size() + 1;
+        threads = (unsigned)min<size_t>(threads, parts);
+
+        OrderedWriter writer(fd, parts);
+        atomic<size_t> nextPart(0);
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                try {
+                    for (size_t p = nextPart++; p < parts; p = nextPart++) {
+                        PartOutput out(writer, p, separator);
+                        exportMerged(p == 0 ? 0 : splits[p - 1], p < splits.size() ? splits[p] : 0,
+                                     p == splits.size(), out);
+                        out.finish();
+                    }
+                } catch (...) {
+                    writer.abort(current_exception());
+                }
+            });
+        }
+        try {
+            writer.writeAll();
+        } catch (...) {
+            for (auto &w : workers) w.join();
+            throw;
+        }
+        for (auto &w : workers) w.join();
+    }
+
+    void resetStats() {
+        for (auto &shard : shards) shard->resetStats();
+    }
+
+    // Close every shard (committing its pending changes), in parallel
+    void closeFile() {
+        if (shards.empty()) return;
+        try {
+            runOnShards([this](size_t i) { shards[i]->closeFile(); });
+        } catch (runtime_error &) {
+            shards.clear();
+            throw;
+        }
+        shards.clear();
+    }
+
+    // Create a new sharded index
+    void createFile() {
+        cout << "Enter the file name to create: ";
+        string fname; cin >> fname;
+        {
+            // Check if file already exists
+            ifstream test(fname, ios::binary);
+            if (test.is_open()) {
+                cout << "File already exists. Overwrite? (y/n): ";
+                char c; cin >> c;
+                if (c!='y' && c!='Y') {
+                    cout << "File creation aborted.\n";
+                    return;
+                }
+            }
+        }
+
+        try {
+            createIndex(fname);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        cout << "File created successfully with " << shards.size() << " shard"
+             << (shards.size() == 1 ? "" : "s") << ".\n";
+    }
+
+    // Open an existing sharded index
+    void openFile() {
+        cout << "Enter the file name to open: ";
+        string fname; cin >> fname;
+        try {
+            openIndex(fname);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        cout << "File opened successfully with " << shards.size() << " shard"
+             << (shards.size() == 1 ? "" : "s") << ".\n";
+    }
+
+    // Insert command: prompt user for key/value and insert it into the key's shard
+    void insertCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key and value: ";
+        uint64_t key, value;
+        if (!(cin >> key >> value)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        try {
+            if (!insert(key, value)) {
+                cerr << "Error: Key already exists.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Upsert command: prompt user for a key and value, adding the key or replacing its value
+    void upsertCommand() {
+        writeCommand(WriteMode::Upsert);
+    }
+
+    // Update command: prompt user for a key and value, replacing the value of an existing key
+    void updateCommand() {
+        writeCommand(WriteMode::Update);
+    }
+
+    // Shared by upsert and update: write the entered pair and print the value it replaced
+    void writeCommand(WriteMode mode) {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key and value: ";
+        uint64_t key, value;
+        if (!(cin >> key >> value)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        try {
+            uint64_t previous;
+            bool existed = mode == WriteMode::Update ? update(key, value, previous) : upsert(key, value, previous);
+            if (existed) {
+                cout << "Replaced value " << previous << ".\n";
+            } else if (mode == WriteMode::Update) {
+                cerr << "Error: Key not found.\n";
+            } else {
+                cout << "Key inserted.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Search command: prompt user for key and look it up in its shard
+    void searchCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key: ";
+        uint64_t key;
+        if (!(cin >> key)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        uint64_t value;
+        try {
+            if (search(key, value)) {
+                cout << key << " " << value << "\n";
+            } else {
+                cerr << "Error: Key not found.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Delete command: prompt user for a key and remove it from its shard
+    void deleteCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter key: ";
+        uint64_t key;
+        if (!(cin >> key)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+
+        try {
+            if (!erase(key)) {
+                cerr << "Error: Key not found.\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Multiget command: look up a batch of keys, printing results in the order given
+    void multiGetCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter the number of keys: ";
+        uint64_t count;
+        if (!(cin >> count)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+        cout << "Enter keys: ";
+        vector<uint64_t> keys(count);
+        for (uint64_t i = 0; i < count; i++) {
+            if (!(cin >> keys[i])) {
+                cerr << "Error: Invalid input.\n";
+                cin.clear(); cin.ignore(10000,'\n');
+                return;
+            }
+        }
+
+        vector<uint64_t> values;
+        vector<bool> found;
+        try {
+            multiGet(keys, values, found);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            if (found[i]) {
+                cout << keys[i] << " " << values[i] << "\n";
+            } else {
+                cerr << "Error: Key " << keys[i] << " not found.\n";
+            }
+        }
+    }
+
+    // Load command: split an input file to the shards and insert each shard's rows on its own thread
+    void loadCommand() {
+        fileCommand(false);
+    }
+
+    // Bulk load command: split an input file to the shards and rebuild them in parallel
+    void bulkLoadCommand() {
+        fileCommand(true);
+    }
+
+    void fileCommand(bool bulk) {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter the file name to load from: ";
+        string fname; cin >> fname;
+        try {
+            loadSharded(fname, bulk);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Range command: print all keys/values with low <= key <= high in ascending order
+    void rangeCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter low and high keys: ";
+        uint64_t low, high;
+        if (!(cin >> low >> high)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+        try {
+            Cursor c(this);
+            for (bool more = low <= high && c.seek(low); more && c.key() <= high; more = c.next()) {
+                cout << c.key() << " " << c.value() << "\n";
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Scan command: print the next count keys/values after a given key
+    void scanCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter start key and count: ";
+        uint64_t start, count;
+        if (!(cin >> start >> count)) {
+            cerr << "Error: Invalid input.\n";
+            cin.clear(); cin.ignore(10000,'\n');
+            return;
+        }
+        try {
+            Cursor c(this);
+            bool more = c.seek(start);
+            if (more && c.key() == start) more = c.next();
+            for (uint64_t n = 0; more && n < count; n++) {
+                cout << c.key() << " " << c.value() << "\n";
+                more = c.next();
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Compact command: compact every shard in breadth-first or key order
+    void compactCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter the block order (bfs or key): ";
+        string orderName; cin >> orderName;
+        CompactOrder order;
+        if (orderName == "bfs") {
+            order = CompactOrder::BreadthFirst;
+        } else if (orderName == "key") {
+            order = CompactOrder::KeyOrder;
+        } else {
+            cerr << "Error: Block order must be bfs or key.\n";
+            return;
+        }
+        try {
+            compact(order);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        cout << "Compaction completed for " << shards.size() << " shard" << (shards.size() == 1 ? "" : "s") << ".\n";
+    }
+
+    // Print command: print all keys/values in ascending order
+    void printCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout.flush();
+        try {
+            exportEntries(STDOUT_FILENO, ' ', 0);
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Extract command: write all keys/values to a specified file in ascending order, as
+    // binary records if its name ends in .bin
+    void extractCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Enter the file name to extract to: ";
+        string fname; cin >> fname;
+
+        // Check if file exists
+        {
+            ifstream test(fname);
+            if (test.is_open()) {
+                cout << "File already exists. Overwrite? (y/n): ";
+                char c; cin >> c;
+                if (c!='y' && c!='Y') {
+                    cout << "Extract aborted.\n";
+                    return;
+                }
+            }
+        }
+
+        int fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Error: Unable to open output file.\n";
+            return;
+        }
+
+        bool binary = isRecordFileName(fname);
+        try {
+            if (binary && !startRecordFile(fd)) {
+                throw runtime_error("Unable to write output file.");
+            }
+            exportEntries(fd, binary ? BINARY_RECORDS : ',', 0);
+            if (binary && !finishRecordFile(fd)) {
+                throw runtime_error("Unable to write output file.");
+            }
+        } catch (runtime_error &e) {
+            ::close(fd);
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        ::close(fd);
+        cout << "Extract completed.\n";
+    }
+
+    // Sync command: commit the pending changes of every shard now
+    void syncCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        try {
+            sync();
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            return;
+        }
+        cout << "Index file synced.\n";
+    }
+
+    // Stats command: print the partitioning, then each shard's statistics and shape
+    void statsCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        cout << "Sharded index: " << shards.size() << " shard" << (shards.size() == 1 ? "" : "s") << ", "
+             << (partitioning == ShardPartitioning::Hash ? "hash" : "range") << " partitioning\n";
+        try {
+            for (size_t i = 0; i < shards.size(); i++) {
+                cout << "Shard " << i << " (" << shardFileName(manifestName, i);
+                if (partitioning == ShardPartitioning::Range) {
+                    cout << ", keys from " << (i == 0 ? 0 : bounds[i - 1]);
+                }
+                cout << "):\n";
+                TreeShape treeShape = shards[i]->shape();
+                printIndexStats(cout, shards[i]->stats(), treeShape);
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Verify command: check every shard's file in turn
+    void verifyCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        try {
+            for (size_t i = 0; i < shards.size(); i++) {
+                cout << "Shard " << i << " (" << shardFileName(manifestName, i) << "):\n";
+                printVerifyReport(cout, shards[i]->verify());
+            }
+        } catch (runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    // Reset stats command: start counting operations of every shard from zero
+    void resetStatsCommand() {
+        if (shards.empty()) {
+            cerr << "Error: No index file is open.\n";
+            return;
+        }
+        resetStats();
+        cout << "Statistics reset.\n";
+    }
+};
@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Address space reserved up front for a mapped index file, so growing the
+// mapping never moves it and pointers into it stay valid (1 TiB)
+static const uint64_t MMAP_RESERVE_BYTES = 1ULL << 40;
+// The mapped file grows in chunks of this size (64 MiB)
+static const uint64_t MMAP_GROW_BYTES = 64ULL << 20;
+
+// fsync, fdatasync and msync calls made by all storage backends and the write-ahead log
+static atomic<uint64_t> storageSyncCount(0);
+
+// How the index file is about to be accessed, used for read-ahead hints
+enum class AccessPattern {
+    Random,      // Point lookups and inserts
+    Sequential   // Full traversals such as print and extract
+};
+
+// Which Storage implementation backs an index file
+enum class StorageKind {
+    Pread,       // Positional pread/pwrite on a file descriptor
+    Stream,      // fstream with explicit seek/read/write
+    Mmap         // Memory-mapped file
+};
+
+// Byte-addressed storage for an index file. The B-Tree and buffer pool only
+// talk to this interface, so the backend is chosen when a file is opened.
+// read, write, flush and mapped may be called from several threads at once.
+class Storage {
+public:
+    virtual ~Storage() {}
+
+    // Open the file, creating or truncating it when create is true
+    virtual bool open(const string &path, bool create) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    // Current file size in bytes
+    virtual uint64_t size() = 0;
+
+    // Read len bytes at offset; anything past end of file reads as zeros
+    virtual void read(uint64_t offset, void *buffer, size_t len) = 0;
+    virtual void write(uint64_t offset, const void *buffer, size_t len) = 0;
+
+    // Hand buffered writes to the operating system
+    virtual void flush() = 0;
+
+    // Make everything written so far durable (fsync)
+    virtual void sync() = 0;
+
+    // Size the file should have once closed (backends that preallocate trim to it)
+    virtual void setLogicalSize(uint64_t /*bytes*/) {}
+
+    // True when mapped() hands out pointers into the file
+    virtual bool isMapped() const { return false; }
+
+    // Pointer straight into the file's bytes, or nullptr if the backend has to copy.
+    // The returned range stays valid until the storage is closed.
+    virtual uint8_t *mapped(uint64_t /*offset*/, size_t /*len*/) { return nullptr; }
+
+    // Hand bytes changed in place through mapped() to the operating system. sync() only
+    // has to make these ranges and those passed to write() durable.
+    virtual void writeBack(uint64_t /*offset*/, size_t /*len*/) {}
+
+    // Hint how the file is about to be accessed
+    virtual void advise(AccessPattern /*pattern*/) {}
+
+    // If the len bytes at offset can be read straight from a file descriptor, set fd and
+    // the offset in that file and return true. Used to issue asynchronous reads; the
+    // answer only holds until the bytes are next written.
+    virtual bool descriptorFor(uint64_t /*offset*/, size_t /*len*/, int &/*fd*/, uint64_t &/*fileOffset*/) { return false; }
+};
+
+// Storage on top of positional I/O: no shared file position, so concurrent
+// reads and writes of different blocks never serialize in user space
+class PreadStorage : public Storage {
+private:
+    int fd;
+
+public:
+    PreadStorage() {
+        fd = -1;
+    }
+
+    ~PreadStorage() {
+        close();
+    }
+
+    bool open(const string &path, bool create) override {
+        close();
+        int flags = O_RDWR;
+        if (create) flags |= O_CREAT | O_TRUNC;
+        fd = ::open(path.c_str(), flags, 0644);
+        return fd >= 0;
+    }
+
+    void close() override {
+        if (fd < 0) return;
+        ::close(fd);
+        fd = -1;
+    }
+
+    bool isOpen() const override {
+        return fd >= 0;
+    }
+
+    uint64_t size() override {
+        struct stat st;
+        if (fstat(fd, &st) != 0) return 0;
+        return (uint64_t)st.st_size;
+    }
+
+    void read(uint64_t offset, void *buffer, size_t len) override {
+        uint8_t *out = (uint8_t*)buffer;
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(fd, out + done, len - done, (off_t)(offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                throw runtime_error("Unable to read index file.");
+            }
+            if (n == 0) break;  // End of file: the rest reads as zeros
+            done += (size_t)n;
+        }
+        memset(out + done, 0, len - done);
+    }
+
+    void write(uint64_t offset, const void *buffer, size_t len) override {
+        const uint8_t *in = (const uint8_t*)buffer;
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pwrite(fd, in + done, len - done, (off_t)(offset + done));
+            if (n <= 0) {
+                throw runtime_error("Unable to write index file.");
+            }
+            done += (size_t)n;
+        }
+    }
+
+    void flush() override {
+        // pwrite already hands the data to the operating system
+    }
+
+    void sync() override {
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        if (fdatasync(fd) != 0) {
+            throw runtime_error("Unable to sync index file.");
+        }
+    }
+
+    bool descriptorFor(uint64_t offset, size_t /*len*/, int &fdOut, uint64_t &fileOffset) override {
+        fdOut = fd;
+        fileOffset = offset;
+        return true;
+    }
+};
+
+// Storage on top of fstream: every access is a seek plus a read or write. The
+// stream has a single position, so accesses are serialized with a mutex.
+class StreamStorage : public Storage {
+private:
+    fstream file;
+    string path;   // fstream has no descriptor to fsync, so sync reopens the file
+    mutex lock;
+
+public:
+    bool open(const string &path, bool create) override {
+        this->path = path;
+        if (create) {
+            file.open(path, ios::binary | ios::trunc | ios::in | ios::out);
+        } else {
+            file.open(path, ios::binary | ios::in | ios::out);
+        }
+        return file.is_open();
+    }
+
+    void close() override {
+        if (file.is_open()) file.close();
+    }
+
+    bool isOpen() const override {
+        return file.is_open();
+    }
+
+    uint64_t size() override {
+        lock_guard<mutex> guard(lock);
+        file.seekg(0, ios::end);
+        return (uint64_t)file.tellg();
+    }
+
+    void read(uint64_t offset, void *buffer, size_t len) override {
+        lock_guard<mutex> guard(lock);
+        memset(buffer, 0, len);
+        file.seekg(offset, ios::beg);
+        file.read((char*)buffer, len);
+        if ((size_t)file.gcount() < len) {
+            file.clear();
+        }
+    }
+
+    void write(uint64_t offset, const void *buffer, size_t len) override {
+        lock_guard<mutex> guard(lock);
+        file.seekp(offset, ios::beg);
+        file.write((const char*)buffer, len);
+    }
+
+    void flush() override {
+        lock_guard<mutex> guard(lock);
+        file.flush();
+    }
+
+    void sync() override {
+        lock_guard<mutex> guard(lock);
+        file.flush();
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        int fd = ::open(path.c_str(), O_RDONLY);
+        bool ok = fd >= 0 && fsync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        if (!ok) {
+            throw runtime_error("Unable to sync index file.");
+        }
+    }
+};
+
+// Storage on top of a shared memory mapping. Address space for the whole file is
+// reserved at open and the file is mapped into it in MMAP_GROW_BYTES chunks as it
+// grows. When the buffer pool uses it directly, nodes are read and written in place
+// without copies or syscalls; wrapped in the write-ahead log, whose writes must all go
+// through write(), it is read and written by copying like the other backends.
+class MmapStorage : public Storage {
+private:
+    int fd;                  // Descriptor of the mapped file
+    uint8_t *base;           // Start of the reserved address range
+    uint64_t mappedBytes;    // Bytes of the reservation currently backed by the file
+    atomic<uint64_t> diskBytes;  // Size of the file on disk, including preallocated chunks
+    uint64_t logicalBytes;   // Size the file is trimmed to on close
+    AccessPattern pattern;   // Last access hint, reapplied to new chunks
+    mutex growLock;          // Serializes growing the file and mapping
+    vector<pair<uint64_t, uint64_t>> unsynced;  // [start, end) ranges changed since the last sync
+    mutex unsyncedLock;      // Protects unsynced
+
+    static uint64_t roundUp(uint64_t value, uint64_t unit) {
+        return (value + unit - 1) / unit * unit;
+    }
+
+    // Remember a changed range for the next sync, extending the last one when they touch
+    void noteChanged(uint64_t offset, uint64_t len) {
+        lock_guard<mutex> guard(unsyncedLock);
+        if (!unsynced.empty() && offset <= unsynced.back().second && offset + len >= unsynced.back().first) {
+            unsynced.back().first = min(unsynced.back().first, offset);
+            unsynced.back().second = max(unsynced.back().second, offset + len);
+        } else {
+            unsynced.emplace_back(offset, offset + len);
+        }
+    }
+
+    void applyAdvice(uint64_t offset, uint64_t len) {
+        if (len == 0) return;
+        madvise(base + offset, len, pattern == AccessPattern::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    }
+
+    // Map [mappedBytes, end) of the file into the reservation
+    void mapUpTo(uint64_t end) {
+        if (end <= mappedBytes) return;
+        if (end > MMAP_RESERVE_BYTES) {
+            throw runtime_error("Index file exceeds the mmap address reservation.");
+        }
+        void *p = mmap(base + mappedBytes, end - mappedBytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_FIXED, fd, (off_t)mappedBytes);
+        if (p == MAP_FAILED) {
+            throw runtime_error("Unable to map index file.");
+        }
+        applyAdvice(mappedBytes, end - mappedBytes);
+        mappedBytes = end;
+    }
+
+    // Make sure [0, end) is backed by the file and mapped
+    void ensure(uint64_t end) {
+        if (end <= diskBytes.load()) return;
+        lock_guard<mutex> guard(growLock);
+        if (end <= diskBytes.load()) return;
+        uint64_t newDisk = roundUp(end, MMAP_GROW_BYTES);
+        if (ftruncate(fd, (off_t)newDisk) != 0) {
+            throw runtime_error("Unable to grow index file.");
+        }
+        mapUpTo(newDisk);
+        diskBytes = newDisk;
+    }
+
+public:
+    MmapStorage() {
+        fd = -1;
+        base = nullptr;
+        mappedBytes = 0;
+        diskBytes = 0;
+        logicalBytes = 0;
+        pattern = AccessPattern::Random;
+    }
+
+    ~MmapStorage() {
+        close();
+    }
+
+    bool open(const string &path, bool create) override {
+        close();
+        int flags = O_RDWR;
+        if (create) flags |= O_CREAT | O_TRUNC;
+        fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        void *reserve = mmap(nullptr, MMAP_RESERVE_BYTES, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserve == MAP_FAILED) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        base = (uint8_t*)reserve;
+        diskBytes = (uint64_t)st.st_size;
+        logicalBytes = diskBytes;
+        mappedBytes = 0;
+        pattern = AccessPattern::Random;
+        try {
+            // The tail of the last page past end of file is readable (as zeros)
+            mapUpTo(roundUp(diskBytes, (uint64_t)sysconf(_SC_PAGESIZE)));
+        } catch (runtime_error &) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() override {
+        if (fd < 0) return;
+        munmap(base, MMAP_RESERVE_BYTES);
+        if (diskBytes.load() != logicalBytes) {
+            if (ftruncate(fd, (off_t)logicalBytes) != 0) {
+                // Leaves zero padding at the end of the file, which readers ignore
+            }
+        }
+        ::close(fd);
+        fd = -1;
+        base = nullptr;
+        mappedBytes = 0;
+        diskBytes = 0;
+        logicalBytes = 0;
+        unsynced.clear();
+    }
+
+    bool isOpen() const override {
+        return fd >= 0;
+    }
+
+    uint64_t size() override {
+        return logicalBytes;
+    }
+
+    void read(uint64_t offset, void *buffer, size_t len) override {
+        memset(buffer, 0, len);
+        if (offset >= diskBytes) return;
+        size_t avail = (size_t)min<uint64_t>(len, diskBytes - offset);
+        memcpy(buffer, base + offset, avail);
+    }
+
+    void write(uint64_t offset, const void *buffer, size_t len) override {
+        ensure(offset + len);
+        memcpy(base + offset, buffer, len);
+        logicalBytes = max(logicalBytes, offset + len);
+        noteChanged(offset, len);
+    }
+
+    void flush() override {
+        // Stores to a shared mapping are already visible to the operating system
+    }
+
+    // msync only the pages changed since the last sync, then fdatasync for the file size
+    void sync() override {
+        lock_guard<mutex> guard(growLock);
+        vector<pair<uint64_t, uint64_t>> ranges;
+        {
+            lock_guard<mutex> unsyncedGuard(unsyncedLock);
+            ranges.swap(unsynced);
+        }
+        sort(ranges.begin(), ranges.end());
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        size_t i = 0;
+        while (i < ranges.size()) {
+            uint64_t start = ranges[i].first / page * page;
+            uint64_t end = ranges[i].second;
+            for (i++; i < ranges.size() && ranges[i].first / page * page <= end; i++) {
+                end = max(end, ranges[i].second);
+            }
+            end = min(roundUp(end, page), mappedBytes);
+            if (start >= end) continue;
+            storageSyncCount.fetch_add(1, memory_order_relaxed);
+            if (msync(base + start, end - start, MS_SYNC) != 0) {
+                throw runtime_error("Unable to sync index file.");
+            }
+        }
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        if (fdatasync(fd) != 0) {
+            throw runtime_error("Unable to sync index file.");
+        }
+    }
+
+    void setLogicalSize(uint64_t bytes) override {
+        ensure(bytes);
+        logicalBytes = bytes;
+    }
+
+    bool isMapped() const override {
+        return true;
+    }
+
+    uint8_t *mapped(uint64_t offset, size_t len) override {
+        ensure(offset + len);
+        return base + offset;
+    }
+
+    void writeBack(uint64_t offset, size_t len) override {
+        noteChanged(offset, len);
+    }
+
+    void advise(AccessPattern newPattern) override {
+        pattern = newPattern;
+        applyAdvice(0, mappedBytes);
+    }
+};
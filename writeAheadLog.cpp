@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Log bytes after which a commit also checkpoints the log into the index file (16 MiB)
+static const uint64_t WAL_CHECKPOINT_BYTES = 16ULL << 20;
+// Appended records are buffered in memory up to this size before being written (1 MiB)
+static const size_t WAL_BUFFER_BYTES = 1 << 20;
+
+// Record types in the log
+static const uint64_t WAL_PAGE = 1;     // Image of bytes written at an offset of the index file
+static const uint64_t WAL_COMMIT = 2;   // Everything before it is committed; offset holds the file size
+static const size_t WAL_RECORD_HEADER = 32;
+
+uint64_t hostToBig(uint64_t x);
+uint64_t bigToHost(uint64_t x);
+
+// FNV-1a hash used to detect torn or partially written records
+static uint64_t walChecksum(const uint8_t *data, size_t len, uint64_t hash = 0xcbf29ce484222325ULL) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Storage that sends every write to an append-only write-ahead log next to the index
+// file (<index>.wal) instead of writing it in place. Each log record is a page image
+// with a checksum; flush appends a commit record and makes the log durable with a single
+// fsync, so a group commit costs one sequential write plus one fsync however many pages
+// it touched. Reads see the newest logged image of a page. Committed images are copied
+// into the index file lazily, when the log grows past WAL_CHECKPOINT_BYTES and on close.
+//
+// Opening a file replays the log: images up to the last intact commit record are written
+// into the index file, anything after it (an interrupted commit, or pages evicted from the
+// buffer pool before their commit) is discarded. A crash at any point therefore leaves the
+// index as of its last completed commit.
+class WalStorage : public Storage {
+private:
+    struct Record {
+        uint64_t logPos;   // Position of the image in the log (buffered part included)
+        uint64_t len;      // Length of the image
+    };
+
+    unique_ptr<Storage> base;     // The index file itself
+    string logPath;               // Path of the log file
+    int logFd;                    // Descriptor of the log file
+    uint64_t logFileBytes;        // Bytes of the log already written to the file
+    vector<uint8_t> buffer;       // Appended records not yet written to the file
+    map<uint64_t, Record> pages;  // Index file offset -> newest logged image
+    uint64_t longestImage;        // Length of the longest image logged since open
+    uint64_t logicalBytes;        // Size of the index file including logged pages
+    shared_mutex lock;            // Readers share it; appends, commits and checkpoints are exclusive
+
+    // Write buffered records to the end of the log file
+    void writeBuffer() {
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t n = pwrite(logFd, buffer.data() + done, buffer.size() - done, (off_t)(logFileBytes + done));
+            if (n <= 0) {
+                throw runtime_error("Unable to write the write-ahead log.");
+            }
+            done += (size_t)n;
+        }
+        logFileBytes += buffer.size();
+        buffer.clear();
+    }
+
+    // Append one record, returning the log position of its payload
+    uint64_t append(uint64_t type, uint64_t offset, const uint8_t *data, uint64_t len) {
+        uint64_t fields[3] = {hostToBig(type), hostToBig(offset), hostToBig(len)};
+        uint64_t sum = walChecksum((const uint8_t*)fields, sizeof(fields));
+        sum = hostToBig(walChecksum(data, len, sum));
+        const uint8_t *f = (const uint8_t*)fields;
+        buffer.insert(buffer.end(), f, f + sizeof(fields));
+        buffer.insert(buffer.end(), (const uint8_t*)&sum, (const uint8_t*)&sum + 8);
+        uint64_t payloadPos = logFileBytes + buffer.size();
+        buffer.insert(buffer.end(), data, data + len);
+        if (buffer.size() >= WAL_BUFFER_BYTES) writeBuffer();
+        return payloadPos;
+    }
+
+    // Read len bytes of the log at pos, whether already written or still buffered
+    void readLog(uint64_t pos, uint8_t *out, size_t len) {
+        if (pos >= logFileBytes) {
+            memcpy(out, buffer.data() + (pos - logFileBytes), len);
+            return;
+        }
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(logFd, out + done, len - done, (off_t)(pos + done));
+            if (n <= 0) {
+                throw runtime_error("Unable to read the write-ahead log.");
+            }
+            done += (size_t)n;
+        }
+    }
+
+    // Copy the newest image of every logged page into the index file, make it durable and
+    // empty the log. Only called when every record in the log is committed.
+    void checkpoint() {
+        writeBuffer();
+        vector<uint8_t> image;
+        for (auto &entry : pages) {
+            image.resize(entry.second.len);
+            readLog(entry.second.logPos, image.data(), image.size());
+            base->write(entry.first, image.data(), image.size());
+        }
+        base->setLogicalSize(logicalBytes);
+        base->flush();
+        base->sync();
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        if (ftruncate(logFd, 0) != 0 || fdatasync(logFd) != 0) {
+            throw runtime_error("Unable to reset the write-ahead log.");
+        }
+        pages.clear();
+        logFileBytes = 0;
+    }
+
+    // Replay the committed part of an existing log into the index file
+    void recover() {
+        struct stat st;
+        if (fstat(logFd, &st) != 0) {
+            throw runtime_error("Unable to read the write-ahead log.");
+        }
+        logFileBytes = (uint64_t)st.st_size;
+
+        map<uint64_t, Record> pending;
+        uint64_t pos = 0;
+        uint64_t committedSize = 0;
+        bool committed = false;
+        vector<uint8_t> payload;
+        while (pos + WAL_RECORD_HEADER <= logFileBytes) {
+            uint64_t fields[4];
+            readLog(pos, (uint8_t*)fields, sizeof(fields));
+            uint64_t type = bigToHost(fields[0]);
+            uint64_t offset = bigToHost(fields[1]);
+            uint64_t len = bigToHost(fields[2]);
+            if ((type != WAL_PAGE && type != WAL_COMMIT) || len > logFileBytes - pos - WAL_RECORD_HEADER) break;
+            payload.resize(len);
+            readLog(pos + WAL_RECORD_HEADER, payload.data(), len);
+            uint64_t sum = walChecksum((const uint8_t*)fields, 24);
+            if (walChecksum(payload.data(), len, sum) != bigToHost(fields[3])) break;
+
+            if (type == WAL_PAGE) {
+                pending[offset] = Record{pos + WAL_RECORD_HEADER, len};
+                longestImage = max(longestImage, len);
+            } else {
+                for (auto &entry : pending) pages[entry.first] = entry.second;
+                pending.clear();
+                committedSize = offset;
+                committed = true;
+            }
+            pos += WAL_RECORD_HEADER + len;
+        }
+
+        if (committed) {
+            logicalBytes = committedSize;
+            checkpoint();
+        } else if (logFileBytes > 0) {
+            pages.clear();
+            if (ftruncate(logFd, 0) != 0) {
+                throw runtime_error("Unable to reset the write-ahead log.");
+            }
+            logFileBytes = 0;
+        }
+    }
+
+public:
+    WalStorage(unique_ptr<Storage> indexStorage) : base(move(indexStorage)) {
+        logFd = -1;
+        logFileBytes = 0;
+        logicalBytes = 0;
+        longestImage = 0;
+    }
+
+    ~WalStorage() {
+        close();
+    }
+
+    bool open(const string &path, bool create) override {
+        close();
+        if (!base->open(path, create)) return false;
+        logPath = path + ".wal";
+        int flags = O_RDWR | O_CREAT;
+        if (create) flags |= O_TRUNC;
+        logFd = ::open(logPath.c_str(), flags, 0644);
+        if (logFd < 0) {
+            base->close();
+            return false;
+        }
+        logicalBytes = base->size();
+        try {
+            recover();
+        } catch (runtime_error &) {
+            ::close(logFd);
+            logFd = -1;
+            base->close();
+            return false;
+        }
+        return true;
+    }
+
+    // Commit whatever is still logged, checkpoint it and remove the log
+    void close() override {
+        if (logFd < 0) return;
+        {
+            unique_lock<shared_mutex> guard(lock);
+            append(WAL_COMMIT, logicalBytes, nullptr, 0);
+            checkpoint();
+        }
+        ::close(logFd);
+        logFd = -1;
+        unlink(logPath.c_str());
+        base->close();
+        logFileBytes = 0;
+        logicalBytes = 0;
+    }
+
+    bool isOpen() const override {
+        return logFd >= 0;
+    }
+
+    uint64_t size() override {
+        shared_lock<shared_mutex> guard(lock);
+        return logicalBytes;
+    }
+
+    // A read spanning several pages (verify reads blocks in batches) gets the newest
+    // image of each of them. Pages are logged whole and never overlap one another.
+    void read(uint64_t offset, void *out, size_t len) override {
+        shared_lock<shared_mutex> guard(lock);
+        auto it = pages.find(offset);
+        if (it != pages.end() && it->second.len >= len) {
+            readLog(it->second.logPos, (uint8_t*)out, len);
+            return;
+        }
+        base->read(offset, out, len);
+        it = pages.lower_bound(offset >= longestImage ? offset - longestImage + 1 : 0);
+        for (; it != pages.end() && it->first < offset + len; ++it) {
+            uint64_t start = max(offset, it->first);
+            uint64_t end = min(offset + len, it->first + it->second.len);
+            if (start >= end) continue;
+            readLog(it->second.logPos + (start - it->first), (uint8_t*)out + (start - offset), (size_t)(end - start));
+        }
+    }
+
+    void write(uint64_t offset, const void *data, size_t len) override {
+        unique_lock<shared_mutex> guard(lock);
+        uint64_t pos = append(WAL_PAGE, offset, (const uint8_t*)data, len);
+        pages[offset] = Record{pos, len};
+        longestImage = max<uint64_t>(longestImage, len);
+        logicalBytes = max(logicalBytes, offset + len);
+    }
+
+    // Commit point: append a commit record and fsync the log once for the whole group
+    void flush() override {
+        unique_lock<shared_mutex> guard(lock);
+        append(WAL_COMMIT, logicalBytes, nullptr, 0);
+        writeBuffer();
+        storageSyncCount.fetch_add(1, memory_order_relaxed);
+        if (fdatasync(logFd) != 0) {
+            throw runtime_error("Unable to sync the write-ahead log.");
+        }
+        if (logFileBytes >= WAL_CHECKPOINT_BYTES) {
+            checkpoint();
+        }
+    }
+
+    // Everything worth keeping is durable once committed, so syncing is a commit
+    void sync() override {
+        flush();
+    }
+
+    void setLogicalSize(uint64_t bytes) override {
+        unique_lock<shared_mutex> guard(lock);
+        logicalBytes = bytes;
+    }
+
+    void advise(AccessPattern pattern) override {
+        base->advise(pattern);
+    }
+
+    // Pages not in the log are read from the index file; logged ones have no single place
+    // to read from (they may still be buffered), so they are read synchronously
+    bool descriptorFor(uint64_t offset, size_t len, int &fd, uint64_t &fileOffset) override {
+        shared_lock<shared_mutex> guard(lock);
+        if (pages.find(offset) != pages.end()) return false;
+        return base->descriptorFor(offset, len, fd, fileOffset);
+    }
+};
@@ -1,4 +1,11 @@
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WRITE_INDEX_X86 1
+#endif
 
 // Functions for big-endian conversion
 bool is_bigendian() {
@@ -7,11 +14,7 @@ bool is_bigendian() {
 }
 
 uint64_t reverse_bytes(uint64_t x) {
-    uint8_t dest[sizeof(uint64_t)];
-    uint8_t *source = (uint8_t*)&x;
-    for (int c = 0; c < (int)sizeof(uint64_t); c++)
-        dest[c] = source[sizeof(uint64_t)-c-1];
-    return *(uint64_t*)dest;
+    return __builtin_bswap64(x);
 }
 
 uint64_t hostToBig(uint64_t x) {
@@ -27,3 +30,82 @@ uint64_t bigToHost(uint64_t x) {
     }
     return x;
 }
+
+// Byte-swap an array of n 64-bit words one word at a time (src and dst may not overlap)
+void reverseWordsScalar(const uint8_t *src, uint8_t *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint64_t word;
+        memcpy(&word, src + i*8, 8);
+        word = reverse_bytes(word);
+        memcpy(dst + i*8, &word, 8);
+    }
+}
+
+#ifdef WRITE_INDEX_X86
+// Byte-swap 64-bit words four at a time with one AVX2 shuffle per 32 bytes
+__attribute__((target("avx2")))
+void reverseWordsAvx2(const uint8_t *src, uint8_t *dst, size_t n) {
+    const __m256i mask = _mm256_setr_epi8(7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8,
+                                          7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i words = _mm256_loadu_si256((const __m256i*)(src + i*8));
+        _mm256_storeu_si256((__m256i*)(dst + i*8), _mm256_shuffle_epi8(words, mask));
+    }
+    reverseWordsScalar(src + i*8, dst + i*8, n - i);
+}
+
+// Byte-swap 64-bit words two at a time with one SSSE3 shuffle per 16 bytes
+__attribute__((target("ssse3")))
+void reverseWordsSsse3(const uint8_t *src, uint8_t *dst, size_t n) {
+    const __m128i mask = _mm_setr_epi8(7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i words = _mm_loadu_si128((const __m128i*)(src + i*8));
+        _mm_storeu_si128((__m128i*)(dst + i*8), _mm_shuffle_epi8(words, mask));
+    }
+    reverseWordsScalar(src + i*8, dst + i*8, n - i);
+}
+#endif
+
+typedef void (*ReverseWordsFn)(const uint8_t *src, uint8_t *dst, size_t n);
+
+// Pick the widest byte-swap kernel the CPU supports
+static ReverseWordsFn selectReverseWords() {
+#ifdef WRITE_INDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return reverseWordsAvx2;
+    if (__builtin_cpu_supports("ssse3")) return reverseWordsSsse3;
+#endif
+    return reverseWordsScalar;
+}
+
+static const ReverseWordsFn reverseWords = selectReverseWords();
+
+// Name of the byte-swap kernel in use, for benchmarks
+const char *reverseWordsKernel() {
+    if (reverseWords == reverseWordsScalar) return "scalar";
+#ifdef WRITE_INDEX_X86
+    if (reverseWords == reverseWordsAvx2) return "avx2";
+    if (reverseWords == reverseWordsSsse3) return "ssse3";
+#endif
+    return "unknown";
+}
+
+// Convert n big-endian words from a block buffer into host-order integers
+void bigToHostArray(const uint8_t *src, uint64_t *dst, size_t n) {
+    if (is_bigendian()) {
+        memcpy(dst, src, n * 8);
+    } else {
+        reverseWords(src, (uint8_t*)dst, n);
+    }
+}
+
+// Convert n host-order integers into big-endian words in a block buffer
+void hostToBigArray(const uint64_t *src, uint8_t *dst, size_t n) {
+    if (is_bigendian()) {
+        memcpy(dst, src, n * 8);
+    } else {
+        reverseWords((const uint8_t*)src, dst, n);
+    }
+}